@@ -0,0 +1,1537 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "batch.h"
+#include "books.h"
+#include "helpers.h"
+#include "requests.h"
+#include "session.h"
+#include "client.h"
+#include "library.h"
+#include "parson.h"
+
+#define INPUT_BUFFER_SIZE (1 << 16)
+#define NUMBER_ARG_SIZE 32
+
+/* Longest escape of a character in a JSON string, \u00XX */
+#define JSON_ESCAPE_SIZE 6
+
+/* Room for the value of Content-Length and the blank line after it */
+#define CONTENT_LENGTH_SIZE 24
+
+/* A connection kept alive across requests */
+typedef struct {
+    int sockfd;             /* -1 when not connected */
+    int used;               /* a response already arrived on it */
+} batch_connection;
+
+/* A command read from the input, or a row of an imported file */
+typedef struct {
+    size_t line;
+    JSON_Value *command;    /* NULL if the line couldn't be parsed */
+    char *request;          /* the prebuilt POST request of a row */
+    size_t offset;          /* where the request starts in its buffer */
+    size_t size;
+    int retried;            /* sent again after the server refused its token */
+} batch_job;
+
+/* Progress of the file being imported */
+typedef struct {
+    const char *path;
+    size_t rows;
+    size_t imported;
+    size_t rejected;        /* rows that weren't valid */
+    size_t failed;          /* rows the server didn't add */
+} batch_import_state;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_cond_t idle;
+    batch_job queue[BATCH_QUEUE_SIZE];
+    size_t head;
+    size_t count;
+    size_t pending;         /* commands queued or running */
+    int done;               /* no more commands will be queued */
+
+    pthread_mutex_t output; /* held while a result line is written */
+    int failed;
+    batch_import_state import;
+
+    void (*sigpipe)(int);   /* the SIGPIPE handler to restore */
+
+    /* commands whose token the server refused, run again by the reader
+       once it renewed the token; at most every queued and running command */
+    batch_job refused[BATCH_QUEUE_SIZE + BATCH_MAX_JOBS];
+    size_t refused_count;
+
+    /* the session is only changed while no worker is running */
+    char *user;
+    char *cookie;
+    char *jwt;
+    time_t jwt_expiry;
+} batch;
+
+static const char *command_name(const batch_job *job)
+{
+    return json_object_get_string(json_object(job->command), "command");
+}
+
+/* Writes the result of a command as a line of JSON, taking result */
+static void report(batch *batch, const batch_job *job, int status, JSON_Value *result, const char *error)
+{
+    JSON_Value *value = json_value_init_object();
+    JSON_Object *object = json_object(value);
+    int ok = error == NULL && status >= 200 && status < 300;
+
+    json_object_set_number(object, "line", job->line);
+    if (command_name(job)) {
+        json_object_set_string(object, "command", command_name(job));
+    }
+    json_object_set_boolean(object, "ok", ok);
+    if (status > 0) {
+        json_object_set_number(object, "status", status);
+    }
+    if (error) {
+        json_object_set_string(object, "error", error);
+    } else if (result) {
+        json_object_set_value(object, "result", result);
+        result = NULL;
+    }
+
+    char *line = json_serialize_to_string(value);
+
+    pthread_mutex_lock(&batch->output);
+    if (line) {
+        fputs(line, stdout);
+        putchar('\n');
+    }
+    if (!ok) {
+        batch->failed = 1;
+    }
+    pthread_mutex_unlock(&batch->output);
+
+    json_free_serialized_string(line);
+    json_value_free(value);
+    json_value_free(result);
+}
+
+/* Sends size bytes of a request and returns the response, NULL if the server
+   couldn't be reached; a kept alive connection the server closed is opened
+   again once */
+static char *send_request(batch_connection *connection, const char *request, size_t size)
+{
+    char *response = NULL;
+
+    for (int attempt = 0; attempt < 2 && response == NULL; attempt++) {
+        if (connection->sockfd < 0) {
+            connection->sockfd = try_open_connection(IP, PORT, AF_INET, SOCK_STREAM, 0);
+            connection->used = 0;
+            if (connection->sockfd < 0) {
+                break;
+            }
+        }
+
+        if (try_send_to_server(connection->sockfd, request, size) == 0) {
+            response = try_receive_from_server(connection->sockfd);
+        }
+
+        if (response == NULL) {
+            /* a fresh connection failing won't do better the second time */
+            int reused = connection->used;
+            close(connection->sockfd);
+            connection->sockfd = -1;
+            if (!reused) {
+                break;
+            }
+        }
+    }
+
+    if (response == NULL) {
+        return NULL;
+    }
+    connection->used = 1;
+
+    char *close_header = response_header(response, "Connection");
+    if (close_header && !strcasecmp(close_header, "close")) {
+        close(connection->sockfd);
+        connection->sockfd = -1;
+    }
+    free(close_header);
+
+    return response;
+}
+
+/* Sends a request made of a message and a body (NULL if it has none) in a
+   single write, and returns the response */
+static char *exchange(batch_connection *connection, const char *message, const char *body)
+{
+    size_t message_size = strlen(message);
+    size_t body_size = body ? strlen(body) : 0;
+    char *request = malloc(message_size + body_size);
+
+    if (request == NULL) {
+        return NULL;
+    }
+
+    memcpy(request, message, message_size);
+    if (body) {
+        memcpy(request + message_size, body, body_size);
+    }
+
+    char *response = send_request(connection, request, message_size + body_size);
+    free(request);
+
+    return response;
+}
+
+/* Returns the JSON body of a response, NULL if it has none */
+static JSON_Value *response_body(const char *response)
+{
+    const char *body = strstr(response, "\r\n\r\n");
+
+    return body ? json_parse_string(body + 4) : NULL;
+}
+
+/* Reports a response, with its body as the result if with_body is set;
+   returns its status, 0 if there was no response */
+static int report_response(batch *batch, const batch_job *job, const char *response, int with_body)
+{
+    if (response == NULL) {
+        report(batch, job, 0, NULL, "Failed to reach the server.");
+        return 0;
+    }
+
+    int status = response_status(response);
+    JSON_Value *body = response_body(response);
+
+    if (status >= 200 && status < 300) {
+        report(batch, job, status, with_body ? body : NULL, NULL);
+        if (!with_body) {
+            json_value_free(body);
+        }
+        return status;
+    }
+
+    const char *error = json_object_get_string(json_object(body), "error");
+    report(batch, job, status, NULL, error ? error : "Request failed.");
+    json_value_free(body);
+
+    return status;
+}
+
+/* Keeps a command whose token the server refused, for the reader to run it
+   again with a renewed one; a command is copied, while the request of a row
+   is taken over; returns 1 if it was kept, 0 if the response should be
+   reported, since the token wasn't refused or was already renewed */
+static int keep_refused(batch *batch, const batch_job *job, const char *response)
+{
+    int status = response ? response_status(response) : 0;
+
+    if ((status != 401 && status != 403) || job->retried) {
+        return 0;
+    }
+
+    batch_job copy = *job;
+    copy.retried = 1;
+    if (job->command) {
+        copy.command = json_value_deep_copy(job->command);
+        if (copy.command == NULL) {
+            return 0;
+        }
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    batch->refused[batch->refused_count++] = copy;
+    pthread_mutex_unlock(&batch->lock);
+
+    return 1;
+}
+
+/* Returns a string field of object, or an integral number one formatted into
+   buffer, "" if it doesn't have it */
+static const char *arg(const JSON_Object *object, const char *name, char buffer[NUMBER_ARG_SIZE])
+{
+    JSON_Value *value = json_object_get_value(object, name);
+    double number;
+
+    switch (json_value_get_type(value)) {
+    case JSONString:
+        return json_value_get_string(value);
+    case JSONNumber:
+        number = json_value_get_number(value);
+        if (number >= 0 && number < 1e15 && number == (double) (long long) number) {
+            snprintf(buffer, NUMBER_ARG_SIZE, "%lld", (long long) number);
+            return buffer;
+        }
+        return "";
+    default:
+        return "";
+    }
+}
+
+static int is_number(const char *string)
+{
+    if (*string == '\0') {
+        return 0;
+    }
+
+    for (; *string != '\0'; string++) {
+        if (!isdigit((unsigned char) *string)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Returns the URL of the book with the id argument, NULL if it isn't valid */
+static char *book_url(batch *batch, const batch_job *job)
+{
+    char buffer[NUMBER_ARG_SIZE];
+    const char *id = arg(json_object(job->command), "id", buffer);
+
+    if (!is_number(id)) {
+        report(batch, job, 0, NULL, "ID must be a number.");
+        return NULL;
+    }
+
+    size_t size = strlen(BOOKS_ACCESS) + strlen(id) + 2;
+    char *url = malloc(size);
+    if (url) {
+        snprintf(url, size, "%s/%s", BOOKS_ACCESS, id);
+    }
+
+    return url;
+}
+
+/* Returns the body of a register or login request, NULL if the credentials aren't valid */
+static char *credentials_body(batch *batch, const batch_job *job)
+{
+    char buffer[NUMBER_ARG_SIZE];
+    const char *username = arg(json_object(job->command), "username", buffer);
+    const char *password = json_object_get_string(json_object(job->command), "password");
+
+    if (password == NULL) {
+        password = "";
+    }
+
+    if (strchr(username, ' ') || strchr(password, ' ')) {
+        report(batch, job, 0, NULL, "Username and password cannot contain spaces.");
+        return NULL;
+    }
+
+    JSON_Value *value = json_value_init_object();
+    json_object_set_string(json_object(value), "username", username);
+    json_object_set_string(json_object(value), "password", password);
+    char *body = json_serialize_to_string(value);
+    json_value_free(value);
+
+    return body;
+}
+
+/* Posts a JSON body and returns the response */
+static char *post(batch_connection *connection, char *url, const char *body, char *jwt)
+{
+    char *message = compute_post_request_headers(HOST, url, PAYLOAD_TYPE, strlen(body), jwt);
+    char *response = exchange(connection, message, body);
+
+    free(message);
+    return response;
+}
+
+static void run_register(batch *batch, batch_connection *connection, const batch_job *job)
+{
+    char *body = credentials_body(batch, job);
+
+    if (body == NULL) {
+        return;
+    }
+
+    char *response = post(connection, REGISTER_ACCESS, body, NULL);
+
+    report_response(batch, job, response, 1);
+    json_free_serialized_string(body);
+    free(response);
+}
+
+static void run_get_books(batch *batch, batch_connection *connection, const batch_job *job)
+{
+    char *message = compute_get_request(HOST, BOOKS_ACCESS, NULL, batch->jwt);
+    char *response = exchange(connection, message, NULL);
+
+    if (!keep_refused(batch, job, response)) {
+        report_response(batch, job, response, 1);
+    }
+    free(message);
+    free(response);
+}
+
+static void run_get_book(batch *batch, batch_connection *connection, const batch_job *job)
+{
+    char *url = book_url(batch, job);
+
+    if (url == NULL) {
+        return;
+    }
+
+    char *message = compute_get_request(HOST, url, NULL, batch->jwt);
+    char *response = exchange(connection, message, NULL);
+
+    if (!keep_refused(batch, job, response)) {
+        report_response(batch, job, response, 1);
+    }
+    free(url);
+    free(message);
+    free(response);
+}
+
+static void run_delete_book(batch *batch, batch_connection *connection, const batch_job *job)
+{
+    char *url = book_url(batch, job);
+
+    if (url == NULL) {
+        return;
+    }
+
+    char *message = compute_delete_request(HOST, url, NULL, batch->jwt);
+    char *response = exchange(connection, message, NULL);
+
+    if (!keep_refused(batch, job, response)) {
+        report_response(batch, job, response, 1);
+    }
+    free(url);
+    free(message);
+    free(response);
+}
+
+static void run_add_book(batch *batch, batch_connection *connection, const batch_job *job)
+{
+    char buffers[BOOK_INPUT_FIELD_COUNT][NUMBER_ARG_SIZE];
+    const char *values[BOOK_INPUT_FIELD_COUNT];
+
+    for (size_t i = 0; i < BOOK_INPUT_FIELD_COUNT; i++) {
+        values[i] = arg(json_object(job->command), book_input_fields[i], buffers[i]);
+    }
+
+    const char *invalid = book_input_error(values[0], values[1], values[2], values[3], values[4]);
+    if (invalid) {
+        report(batch, job, 0, NULL, invalid);
+        return;
+    }
+
+    JSON_Value *value = json_value_init_object();
+    for (size_t i = 0; i < BOOK_INPUT_FIELD_COUNT; i++) {
+        json_object_set_string(json_object(value), book_input_fields[i], values[i]);
+    }
+    char *body = json_serialize_to_string(value);
+    json_value_free(value);
+
+    char *response = post(connection, BOOKS_ACCESS, body, batch->jwt);
+
+    if (!keep_refused(batch, job, response)) {
+        report_response(batch, job, response, 1);
+    }
+    json_free_serialized_string(body);
+    free(response);
+}
+
+static void set_jwt(batch *batch, char *jwt)
+{
+    free(batch->jwt);
+    batch->jwt = jwt;
+    batch->jwt_expiry = jwt ? jwt_expiry(jwt) : 0;
+}
+
+/* Gets a JWT token with the session cookie, like the interactive mode does;
+   returns the status of the response and sets *error if there is no token */
+static int enter_library(batch *batch, const char **error)
+{
+    int status = renew_token(batch->cookie, batch->user, &batch->jwt);
+
+    batch->jwt_expiry = batch->jwt ? jwt_expiry(batch->jwt) : 0;
+    *error = NULL;
+    if (status == 0) {
+        /* the token is kept, the server may just be down for a moment */
+        *error = "Failed to reach the server.";
+    } else if (batch->jwt == NULL) {
+        *error = "Failed to enter the library.";
+    }
+
+    return status;
+}
+
+static void run_login(batch *batch, batch_connection *connection, const batch_job *job)
+{
+    char buffer[NUMBER_ARG_SIZE];
+    char *body = credentials_body(batch, job);
+
+    if (body == NULL) {
+        return;
+    }
+
+    char *response = post(connection, LOGIN_ACCESS, body, NULL);
+    json_free_serialized_string(body);
+
+    /* the session cookie is the first part of Set-Cookie */
+    char *cookie = response ? response_header(response, "Set-Cookie") : NULL;
+    if (report_response(batch, job, response, 0) / 100 == 2 && cookie) {
+        cookie[strcspn(cookie, ";")] = '\0';
+        free(batch->user);
+        free(batch->cookie);
+        batch->user = strdup(arg(json_object(job->command), "username", buffer));
+        batch->cookie = cookie;
+        cookie = NULL;
+        set_jwt(batch, NULL);
+        session_save(SESSION_PATH, batch->user, batch->cookie, NULL);
+    }
+
+    free(cookie);
+    free(response);
+}
+
+static void run_enter_library(batch *batch, batch_connection *connection, const batch_job *job)
+{
+    const char *error;
+
+    if (batch->cookie == NULL) {
+        report(batch, job, 0, NULL, "You must be logged in to enter the library.");
+        return;
+    }
+
+    int status = enter_library(batch, &error);
+    report(batch, job, status, NULL, error);
+}
+
+static void run_logout(batch *batch, batch_connection *connection, const batch_job *job)
+{
+    if (batch->cookie == NULL) {
+        report(batch, job, 0, NULL, "You are not logged in.");
+        return;
+    }
+
+    char *message = compute_get_request(HOST, LOGOUT_ACCESS, batch->cookie, NULL);
+    char *response = exchange(connection, message, NULL);
+
+    report_response(batch, job, response, 0);
+    session_forget(SESSION_PATH);
+    free(batch->user);
+    free(batch->cookie);
+    batch->user = NULL;
+    batch->cookie = NULL;
+    set_jwt(batch, NULL);
+
+    free(message);
+    free(response);
+}
+
+static void run_import_books(batch *batch, batch_connection *connection, const batch_job *job);
+
+typedef void (*batch_command)(batch *batch, batch_connection *connection, const batch_job *job);
+
+/* Where a command runs */
+typedef enum {
+    BATCH_WORKER,           /* by a worker, at the same time as others */
+    BATCH_AFTER_QUEUE,      /* by the reader, once the commands before it finished */
+    BATCH_READER,           /* by the reader, queueing work of its own */
+} batch_mode;
+
+static const struct {
+    const char *name;
+    batch_command run;
+    batch_mode mode;
+    int needs_token;
+} commands[] = {
+    { "register", run_register, BATCH_WORKER, 0 },
+    { "login", run_login, BATCH_AFTER_QUEUE, 0 },
+    { "enter_library", run_enter_library, BATCH_AFTER_QUEUE, 0 },
+    { "get_books", run_get_books, BATCH_WORKER, 1 },
+    { "get_book", run_get_book, BATCH_WORKER, 1 },
+    { "add_book", run_add_book, BATCH_WORKER, 1 },
+    { "import_books", run_import_books, BATCH_READER, 1 },
+    { "delete_book", run_delete_book, BATCH_WORKER, 1 },
+    { "logout", run_logout, BATCH_AFTER_QUEUE, 0 },
+};
+
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+static int find_command(const char *name)
+{
+    for (size_t i = 0; name && i < COMMAND_COUNT; i++) {
+        if (!strcmp(commands[i].name, name)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Reports the outcome of a row of the file being imported; a row that wasn't
+   sent was rejected for error, and one sent without a response failed for
+   error, if given */
+static void report_row(batch *batch, size_t row, int sent, const char *response, const char *error)
+{
+    JSON_Value *value = json_value_init_object();
+    JSON_Object *object = json_object(value);
+    JSON_Value *body = NULL;
+    int status = response ? response_status(response) : 0;
+    int ok = status >= 200 && status < 300;
+
+    if (sent && response == NULL) {
+        if (error == NULL) {
+            error = "Failed to reach the server.";
+        }
+    } else if (sent && !ok) {
+        body = response_body(response);
+        error = json_object_get_string(json_object(body), "error");
+        if (error == NULL) {
+            error = "Request failed.";
+        }
+    }
+
+    json_object_set_string(object, "file", batch->import.path);
+    json_object_set_number(object, "row", row);
+    json_object_set_boolean(object, "ok", ok);
+    if (status > 0) {
+        json_object_set_number(object, "status", status);
+    }
+    if (!ok) {
+        json_object_set_string(object, "error", error);
+    }
+
+    char *line = json_serialize_to_string(value);
+
+    pthread_mutex_lock(&batch->output);
+    if (line) {
+        fputs(line, stdout);
+        putchar('\n');
+    }
+    if (ok) {
+        batch->import.imported++;
+    } else {
+        batch->failed = 1;
+        if (sent) {
+            batch->import.failed++;
+        } else {
+            batch->import.rejected++;
+        }
+    }
+    pthread_mutex_unlock(&batch->output);
+
+    json_free_serialized_string(line);
+    json_value_free(value);
+    json_value_free(body);
+}
+
+static void run_import_row(batch *batch, batch_connection *connection, batch_job *job)
+{
+    char *response = send_request(connection, job->request + job->offset, job->size);
+
+    /* a refused row keeps its request, to be sent again with the new token */
+    if (keep_refused(batch, job, response)) {
+        free(response);
+        return;
+    }
+
+    report_row(batch, job->line, 1, response, NULL);
+    free(response);
+    free(job->request);
+}
+
+static void *worker(void *context)
+{
+    batch *batch = context;
+    batch_connection connection = { -1, 0 };
+
+    pthread_mutex_lock(&batch->lock);
+    while (1) {
+        while (batch->count == 0 && !batch->done) {
+            pthread_cond_wait(&batch->not_empty, &batch->lock);
+        }
+        if (batch->count == 0) {
+            break;
+        }
+
+        batch_job job = batch->queue[batch->head];
+        batch->head = (batch->head + 1) % BATCH_QUEUE_SIZE;
+        batch->count--;
+        pthread_cond_signal(&batch->not_full);
+        pthread_mutex_unlock(&batch->lock);
+
+        if (job.request) {
+            run_import_row(batch, &connection, &job);
+        } else {
+            commands[find_command(command_name(&job))].run(batch, &connection, &job);
+            json_value_free(job.command);
+        }
+
+        pthread_mutex_lock(&batch->lock);
+        /* flush while nothing else is in flight, so readers see the results */
+        if (--batch->pending == 0) {
+            pthread_mutex_lock(&batch->output);
+            fflush(stdout);
+            pthread_mutex_unlock(&batch->output);
+            pthread_cond_broadcast(&batch->idle);
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    if (connection.sockfd >= 0) {
+        close(connection.sockfd);
+    }
+
+    return NULL;
+}
+
+static void enqueue(batch *batch, batch_job job)
+{
+    pthread_mutex_lock(&batch->lock);
+    while (batch->count == BATCH_QUEUE_SIZE) {
+        pthread_cond_wait(&batch->not_full, &batch->lock);
+    }
+    batch->queue[(batch->head + batch->count) % BATCH_QUEUE_SIZE] = job;
+    batch->count++;
+    batch->pending++;
+    pthread_cond_signal(&batch->not_empty);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static void wait_idle(batch *batch)
+{
+    pthread_mutex_lock(&batch->lock);
+    while (batch->pending > 0) {
+        pthread_cond_wait(&batch->idle, &batch->lock);
+    }
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/* Enters the library again once the requests carrying the token finished;
+   a server that refuses the session cookie as well makes the saved session
+   useless, so it is forgotten; returns -1, setting *error, if it failed */
+static int renew_batch_token(batch *batch, const char **error)
+{
+    wait_idle(batch);
+
+    int status = enter_library(batch, error);
+    if (status / 100 == 2 && *error == NULL) {
+        return 0;
+    }
+
+    if (status != 0) {
+        session_forget(SESSION_PATH);
+    }
+    if (*error == NULL) {
+        *error = "Failed to renew the token.";
+    }
+
+    return -1;
+}
+
+/* Enters the library again if the token is known to be expired; returns 1 if
+   it was renewed, 0 if it didn't have to be, and -1, setting *error, if it failed */
+static int renew_expired_token(batch *batch, const char **error)
+{
+    *error = NULL;
+    if (batch->jwt_expiry == 0 || time(NULL) < batch->jwt_expiry - SESSION_EXPIRY_MARGIN) {
+        return 0;
+    }
+
+    return renew_batch_token(batch, error) < 0 ? -1 : 1;
+}
+
+/* Reads the rows of a file to import */
+typedef struct {
+    FILE *input;
+    int csv;                /* CSV with a header row, JSONL otherwise */
+    char *line;
+    size_t capacity;
+    size_t number;          /* lines read so far */
+
+    /* CSV */
+    char *record;           /* a record, which can span lines inside quotes */
+    size_t record_size;
+    size_t record_capacity;
+    char **fields;
+    size_t fields_capacity;
+    size_t columns[BOOK_INPUT_FIELD_COUNT];
+
+    /* JSONL */
+    JSON_Value *row;
+    char buffers[BOOK_INPUT_FIELD_COUNT][NUMBER_ARG_SIZE];
+} row_reader;
+
+/* Reads the next CSV record into reader->record; returns 0 at the end of the file */
+static int read_csv_record(row_reader *reader)
+{
+    int quoted = 0;
+
+    reader->record_size = 0;
+    do {
+        ssize_t length = getline(&reader->line, &reader->capacity, reader->input);
+        if (length < 0) {
+            break;
+        }
+        reader->number++;
+
+        for (ssize_t i = 0; i < length; i++) {
+            if (reader->line[i] == '"') {
+                quoted = !quoted;
+            }
+        }
+
+        if (reader->record_size + length + 1 > reader->record_capacity) {
+            reader->record_capacity = 2 * (reader->record_size + length + 1);
+            reader->record = realloc(reader->record, reader->record_capacity);
+            if (reader->record == NULL) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memcpy(reader->record + reader->record_size, reader->line, length);
+        reader->record_size += length;
+    } while (quoted);
+
+    if (reader->record_size == 0) {
+        return 0;
+    }
+
+    while (reader->record_size > 0 && (reader->record[reader->record_size - 1] == '\n'
+                                       || reader->record[reader->record_size - 1] == '\r')) {
+        reader->record_size--;
+    }
+    reader->record[reader->record_size] = '\0';
+
+    return 1;
+}
+
+/* Splits reader->record in place into its fields, unquoting them; returns the
+   number of fields, -1 if a quoted field isn't closed or is followed by more */
+static int split_csv_record(row_reader *reader)
+{
+    char *in = reader->record;
+    size_t count = 0;
+
+    while (1) {
+        if (count == reader->fields_capacity) {
+            reader->fields_capacity = reader->fields_capacity ? 2 * reader->fields_capacity : 8;
+            reader->fields = realloc(reader->fields, reader->fields_capacity * sizeof(char *));
+            if (reader->fields == NULL) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        char *out = in;
+        reader->fields[count++] = out;
+
+        if (*in == '"') {
+            /* "" stands for a quote inside a quoted field */
+            for (in++; *in != '"' || in[1] == '"'; in++) {
+                if (*in == '\0') {
+                    return -1;
+                }
+                if (*in == '"') {
+                    in++;
+                }
+                *out++ = *in;
+            }
+            in++;
+            if (*in != ',' && *in != '\0') {
+                return -1;
+            }
+        } else {
+            while (*in != ',' && *in != '\0') {
+                *out++ = *in++;
+            }
+        }
+
+        char end = *in;
+        *out = '\0';
+        if (end == '\0') {
+            return count;
+        }
+        in++;
+    }
+}
+
+/* Opens a file to import, CSV if its name ends in .csv and JSONL otherwise,
+   and reads the header of a CSV file; returns NULL on success, else why the
+   file can't be imported */
+static const char *row_reader_open(row_reader *reader, const char *path)
+{
+    size_t length = strlen(path);
+
+    memset(reader, 0, sizeof(*reader));
+    reader->csv = length >= 4 && !strcasecmp(path + length - 4, ".csv");
+    reader->input = fopen(path, "r");
+    if (reader->input == NULL) {
+        return "Failed to open the file.";
+    }
+    setvbuf(reader->input, NULL, _IOFBF, INPUT_BUFFER_SIZE);
+
+    if (!reader->csv) {
+        return NULL;
+    }
+
+    int count = read_csv_record(reader) ? split_csv_record(reader) : -1;
+    for (size_t i = 0; i < BOOK_INPUT_FIELD_COUNT; i++) {
+        reader->columns[i] = count;
+        for (int column = 0; column < count; column++) {
+            if (!strcasecmp(reader->fields[column], book_input_fields[i])) {
+                reader->columns[i] = column;
+                break;
+            }
+        }
+        if (count < 0 || reader->columns[i] == (size_t) count) {
+            return "The header must name the title, author, genre, publisher and page_count columns.";
+        }
+    }
+
+    return NULL;
+}
+
+static void row_reader_close(row_reader *reader)
+{
+    if (reader->input) {
+        fclose(reader->input);
+    }
+    free(reader->line);
+    free(reader->record);
+    free(reader->fields);
+    json_value_free(reader->row);
+}
+
+/* Reads the next row into values, valid until the next call, and the number
+   of the line it starts on into *row; returns 1 for a row, -1 for a row that
+   can't be parsed and 0 at the end of the file */
+static int read_row(row_reader *reader, const char *values[BOOK_INPUT_FIELD_COUNT], size_t *row)
+{
+    if (reader->csv) {
+        do {
+            *row = reader->number + 1;
+            if (!read_csv_record(reader)) {
+                return 0;
+            }
+        } while (reader->record_size == 0);
+
+        int count = split_csv_record(reader);
+        if (count < 0) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < BOOK_INPUT_FIELD_COUNT; i++) {
+            values[i] = reader->columns[i] < (size_t) count ? reader->fields[reader->columns[i]] : "";
+        }
+        return 1;
+    }
+
+    json_value_free(reader->row);
+    reader->row = NULL;
+
+    char *line;
+    do {
+        if (getline(&reader->line, &reader->capacity, reader->input) < 0) {
+            return 0;
+        }
+        *row = ++reader->number;
+        for (line = reader->line; isspace((unsigned char) *line); line++);
+    } while (*line == '\0');
+
+    reader->row = json_parse_string(line);
+    JSON_Object *object = json_object(reader->row);
+    if (object == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < BOOK_INPUT_FIELD_COUNT; i++) {
+        values[i] = arg(object, book_input_fields[i], reader->buffers[i]);
+    }
+    return 1;
+}
+
+/* Returns the headers shared by the POST requests of an import, ending right
+   before the value of Content-Length */
+static char *import_headers(batch *batch, size_t *size)
+{
+    char *headers = compute_post_request_headers(HOST, BOOKS_ACCESS, PAYLOAD_TYPE, 0, batch->jwt);
+
+    /* Content-Length is the last header */
+    *size = strlen(headers) - strlen("0\r\n\r\n");
+    headers[*size] = '\0';
+
+    return headers;
+}
+
+/* Writes string as a JSON string at out and returns the end of it */
+static char *write_json_string(char *out, const char *string)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    *out++ = '"';
+    for (const unsigned char *p = (const unsigned char *) string; *p != '\0'; p++) {
+        switch (*p) {
+        case '"':
+        case '\\':
+            *out++ = '\\';
+            *out++ = *p;
+            break;
+        case '\n':
+            *out++ = '\\';
+            *out++ = 'n';
+            break;
+        case '\r':
+            *out++ = '\\';
+            *out++ = 'r';
+            break;
+        case '\t':
+            *out++ = '\\';
+            *out++ = 't';
+            break;
+        default:
+            if (*p < 0x20) {
+                memcpy(out, "\\u00", 4);
+                out[4] = hex[*p >> 4];
+                out[5] = hex[*p & 0xf];
+                out += JSON_ESCAPE_SIZE;
+            } else {
+                *out++ = *p;
+            }
+        }
+    }
+    *out++ = '"';
+
+    return out;
+}
+
+/* Builds the POST request of a book in a single pass: the body is serialized
+   straight into place after room for the headers, which are copied in front
+   of it once its length is known; the request starts at *offset */
+static char *book_request(const char *headers, size_t headers_size,
+                          const char *values[BOOK_INPUT_FIELD_COUNT], size_t *offset, size_t *size)
+{
+    size_t capacity = headers_size + CONTENT_LENGTH_SIZE + 2;
+
+    /* "field":"value", with every character of the value escaped at worst */
+    for (size_t i = 0; i < BOOK_INPUT_FIELD_COUNT; i++) {
+        capacity += strlen(book_input_fields[i]) + 6 + JSON_ESCAPE_SIZE * strlen(values[i]);
+    }
+
+    char *request = malloc(capacity);
+    if (request == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *body = request + headers_size + CONTENT_LENGTH_SIZE;
+    char *out = body;
+
+    *out++ = '{';
+    for (size_t i = 0; i < BOOK_INPUT_FIELD_COUNT; i++) {
+        if (i > 0) {
+            *out++ = ',';
+        }
+        out = write_json_string(out, book_input_fields[i]);
+        *out++ = ':';
+        out = write_json_string(out, values[i]);
+    }
+    *out++ = '}';
+
+    char length[CONTENT_LENGTH_SIZE];
+    int length_size = snprintf(length, sizeof(length), "%zu\r\n\r\n", (size_t) (out - body));
+    char *start = body - length_size - headers_size;
+
+    memcpy(start, headers, headers_size);
+    memcpy(start + headers_size, length, length_size);
+    *offset = start - request;
+    *size = out - start;
+
+    return request;
+}
+
+/* Builds the request of a refused row again, with the headers of the renewed token */
+static void rebuild_row(batch *batch, batch_job *job)
+{
+    const char *request = job->request + job->offset;
+    size_t headers_size;
+    size_t body = 0;
+
+    /* the body follows the blank line after the headers */
+    while (memcmp(request + body, "\r\n\r\n", 4) != 0) {
+        body++;
+    }
+    body += 4;
+
+    char *headers = import_headers(batch, &headers_size);
+    char length[CONTENT_LENGTH_SIZE];
+    int length_size = snprintf(length, sizeof(length), "%zu\r\n\r\n", job->size - body);
+    size_t size = headers_size + length_size + job->size - body;
+    char *rebuilt = malloc(size);
+
+    if (rebuilt == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(rebuilt, headers, headers_size);
+    memcpy(rebuilt + headers_size, length, length_size);
+    memcpy(rebuilt + headers_size + length_size, request + body, job->size - body);
+
+    free(headers);
+    free(job->request);
+    job->request = rebuilt;
+    job->offset = 0;
+    job->size = size;
+}
+
+/* Renews the token the server refused to the workers, once all of them are
+   done, and queues the refused commands and rows again; they fail if it can't
+   be renewed; returns 1 if it was renewed, 0 if nothing was refused, and -1,
+   setting *error, if it failed */
+static int retry_refused(batch *batch, const char **error)
+{
+    batch_job refused[BATCH_QUEUE_SIZE + BATCH_MAX_JOBS];
+
+    *error = NULL;
+
+    pthread_mutex_lock(&batch->lock);
+    size_t count = batch->refused_count;
+    pthread_mutex_unlock(&batch->lock);
+
+    if (count == 0) {
+        return 0;
+    }
+
+    /* the commands still running can be refused as well */
+    wait_idle(batch);
+    pthread_mutex_lock(&batch->lock);
+    count = batch->refused_count;
+    memcpy(refused, batch->refused, count * sizeof(batch_job));
+    batch->refused_count = 0;
+    pthread_mutex_unlock(&batch->lock);
+
+    int renewed = batch->cookie == NULL ? -1 : renew_batch_token(batch, error);
+    if (renewed < 0 && *error == NULL) {
+        *error = "Failed to renew the token.";
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (renewed == 0) {
+            if (refused[i].request) {
+                rebuild_row(batch, &refused[i]);
+            }
+            enqueue(batch, refused[i]);
+        } else if (refused[i].request) {
+            report_row(batch, refused[i].line, 1, NULL, *error);
+            free(refused[i].request);
+        } else {
+            report(batch, &refused[i], 0, NULL, *error);
+            json_value_free(refused[i].command);
+        }
+    }
+
+    return renewed == 0 ? 1 : -1;
+}
+
+/* Reports the whole import once its rows finished; line is the number of the
+   command that started it, 0 if there is none */
+static void report_import(batch *batch, size_t line, const struct timespec *start, const char *error)
+{
+    JSON_Value *value = json_value_init_object();
+    JSON_Object *object = json_object(value);
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+
+    pthread_mutex_lock(&batch->output);
+    batch_import_state import = batch->import;
+    pthread_mutex_unlock(&batch->output);
+
+    int ok = error == NULL && import.rejected == 0 && import.failed == 0;
+
+    if (line > 0) {
+        json_object_set_number(object, "line", line);
+    }
+    json_object_set_string(object, "command", "import_books");
+    json_object_set_string(object, "file", import.path);
+    json_object_set_boolean(object, "ok", ok);
+    json_object_set_number(object, "rows", import.rows);
+    json_object_set_number(object, "imported", import.imported);
+    json_object_set_number(object, "rejected", import.rejected);
+    json_object_set_number(object, "failed", import.failed);
+    json_object_set_number(object, "milliseconds", (long long) (seconds * 1000 + 0.5));
+    json_object_set_number(object, "books_per_second",
+                           seconds > 0 ? (long long) (import.imported / seconds + 0.5) : 0);
+    if (error) {
+        json_object_set_string(object, "error", error);
+    }
+
+    char *summary = json_serialize_to_string(value);
+
+    pthread_mutex_lock(&batch->output);
+    if (summary) {
+        fputs(summary, stdout);
+        putchar('\n');
+    }
+    if (!ok) {
+        batch->failed = 1;
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&batch->output);
+
+    json_free_serialized_string(summary);
+    json_value_free(value);
+}
+
+/* Posts the books of a file, reporting every row and then the whole import;
+   line is the number of the command that started it, 0 if there is none */
+static void import_file(batch *batch, const char *path, size_t line)
+{
+    row_reader reader;
+    const char *values[BOOK_INPUT_FIELD_COUNT];
+    const char *error;
+    struct timespec start;
+    size_t headers_size;
+    size_t row;
+    int status;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_mutex_lock(&batch->output);
+    memset(&batch->import, 0, sizeof(batch->import));
+    batch->import.path = path;
+    pthread_mutex_unlock(&batch->output);
+
+    error = row_reader_open(&reader, path);
+    char *headers = import_headers(batch, &headers_size);
+
+    while (error == NULL && (status = read_row(&reader, values, &row)) != 0) {
+        batch->import.rows++;
+
+        const char *invalid = status < 0 ? "Invalid row."
+                              : book_input_error(values[0], values[1], values[2], values[3], values[4]);
+        if (invalid) {
+            report_row(batch, row, 0, NULL, invalid);
+            continue;
+        }
+
+        /* the headers carry the token, build them again if it was renewed,
+           either because it expired or because the server refused it */
+        int renewed = renew_expired_token(batch, &error);
+        if (renewed == 0) {
+            renewed = retry_refused(batch, &error);
+        }
+        if (renewed < 0) {
+            break;
+        }
+        if (renewed) {
+            free(headers);
+            headers = import_headers(batch, &headers_size);
+        }
+
+        batch_job job = { .line = row };
+        job.request = book_request(headers, headers_size, values, &job.offset, &job.size);
+        enqueue(batch, job);
+    }
+
+    /* rows can still be refused while the last ones run */
+    const char *retry_error;
+    wait_idle(batch);
+    if (retry_refused(batch, &retry_error) < 0 && error == NULL) {
+        error = retry_error;
+    }
+    wait_idle(batch);
+    report_import(batch, line, &start, error);
+
+    free(headers);
+    row_reader_close(&reader);
+}
+
+static void run_import_books(batch *batch, batch_connection *connection, const batch_job *job)
+{
+    char buffer[NUMBER_ARG_SIZE];
+    const char *path = arg(json_object(job->command), "file", buffer);
+
+    if (*path == '\0') {
+        report(batch, job, 0, NULL, "Missing file.");
+        return;
+    }
+
+    import_file(batch, path, job->line);
+}
+
+/* Reads a bare or double quoted word at *p, unescaping it in place, and moves
+   *p past the character that ended it, stored in *end; returns NULL if a
+   quote isn't closed */
+static char *read_word(char **p, char stop, char *end)
+{
+    char *in = *p;
+    char *out = *p;
+    char *word = *p;
+
+    if (*in == '"') {
+        for (in++; *in != '"'; in++) {
+            if (*in == '\0') {
+                return NULL;
+            }
+            if (*in == '\\' && in[1] != '\0') {
+                in++;
+            }
+            *out++ = *in;
+        }
+        in++;
+    } else {
+        while (*in != '\0' && !isspace((unsigned char) *in) && *in != stop) {
+            *out++ = *in++;
+        }
+    }
+
+    *end = *in;
+    *p = *in != '\0' ? in + 1 : in;
+    *out = '\0';
+
+    return word;
+}
+
+/* Parses a command and its key=value arguments into a command object */
+static JSON_Value *parse_script_line(char *line)
+{
+    JSON_Value *value = json_value_init_object();
+    JSON_Object *object = json_object(value);
+    char *p = line;
+    char end;
+
+    char *name = read_word(&p, '\0', &end);
+    if (name == NULL || *name == '\0') {
+        json_value_free(value);
+        return NULL;
+    }
+    json_object_set_string(object, "command", name);
+
+    while (1) {
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+        if (*p == '\0') {
+            return value;
+        }
+
+        char *key = read_word(&p, '=', &end);
+        if (key == NULL || *key == '\0' || end != '=') {
+            break;
+        }
+
+        char *argument = read_word(&p, '\0', &end);
+        if (argument == NULL || (end != '\0' && !isspace((unsigned char) end))) {
+            break;
+        }
+        json_object_set_string(object, key, argument);
+    }
+
+    json_value_free(value);
+    return NULL;
+}
+
+/* Parses a line of input; returns 0 for a blank or comment line, -1 if it
+   isn't a valid command, 1 otherwise */
+static int parse_line(char *line, JSON_Value **command)
+{
+    *command = NULL;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    while (isspace((unsigned char) *line)) {
+        line++;
+    }
+
+    if (*line == '\0' || *line == '#') {
+        return 0;
+    }
+
+    *command = *line == '{' ? json_parse_string(line) : parse_script_line(line);
+    if (json_object_get_string(json_object(*command), "command") == NULL) {
+        json_value_free(*command);
+        *command = NULL;
+        return -1;
+    }
+
+    return 1;
+}
+
+/* Runs a command read by the reader thread */
+static void dispatch(batch *batch, batch_connection *connection, batch_job job)
+{
+    int index = find_command(command_name(&job));
+    const char *error;
+
+    /* the commands the server refused the token of go first */
+    retry_refused(batch, &error);
+
+    if (index < 0) {
+        report(batch, &job, 0, NULL, "Invalid command.");
+        json_value_free(job.command);
+        return;
+    }
+
+    if (commands[index].needs_token) {
+        if (batch->jwt == NULL) {
+            report(batch, &job, 0, NULL, "You must enter the library first.");
+            json_value_free(job.command);
+            return;
+        }
+
+        /* never send a token that is known to be expired, renew it first */
+        if (renew_expired_token(batch, &error) < 0) {
+            report(batch, &job, 0, NULL, error);
+            json_value_free(job.command);
+            return;
+        }
+    }
+
+    if (commands[index].mode == BATCH_WORKER) {
+        enqueue(batch, job);
+        return;
+    }
+
+    if (commands[index].mode == BATCH_AFTER_QUEUE) {
+        wait_idle(batch);
+    }
+    commands[index].run(batch, connection, &job);
+    json_value_free(job.command);
+    fflush(stdout);
+}
+
+/* Starts the workers of a batch, returning how many of them there are */
+static int batch_start(batch *batch, pthread_t workers[BATCH_MAX_JOBS], int jobs)
+{
+    if (jobs < 1) {
+        jobs = 1;
+    } else if (jobs > BATCH_MAX_JOBS) {
+        jobs = BATCH_MAX_JOBS;
+    }
+
+    memset(batch, 0, sizeof(*batch));
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_mutex_init(&batch->output, NULL);
+    pthread_cond_init(&batch->not_empty, NULL);
+    pthread_cond_init(&batch->not_full, NULL);
+    pthread_cond_init(&batch->idle, NULL);
+
+    /* writing to a connection the server closed fails instead of killing the client */
+    batch->sigpipe = signal(SIGPIPE, SIG_IGN);
+
+    for (int i = 0; i < jobs; i++) {
+        if (pthread_create(&workers[i], NULL, worker, batch) != 0) {
+            error("ERROR starting a worker");
+        }
+    }
+
+    return jobs;
+}
+
+/* Waits for the queued commands and frees a batch; returns 1 if any command
+   failed, 0 otherwise */
+static int batch_stop(batch *batch, pthread_t workers[BATCH_MAX_JOBS], int jobs)
+{
+    pthread_mutex_lock(&batch->lock);
+    batch->done = 1;
+    pthread_cond_broadcast(&batch->not_empty);
+    pthread_mutex_unlock(&batch->lock);
+
+    for (int i = 0; i < jobs; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    fflush(stdout);
+    signal(SIGPIPE, batch->sigpipe);
+
+    free(batch->user);
+    free(batch->cookie);
+    free(batch->jwt);
+    pthread_mutex_destroy(&batch->lock);
+    pthread_mutex_destroy(&batch->output);
+    pthread_cond_destroy(&batch->not_empty);
+    pthread_cond_destroy(&batch->not_full);
+    pthread_cond_destroy(&batch->idle);
+
+    return batch->failed;
+}
+
+int batch_run(FILE *input, int jobs)
+{
+    batch batch;
+    pthread_t workers[BATCH_MAX_JOBS];
+    batch_connection connection = { -1, 0 };
+    char *line = NULL;
+    size_t capacity = 0;
+    size_t number = 0;
+    const char *error;
+
+    jobs = batch_start(&batch, workers, jobs);
+    setvbuf(input, NULL, _IOFBF, INPUT_BUFFER_SIZE);
+
+    /* start from the saved session, if there is one */
+    if (session_load(SESSION_PATH, &batch.user, &batch.cookie, &batch.jwt) == 0 && batch.jwt) {
+        batch.jwt_expiry = jwt_expiry(batch.jwt);
+    }
+
+    while (getline(&line, &capacity, input) >= 0) {
+        batch_job job = { .line = ++number };
+        int parsed = parse_line(line, &job.command);
+
+        if (parsed == 0) {
+            continue;
+        }
+
+        if (parsed < 0) {
+            report(&batch, &job, 0, NULL, "Invalid command line.");
+            continue;
+        }
+
+        if (!strcmp(command_name(&job), "exit")) {
+            json_value_free(job.command);
+            break;
+        }
+
+        dispatch(&batch, &connection, job);
+    }
+    free(line);
+
+    wait_idle(&batch);
+    retry_refused(&batch, &error);
+
+    if (connection.sockfd >= 0) {
+        close(connection.sockfd);
+    }
+    return batch_stop(&batch, workers, jobs);
+}
+
+static char *copy(const char *string)
+{
+    return string ? strdup(string) : NULL;
+}
+
+int batch_import(const char *path, int jobs, const char *user, const char *cookie, char **jwt)
+{
+    batch batch;
+    pthread_t workers[BATCH_MAX_JOBS];
+
+    jobs = batch_start(&batch, workers, jobs);
+    batch.user = copy(user);
+    batch.cookie = copy(cookie);
+    set_jwt(&batch, copy(*jwt));
+
+    import_file(&batch, path, 0);
+
+    /* hand back the token, renewed if it expired or was refused meanwhile */
+    free(*jwt);
+    *jwt = batch.jwt;
+    batch.jwt = NULL;
+
+    return batch_stop(&batch, workers, jobs);
+}
@@ -0,0 +1,34 @@
+#ifndef _BATCH_
+#define _BATCH_
+
+#include <stdio.h>
+
+// most commands waiting for a worker at a time, the reader blocks beyond it
+#define BATCH_QUEUE_SIZE 256
+
+// most workers, each of them with its own kept alive connection
+#define BATCH_MAX_JOBS 64
+
+// workers of an import started from the interactive mode
+#define BATCH_IMPORT_JOBS 8
+
+// runs the commands read from input, one per line, either as a JSON object
+// ({"command": "get_book", "id": "3"}) or as a command followed by
+// key=value arguments (get_book id=3), and writes a JSON result per line
+// to stdout, tagged with the number of the line it came from; book
+// commands are run by jobs workers at the same time, so their results can
+// come out of order, while login, enter_library and logout wait for the
+// commands before them; import_books file=PATH queues the rows of a file
+// like batch_import; returns 0 if every command succeeded, 1 otherwise
+int batch_run(FILE *input, int jobs);
+
+// imports the books of a CSV file, whose header row names the title, author,
+// genre, publisher and page_count columns, or of a JSONL file with a book
+// object per line; rows are validated like add_book and posted over jobs
+// kept alive connections at a time, writing a JSON result per row and a
+// summary with the throughput; *jwt is replaced by the token the import ended
+// with, renewed and saved with the session if it expired or was refused, NULL
+// if the server refused to renew it; returns 0 if every row was added, 1 otherwise
+int batch_import(const char *path, int jobs, const char *user, const char *cookie, char **jwt);
+
+#endif
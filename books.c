@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <ctype.h>
+#include "books.h"
+
+#define STRING_BLOCK_SIZE 4096
+#define INTERNED_STARTING_CAPACITY 64
+#define BOOKS_STARTING_CAPACITY 16
+
+#define BOOK_FIELD(name, type, flag) { #name, sizeof(#name) - 1, offsetof(book, name), type, flag }
+
+enum field_type {
+    FIELD_INT,
+    FIELD_STRING
+};
+
+struct string_block {
+    string_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+/* Fields of the /library/books responses, in the order the server sends them */
+static const struct book_field {
+    const char *name;
+    size_t name_len;
+    size_t offset;
+    int type;
+    unsigned flag;
+} book_fields[] = {
+    BOOK_FIELD(id, FIELD_INT, BOOK_ID),
+    BOOK_FIELD(title, FIELD_STRING, BOOK_TITLE),
+    BOOK_FIELD(author, FIELD_STRING, BOOK_AUTHOR),
+    BOOK_FIELD(publisher, FIELD_STRING, BOOK_PUBLISHER),
+    BOOK_FIELD(genre, FIELD_STRING, BOOK_GENRE),
+    BOOK_FIELD(page_count, FIELD_INT, BOOK_PAGE_COUNT),
+};
+
+#define BOOK_FIELD_COUNT (sizeof(book_fields) / sizeof(book_fields[0]))
+
+const book_string_field book_string_fields[BOOK_STRING_FIELD_COUNT] = {
+    { offsetof(book, title), BOOK_TITLE },
+    { offsetof(book, author), BOOK_AUTHOR },
+    { offsetof(book, publisher), BOOK_PUBLISHER },
+    { offsetof(book, genre), BOOK_GENRE },
+};
+
+book_list book_list_init(void)
+{
+    book_list list;
+
+    memset(&list, 0, sizeof(list));
+
+    return list;
+}
+
+void book_list_destroy(book_list *list)
+{
+    while (list->strings != NULL) {
+        string_block *next = list->strings->next;
+        free(list->strings);
+        list->strings = next;
+    }
+
+    free(list->books);
+    free(list->interned);
+    *list = book_list_init();
+}
+
+size_t hash_bytes(size_t hash, const void *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ ((const unsigned char *) data)[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+size_t hash_string(const char *string)
+{
+    return hash_bytes(HASH_SEED, string, strlen(string));
+}
+
+/* Copies a string into the current block, starting a new one when it is full */
+static const char *store_string(book_list *list, const char *string, size_t len)
+{
+    string_block *block = list->strings;
+
+    if (block == NULL || block->size - block->used < len + 1) {
+        size_t size = len + 1 > STRING_BLOCK_SIZE ? len + 1 : STRING_BLOCK_SIZE;
+
+        block = malloc(sizeof(string_block) + size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->used = 0;
+        block->size = size;
+        block->next = list->strings;
+        list->strings = block;
+    }
+
+    char *copy = block->data + block->used;
+    memcpy(copy, string, len);
+    copy[len] = '\0';
+    block->used += len + 1;
+
+    return copy;
+}
+
+static int grow_interned(book_list *list)
+{
+    size_t capacity = list->interned_capacity ? list->interned_capacity * 2 : INTERNED_STARTING_CAPACITY;
+    const char **table = calloc(capacity, sizeof(const char *));
+
+    if (table == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < list->interned_capacity; i++) {
+        const char *string = list->interned[i];
+        if (string == NULL) {
+            continue;
+        }
+        size_t slot = hash_string(string) & (capacity - 1);
+        while (table[slot] != NULL) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        table[slot] = string;
+    }
+
+    free(list->interned);
+    list->interned = table;
+    list->interned_capacity = capacity;
+
+    return 0;
+}
+
+/* Returns the single stored copy of string, genres or authors repeat across books */
+static const char *intern_string(book_list *list, const char *string, size_t len)
+{
+    if (list->interned_count * 2 >= list->interned_capacity && grow_interned(list) < 0) {
+        return NULL;
+    }
+
+    size_t slot = hash_bytes(HASH_SEED, string, len) & (list->interned_capacity - 1);
+    while (list->interned[slot] != NULL) {
+        const char *candidate = list->interned[slot];
+        if (strncmp(candidate, string, len) == 0 && candidate[len] == '\0') {
+            return candidate;
+        }
+        slot = (slot + 1) & (list->interned_capacity - 1);
+    }
+
+    const char *copy = store_string(list, string, len);
+    if (copy != NULL) {
+        list->interned[slot] = copy;
+        list->interned_count++;
+    }
+
+    return copy;
+}
+
+static book *current_book(book_decoder *decoder)
+{
+    return &decoder->list->books[decoder->list->count - 1];
+}
+
+/* Scalars are only expected as values of the fields of a book */
+static const struct book_field *scalar_field(book_decoder *decoder, int *expected)
+{
+    *expected = decoder->depth == (decoder->list->is_array ? 2 : 1);
+
+    if (!*expected || decoder->field < 0) {
+        return NULL;
+    }
+
+    current_book(decoder)->fields |= book_fields[decoder->field].flag;
+
+    return &book_fields[decoder->field];
+}
+
+static JSON_Status set_int_field(book_decoder *decoder, const struct book_field *field, double number)
+{
+    if (!isfinite(number) || number < INT_MIN || number > INT_MAX || number != (int) number) {
+        return JSONFailure;
+    }
+
+    *(int *) ((char *) current_book(decoder) + field->offset) = (int) number;
+
+    return JSONSuccess;
+}
+
+static JSON_Status decode_begin_object(void *context)
+{
+    book_decoder *decoder = context;
+    book_list *list = decoder->list;
+
+    if (decoder->depth != (list->is_array ? 1 : 0)) {
+        return JSONFailure;
+    }
+
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : BOOKS_STARTING_CAPACITY;
+        book *books = realloc(list->books, capacity * sizeof(book));
+        if (books == NULL) {
+            return JSONFailure;
+        }
+        list->books = books;
+        list->capacity = capacity;
+    }
+
+    memset(&list->books[list->count++], 0, sizeof(book));
+    decoder->depth++;
+    decoder->field = -1;
+    decoder->last_field = -1;
+
+    return JSONSuccess;
+}
+
+static JSON_Status decode_begin_array(void *context)
+{
+    book_decoder *decoder = context;
+
+    if (decoder->depth != 0) {
+        return JSONFailure;
+    }
+
+    decoder->list->is_array = 1;
+    decoder->depth++;
+
+    return JSONSuccess;
+}
+
+static JSON_Status decode_end(void *context)
+{
+    book_decoder *decoder = context;
+
+    decoder->depth--;
+
+    return JSONSuccess;
+}
+
+/* Only the known fields are expected, in the order of book_fields, so that
+   printing a book gives back what the server sent; anything else is left to
+   the parson fallback */
+static JSON_Status decode_key(void *context, const char *name, size_t len)
+{
+    book_decoder *decoder = context;
+
+    decoder->field = -1;
+    for (int i = decoder->last_field + 1; i < (int) BOOK_FIELD_COUNT; i++) {
+        if (book_fields[i].name_len == len && !memcmp(book_fields[i].name, name, len)) {
+            decoder->field = i;
+            decoder->last_field = i;
+            return JSONSuccess;
+        }
+    }
+
+    return JSONFailure;
+}
+
+static JSON_Status decode_string(void *context, const char *string, size_t len)
+{
+    book_decoder *decoder = context;
+    int expected;
+    const struct book_field *field = scalar_field(decoder, &expected);
+
+    if (field == NULL) {
+        return expected ? JSONSuccess : JSONFailure;
+    }
+
+    /* a number sent as a string (add_book sends page_count so) is printed as
+       is by the fallback */
+    if (field->type != FIELD_STRING || strlen(string) != len) {
+        return JSONFailure;
+    }
+
+    const char *interned = intern_string(decoder->list, string, len);
+    if (interned == NULL) {
+        return JSONFailure;
+    }
+    *(const char **) ((char *) current_book(decoder) + field->offset) = interned;
+
+    return JSONSuccess;
+}
+
+static JSON_Status decode_number(void *context, double number)
+{
+    book_decoder *decoder = context;
+    int expected;
+    const struct book_field *field = scalar_field(decoder, &expected);
+
+    if (field == NULL) {
+        return expected ? JSONSuccess : JSONFailure;
+    }
+
+    if (field->type != FIELD_INT) {
+        return JSONFailure;
+    }
+
+    return set_int_field(decoder, field, number);
+}
+
+/* No field of a book is a boolean or null */
+static JSON_Status decode_boolean(void *context, int boolean)
+{
+    (void) context;
+    (void) boolean;
+
+    return JSONFailure;
+}
+
+static JSON_Status decode_null(void *context)
+{
+    (void) context;
+
+    return JSONFailure;
+}
+
+static const JSON_Stream_Callbacks book_callbacks = {
+    decode_begin_object,
+    decode_end,
+    decode_begin_array,
+    decode_end,
+    decode_key,
+    decode_string,
+    decode_number,
+    decode_boolean,
+    decode_null
+};
+
+int book_decoder_init(book_decoder *decoder, book_list *list)
+{
+    decoder->list = list;
+    decoder->depth = 0;
+    decoder->field = -1;
+    decoder->last_field = -1;
+    decoder->parser = json_stream_parser_init(&book_callbacks, decoder);
+
+    return decoder->parser != NULL ? 0 : -1;
+}
+
+int book_decoder_finish(book_decoder *decoder)
+{
+    JSON_Status status = json_stream_parser_finish(decoder->parser);
+
+    json_stream_parser_free(decoder->parser);
+    decoder->parser = NULL;
+
+    return status == JSONSuccess ? 0 : -1;
+}
+
+int books_decode(book_list *list, const char *json, size_t len)
+{
+    book_decoder decoder;
+
+    if (book_decoder_init(&decoder, list) < 0) {
+        return -1;
+    }
+
+    json_stream_parser_feed(decoder.parser, json, len);
+
+    return book_decoder_finish(&decoder);
+}
+
+const char *const book_input_fields[BOOK_INPUT_FIELD_COUNT] = {
+    "title", "author", "genre", "publisher", "page_count"
+};
+
+const char *book_input_error(const char *title, const char *author, const char *genre,
+                             const char *publisher, const char *page_count)
+{
+    if (!*title || !*author || !*genre || !*publisher || !*page_count) {
+        return "All fields must be completed.";
+    }
+
+    for (const char *c = page_count; *c != '\0'; c++) {
+        if (!isdigit((unsigned char) *c)) {
+            return "Page count must be a number.";
+        }
+    }
+
+    return NULL;
+}
+
+static void print_string(const char *string)
+{
+    putchar('"');
+    for (; *string != '\0'; string++) {
+        unsigned char c = *string;
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+void book_print(const book *book)
+{
+    int first = 1;
+
+    putchar('{');
+    for (size_t i = 0; i < BOOK_FIELD_COUNT; i++) {
+        const struct book_field *field = &book_fields[i];
+        const char *value = (const char *) book + field->offset;
+
+        if (!(book->fields & field->flag)) {
+            continue;
+        }
+
+        printf(first ? "\"%s\":" : ",\"%s\":", field->name);
+        first = 0;
+
+        if (field->type == FIELD_INT) {
+            printf("%d", *(const int *) value);
+        } else {
+            print_string(*(const char * const *) value);
+        }
+    }
+    putchar('}');
+}
+
+void books_print(const book_list *list)
+{
+    if (list->is_array) {
+        putchar('[');
+    }
+
+    for (size_t i = 0; i < list->count; i++) {
+        if (i > 0) {
+            putchar(',');
+        }
+        book_print(&list->books[i]);
+    }
+
+    if (list->is_array) {
+        putchar(']');
+    }
+    putchar('\n');
+}
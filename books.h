@@ -0,0 +1,101 @@
+#ifndef _BOOKS_
+#define _BOOKS_
+
+#include <stddef.h>
+#include "parson.h"
+
+// bits of book.fields, set for every field present in the decoded json
+#define BOOK_ID         (1u << 0)
+#define BOOK_TITLE      (1u << 1)
+#define BOOK_AUTHOR     (1u << 2)
+#define BOOK_PUBLISHER  (1u << 3)
+#define BOOK_GENRE      (1u << 4)
+#define BOOK_PAGE_COUNT (1u << 5)
+
+typedef struct {
+    int id;
+    const char *title;
+    const char *author;
+    const char *publisher;
+    const char *genre;
+    int page_count;
+    unsigned fields;
+} book;
+
+// string fields of a book, in the order the catalog store saves them
+typedef struct {
+    size_t offset;           // of the field in book
+    unsigned flag;           // bit of the field in book.fields
+} book_string_field;
+
+#define BOOK_STRING_FIELD_COUNT 4
+
+extern const book_string_field book_string_fields[BOOK_STRING_FIELD_COUNT];
+
+// the string field of a book at offset
+#define BOOK_STRING(book, offset) (*(const char **) ((char *) (book) + (offset)))
+
+// first value of a FNV-1a hash
+#define HASH_SEED 2166136261u
+
+typedef struct string_block string_block;
+
+typedef struct {
+    book *books;             // contiguous array of decoded books
+    size_t count;
+    size_t capacity;
+    int is_array;            // json was a list of books, not a single book
+    string_block *strings;   // storage of interned strings, shared by all books
+    const char **interned;   // hash table of interned strings
+    size_t interned_count;
+    size_t interned_capacity;
+} book_list;
+
+typedef struct {
+    JSON_Stream_Parser *parser;  // feed the json to this parser
+    book_list *list;
+    int depth;
+    int field;                   // index of the field being decoded, -1 if none
+    int last_field;              // index of the last field of the current book
+} book_decoder;
+
+// continues the FNV-1a hash of data with size more bytes
+size_t hash_bytes(size_t hash, const void *data, size_t size);
+
+// returns the FNV-1a hash of a null terminated string
+size_t hash_string(const char *string);
+
+// initializes an empty book list
+book_list book_list_init(void);
+
+// frees the books and strings of a book list
+void book_list_destroy(book_list *list);
+
+// starts decoding a book or a list of books into list, returns -1 on failure
+int book_decoder_init(book_decoder *decoder, book_list *list);
+
+// ends decoding and frees the parser, returns -1 if the json was invalid
+// or didn't have the expected shape: only the known fields, in the order
+// the server sends them, with their expected types
+int book_decoder_finish(book_decoder *decoder);
+
+// decodes a whole json text into list, returns -1 on failure
+int books_decode(book_list *list, const char *json, size_t len);
+
+// fields of a book to add, in the order book_input_error takes them
+#define BOOK_INPUT_FIELD_COUNT 5
+
+extern const char *const book_input_fields[BOOK_INPUT_FIELD_COUNT];
+
+// checks the fields of a book to add, as typed or read from a file; returns
+// a message describing the first problem, NULL if they are valid
+const char *book_input_error(const char *title, const char *author, const char *genre,
+                             const char *publisher, const char *page_count);
+
+// prints a book as compact json, without a new line
+void book_print(const book *book);
+
+// prints the books of a list as compact json
+void books_print(const book_list *list);
+
+#endif
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "cache.h"
+#include "books.h"
+#include "helpers.h"
+
+#define CACHE_STARTING_CAPACITY 16
+
+http_cache http_cache_init(void)
+{
+    http_cache cache;
+
+    memset(&cache, 0, sizeof(cache));
+
+    return cache;
+}
+
+static void free_entry(http_cache_entry *entry)
+{
+    free(entry->key);
+    free(entry->url);
+    free(entry->response);
+    free(entry->etag);
+    free(entry->last_modified);
+    free(entry);
+}
+
+void http_cache_clear(http_cache *cache)
+{
+    for (size_t i = 0; i < cache->capacity; i++) {
+        while (cache->buckets[i] != NULL) {
+            http_cache_entry *next = cache->buckets[i]->next;
+            free_entry(cache->buckets[i]);
+            cache->buckets[i] = next;
+        }
+    }
+
+    cache->count = 0;
+}
+
+void http_cache_destroy(http_cache *cache)
+{
+    http_cache_clear(cache);
+    free(cache->buckets);
+    *cache = http_cache_init();
+}
+
+/* Joins the parts of a request that select a stored response */
+static char *make_key(const char *method, const char *url, const char *identity)
+{
+    if (identity == NULL) {
+        identity = "";
+    }
+
+    size_t size = strlen(method) + strlen(url) + strlen(identity) + 3;
+    char *key = malloc(size);
+
+    if (key != NULL) {
+        snprintf(key, size, "%s %s\n%s", method, url, identity);
+    }
+
+    return key;
+}
+
+static http_cache_entry **find_slot(http_cache *cache, const char *key)
+{
+    http_cache_entry **slot = &cache->buckets[hash_string(key) & (cache->capacity - 1)];
+
+    while (*slot != NULL && strcmp((*slot)->key, key) != 0) {
+        slot = &(*slot)->next;
+    }
+
+    return slot;
+}
+
+static int grow_buckets(http_cache *cache)
+{
+    size_t capacity = cache->capacity ? cache->capacity * 2 : CACHE_STARTING_CAPACITY;
+    http_cache_entry **buckets = calloc(capacity, sizeof(http_cache_entry *));
+
+    if (buckets == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < cache->capacity; i++) {
+        while (cache->buckets[i] != NULL) {
+            http_cache_entry *entry = cache->buckets[i];
+            size_t bucket = hash_string(entry->key) & (capacity - 1);
+
+            cache->buckets[i] = entry->next;
+            entry->next = buckets[bucket];
+            buckets[bucket] = entry;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->capacity = capacity;
+
+    return 0;
+}
+
+http_cache_entry *http_cache_lookup(http_cache *cache, const char *method,
+                                    const char *url, const char *identity)
+{
+    if (cache->count == 0) {
+        return NULL;
+    }
+
+    char *key = make_key(method, url, identity);
+    if (key == NULL) {
+        return NULL;
+    }
+
+    http_cache_entry *entry = *find_slot(cache, key);
+    free(key);
+
+    return entry;
+}
+
+int http_cache_is_fresh(const http_cache_entry *entry)
+{
+    return time(NULL) - entry->stored_at < entry->ttl;
+}
+
+/* Sets the lifetime of an entry from the Cache-Control header of response,
+   returns -1 if the response must not be stored */
+static int read_lifetime(http_cache_entry *entry, const char *response)
+{
+    char *control = response_header(response, "Cache-Control");
+
+    /* without a max-age, responses with validators are revalidated every time
+       (a 304 is cheap) and the others are kept for a short while */
+    entry->ttl = entry->etag || entry->last_modified ? 0 : HTTP_CACHE_TTL;
+
+    if (control == NULL) {
+        return 0;
+    }
+
+    for (char *c = control; *c != '\0'; c++) {
+        *c = tolower((unsigned char) *c);
+    }
+
+    int status = 0;
+    char *max_age = strstr(control, "max-age=");
+    if (strstr(control, "no-store")) {
+        status = -1;
+    } else if (strstr(control, "no-cache")) {
+        entry->ttl = 0;
+    } else if (max_age) {
+        entry->ttl = strtol(max_age + strlen("max-age="), NULL, 10);
+    }
+
+    free(control);
+
+    /* nothing to revalidate with and never fresh, storing it is useless */
+    if (entry->ttl <= 0 && !entry->etag && !entry->last_modified) {
+        status = -1;
+    }
+
+    return status;
+}
+
+/* Returns the value of a validator header, NULL if it is missing or too long to send back */
+static char *read_validator(const char *response, const char *name)
+{
+    char *value = response_header(response, name);
+
+    if (value && strlen(value) > HTTP_CACHE_MAX_VALIDATOR) {
+        free(value);
+        value = NULL;
+    }
+
+    return value;
+}
+
+/* Replaces the validators of an entry with the ones in response, if any */
+static void read_validators(http_cache_entry *entry, const char *response)
+{
+    char *etag = read_validator(response, "ETag");
+    char *last_modified = read_validator(response, "Last-Modified");
+
+    if (etag) {
+        free(entry->etag);
+        entry->etag = etag;
+    }
+
+    if (last_modified) {
+        free(entry->last_modified);
+        entry->last_modified = last_modified;
+    }
+}
+
+http_cache_entry *http_cache_store(http_cache *cache, const char *method,
+                                   const char *url, const char *identity,
+                                   const char *response)
+{
+    if (cache->count * 2 >= cache->capacity && grow_buckets(cache) < 0) {
+        return NULL;
+    }
+
+    char *key = make_key(method, url, identity);
+    if (key == NULL) {
+        return NULL;
+    }
+
+    http_cache_entry **slot = find_slot(cache, key);
+    if (*slot != NULL) {
+        http_cache_entry *old = *slot;
+        *slot = old->next;
+        free_entry(old);
+        cache->count--;
+    }
+
+    http_cache_entry *entry = calloc(1, sizeof(http_cache_entry));
+    if (entry == NULL || response_status(response) != 200) {
+        free(entry);
+        free(key);
+        return NULL;
+    }
+
+    entry->key = key;
+    read_validators(entry, response);
+    entry->url = strdup(url);
+    entry->response = strdup(response);
+    entry->stored_at = time(NULL);
+
+    if (read_lifetime(entry, response) < 0 || !entry->url || !entry->response) {
+        free_entry(entry);
+        return NULL;
+    }
+
+    entry->next = *slot;
+    *slot = entry;
+    cache->count++;
+
+    return entry;
+}
+
+void http_cache_refresh(http_cache_entry *entry, const char *response)
+{
+    read_validators(entry, response);
+    entry->stored_at = time(NULL);
+
+    /* a 304 carries the cache headers the full response would have had */
+    if (read_lifetime(entry, response) < 0) {
+        entry->ttl = 0;
+    }
+}
+
+void http_cache_invalidate(http_cache *cache, const char *url)
+{
+    for (size_t i = 0; i < cache->capacity; i++) {
+        http_cache_entry **slot = &cache->buckets[i];
+
+        while (*slot != NULL) {
+            if (strcmp((*slot)->url, url) == 0) {
+                http_cache_entry *entry = *slot;
+                *slot = entry->next;
+                free_entry(entry);
+                cache->count--;
+            } else {
+                slot = &(*slot)->next;
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef _CACHE_
+#define _CACHE_
+
+#include <stddef.h>
+#include <time.h>
+
+// seconds a response without validators (ETag / Last-Modified) and
+// without a max-age is served from the cache before it is fetched again
+#define HTTP_CACHE_TTL 5
+
+// longest ETag / Last-Modified kept, longer validators are ignored
+#define HTTP_CACHE_MAX_VALIDATOR 256
+
+typedef struct http_cache_entry {
+    struct http_cache_entry *next;  // next entry of the same bucket
+    char *key;                      // method, url and auth identity
+    char *url;
+    char *response;                 // whole 200 response, headers included
+    char *etag;                     // NULL when the server sent no ETag
+    char *last_modified;            // NULL when the server sent no Last-Modified
+    time_t stored_at;
+    time_t ttl;                     // seconds it is fresh for, 0 to always revalidate
+} http_cache_entry;
+
+typedef struct {
+    http_cache_entry **buckets;
+    size_t count;
+    size_t capacity;
+} http_cache;
+
+// initializes an empty cache
+http_cache http_cache_init(void);
+
+// frees all the entries of a cache
+void http_cache_destroy(http_cache *cache);
+
+// returns the entry stored for a request, NULL if there is none
+// (identity is the token or cookie the request is sent with, can be NULL)
+http_cache_entry *http_cache_lookup(http_cache *cache, const char *method,
+                                    const char *url, const char *identity);
+
+// checks if an entry can be served without asking the server
+int http_cache_is_fresh(const http_cache_entry *entry);
+
+// stores the response to a request, replacing the previous one; responses
+// that can't be cached drop the previous entry and NULL is returned
+http_cache_entry *http_cache_store(http_cache *cache, const char *method,
+                                   const char *url, const char *identity,
+                                   const char *response);
+
+// updates an entry with the headers of a 304 response and restarts its lifetime
+void http_cache_refresh(http_cache_entry *entry, const char *response);
+
+// drops the entries of every method and identity stored for url
+void http_cache_invalidate(http_cache *cache, const char *url);
+
+// drops all the entries of a cache
+void http_cache_clear(http_cache *cache);
+
+#endif
@@ -0,0 +1,353 @@
+#include <stdlib.h>
+#include <string.h>
+#include "catalog.h"
+
+#define CATALOG_STARTING_CAPACITY 64
+
+/* Marks the books a listing has not confirmed yet */
+#define UNCONFIRMED ((time_t) -1)
+
+/* Fields the secondary indexes are keyed by */
+static const struct {
+    size_t offset;
+    unsigned flag;
+} index_fields[CATALOG_INDEXES] = {
+    [CATALOG_BY_AUTHOR] = { offsetof(book, author), BOOK_AUTHOR },
+    [CATALOG_BY_GENRE] = { offsetof(book, genre), BOOK_GENRE },
+    [CATALOG_BY_PUBLISHER] = { offsetof(book, publisher), BOOK_PUBLISHER },
+};
+
+catalog catalog_init(void)
+{
+    catalog catalog;
+
+    memset(&catalog, 0, sizeof(catalog));
+
+    return catalog;
+}
+
+static void free_entry(catalog_entry *entry)
+{
+    for (size_t i = 0; i < BOOK_STRING_FIELD_COUNT; i++) {
+        free((char *) BOOK_STRING(&entry->book, book_string_fields[i].offset));
+    }
+    free(entry);
+}
+
+void catalog_clear(catalog *catalog)
+{
+    free(catalog->version);
+    catalog->version = NULL;
+    catalog->unrevalidated = 0;
+    catalog->changes++;
+
+    for (size_t i = 0; i < catalog->capacity; i++) {
+        while (catalog->buckets[CATALOG_BY_ID][i] != NULL) {
+            catalog_entry *next = catalog->buckets[CATALOG_BY_ID][i]->next[CATALOG_BY_ID];
+            free_entry(catalog->buckets[CATALOG_BY_ID][i]);
+            catalog->buckets[CATALOG_BY_ID][i] = next;
+        }
+        for (int index = CATALOG_BY_ID + 1; index < CATALOG_INDEXES; index++) {
+            catalog->buckets[index][i] = NULL;
+        }
+    }
+
+    catalog->count = 0;
+}
+
+void catalog_destroy(catalog *catalog)
+{
+    catalog_clear(catalog);
+    for (int index = 0; index < CATALOG_INDEXES; index++) {
+        free(catalog->buckets[index]);
+    }
+    *catalog = catalog_init();
+}
+
+/* Returns the key of a book in a secondary index, NULL if it doesn't have one */
+static const char *index_key(const book *book, int index)
+{
+    if (!(book->fields & index_fields[index].flag)) {
+        return NULL;
+    }
+
+    return BOOK_STRING(book, index_fields[index].offset);
+}
+
+static size_t id_bucket(const catalog *catalog, int id)
+{
+    return ((size_t) (unsigned) id * 2654435761u) & (catalog->capacity - 1);
+}
+
+static void link_entry(catalog *catalog, catalog_entry *entry)
+{
+    size_t bucket = id_bucket(catalog, entry->book.id);
+
+    entry->next[CATALOG_BY_ID] = catalog->buckets[CATALOG_BY_ID][bucket];
+    catalog->buckets[CATALOG_BY_ID][bucket] = entry;
+
+    for (int index = CATALOG_BY_ID + 1; index < CATALOG_INDEXES; index++) {
+        const char *key = index_key(&entry->book, index);
+        if (key == NULL) {
+            continue;
+        }
+        bucket = hash_string(key) & (catalog->capacity - 1);
+        entry->next[index] = catalog->buckets[index][bucket];
+        catalog->buckets[index][bucket] = entry;
+    }
+}
+
+static void unlink_entry(catalog *catalog, catalog_entry *entry)
+{
+    for (int index = 0; index < CATALOG_INDEXES; index++) {
+        catalog_entry **slot;
+
+        if (index == CATALOG_BY_ID) {
+            slot = &catalog->buckets[index][id_bucket(catalog, entry->book.id)];
+        } else if (index_key(&entry->book, index) != NULL) {
+            slot = &catalog->buckets[index][hash_string(index_key(&entry->book, index)) & (catalog->capacity - 1)];
+        } else {
+            continue;
+        }
+
+        while (*slot != entry) {
+            slot = &(*slot)->next[index];
+        }
+        *slot = entry->next[index];
+    }
+}
+
+static int grow_buckets(catalog *catalog)
+{
+    size_t capacity = catalog->capacity ? catalog->capacity * 2 : CATALOG_STARTING_CAPACITY;
+    catalog_entry **buckets[CATALOG_INDEXES];
+    catalog_entry *entries = NULL;
+
+    for (int index = 0; index < CATALOG_INDEXES; index++) {
+        buckets[index] = calloc(capacity, sizeof(catalog_entry *));
+        if (buckets[index] == NULL) {
+            while (index-- > 0) {
+                free(buckets[index]);
+            }
+            return -1;
+        }
+    }
+
+    /* chain every entry through its id link, then link them again */
+    for (size_t i = 0; i < catalog->capacity; i++) {
+        while (catalog->buckets[CATALOG_BY_ID][i] != NULL) {
+            catalog_entry *entry = catalog->buckets[CATALOG_BY_ID][i];
+            catalog->buckets[CATALOG_BY_ID][i] = entry->next[CATALOG_BY_ID];
+            entry->next[CATALOG_BY_ID] = entries;
+            entries = entry;
+        }
+    }
+
+    for (int index = 0; index < CATALOG_INDEXES; index++) {
+        free(catalog->buckets[index]);
+        catalog->buckets[index] = buckets[index];
+    }
+    catalog->capacity = capacity;
+
+    while (entries != NULL) {
+        catalog_entry *next = entries->next[CATALOG_BY_ID];
+        link_entry(catalog, entries);
+        entries = next;
+    }
+
+    return 0;
+}
+
+static catalog_entry *find_entry(const catalog *catalog, int id)
+{
+    if (catalog->count == 0) {
+        return NULL;
+    }
+
+    catalog_entry *entry = catalog->buckets[CATALOG_BY_ID][id_bucket(catalog, id)];
+    while (entry != NULL && entry->book.id != id) {
+        entry = entry->next[CATALOG_BY_ID];
+    }
+
+    return entry;
+}
+
+/* Copies the fields a decoded book has into an entry */
+static int merge_book(catalog_entry *entry, const book *book)
+{
+    for (size_t i = 0; i < BOOK_STRING_FIELD_COUNT; i++) {
+        if (!(book->fields & book_string_fields[i].flag)) {
+            continue;
+        }
+
+        char *copy = strdup(BOOK_STRING(book, book_string_fields[i].offset));
+        if (copy == NULL) {
+            return -1;
+        }
+        free((char *) BOOK_STRING(&entry->book, book_string_fields[i].offset));
+        BOOK_STRING(&entry->book, book_string_fields[i].offset) = copy;
+        entry->book.fields |= book_string_fields[i].flag;
+    }
+
+    if (book->fields & BOOK_PAGE_COUNT) {
+        entry->book.page_count = book->page_count;
+        entry->book.fields |= BOOK_PAGE_COUNT;
+    }
+
+    return 0;
+}
+
+int catalog_insert(catalog *catalog, const book *book, int detailed, time_t confirmed_at)
+{
+    catalog_entry *entry = find_entry(catalog, book->id);
+
+    if (entry == NULL) {
+        if (catalog->count >= catalog->capacity && grow_buckets(catalog) < 0) {
+            return -1;
+        }
+
+        entry = calloc(1, sizeof(catalog_entry));
+        if (entry == NULL) {
+            return -1;
+        }
+        entry->book.id = book->id;
+        entry->book.fields = BOOK_ID;
+        catalog->count++;
+    } else {
+        unlink_entry(catalog, entry);
+    }
+
+    int status = merge_book(entry, book);
+
+    entry->detailed |= detailed;
+    entry->confirmed_at = confirmed_at;
+    link_entry(catalog, entry);
+    catalog->changes++;
+
+    return status;
+}
+
+int catalog_update(catalog *catalog, const book_list *list)
+{
+    time_t now = time(NULL);
+
+    /* a listing is the whole library, whatever it doesn't confirm is gone */
+    if (list->is_array) {
+        for (size_t i = 0; i < catalog->capacity; i++) {
+            for (catalog_entry *entry = catalog->buckets[CATALOG_BY_ID][i]; entry; entry = entry->next[CATALOG_BY_ID]) {
+                entry->confirmed_at = UNCONFIRMED;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < list->count; i++) {
+        if (!(list->books[i].fields & BOOK_ID)) {
+            continue;
+        }
+
+        if (catalog_insert(catalog, &list->books[i], !list->is_array, now) < 0) {
+            catalog_clear(catalog);
+            return -1;
+        }
+    }
+
+    if (list->is_array) {
+        catalog->unrevalidated = 0;
+        for (size_t i = 0; i < catalog->capacity; i++) {
+            catalog_entry **slot = &catalog->buckets[CATALOG_BY_ID][i];
+
+            while (*slot != NULL) {
+                catalog_entry *entry = *slot;
+                if (entry->confirmed_at == UNCONFIRMED) {
+                    unlink_entry(catalog, entry);
+                    free_entry(entry);
+                    catalog->count--;
+                    catalog->changes++;
+                } else {
+                    slot = &entry->next[CATALOG_BY_ID];
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+void catalog_set_version(catalog *catalog, const char *version)
+{
+    free(catalog->version);
+    catalog->version = version ? strdup(version) : NULL;
+    catalog->changes++;
+}
+
+void catalog_confirm(catalog *catalog)
+{
+    time_t now = time(NULL);
+
+    for (size_t i = 0; i < catalog->capacity; i++) {
+        for (catalog_entry *entry = catalog->buckets[CATALOG_BY_ID][i]; entry; entry = entry->next[CATALOG_BY_ID]) {
+            entry->confirmed_at = now;
+        }
+    }
+    catalog->unrevalidated = 0;
+    catalog->changes++;
+}
+
+void catalog_visit(const catalog *catalog,
+                   void (*visit)(const catalog_entry *entry, void *context), void *context)
+{
+    for (size_t i = 0; i < catalog->capacity; i++) {
+        for (catalog_entry *entry = catalog->buckets[CATALOG_BY_ID][i]; entry; entry = entry->next[CATALOG_BY_ID]) {
+            visit(entry, context);
+        }
+    }
+}
+
+const book *catalog_get(catalog *catalog, int id)
+{
+    catalog_entry *entry = find_entry(catalog, id);
+
+    if (entry == NULL || !entry->detailed) {
+        return NULL;
+    }
+
+    /* books of a stored catalog are served longer, until it is revalidated */
+    time_t ttl = catalog->unrevalidated ? CATALOG_UNREVALIDATED_TTL : CATALOG_TTL;
+    if (time(NULL) - entry->confirmed_at >= ttl) {
+        return NULL;
+    }
+
+    return &entry->book;
+}
+
+void catalog_remove(catalog *catalog, int id)
+{
+    catalog_entry *entry = find_entry(catalog, id);
+
+    if (entry != NULL) {
+        unlink_entry(catalog, entry);
+        free_entry(entry);
+        catalog->count--;
+        catalog->changes++;
+    }
+}
+
+size_t catalog_find(catalog *catalog, enum catalog_index index, const char *value,
+                    void (*visit)(const book *book, void *context), void *context)
+{
+    size_t found = 0;
+
+    if (index == CATALOG_BY_ID || catalog->count == 0) {
+        return 0;
+    }
+
+    catalog_entry *entry = catalog->buckets[index][hash_string(value) & (catalog->capacity - 1)];
+    for (; entry != NULL; entry = entry->next[index]) {
+        if (strcmp(index_key(&entry->book, index), value) == 0) {
+            visit(&entry->book, context);
+            found++;
+        }
+    }
+
+    return found;
+}
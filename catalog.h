@@ -0,0 +1,82 @@
+#ifndef _CATALOG_
+#define _CATALOG_
+
+#include <stddef.h>
+#include <time.h>
+#include "books.h"
+
+// seconds a book stays fresh after the server last confirmed it exists;
+// books are never edited, only added and deleted
+#define CATALOG_TTL 60
+
+// seconds a book loaded from the store is served while the catalog can't be
+// revalidated, counted from when the server last confirmed it
+#define CATALOG_UNREVALIDATED_TTL (24 * 60 * 60)
+
+// indexes of the catalog, the secondary ones only hold books with that field
+enum catalog_index {
+    CATALOG_BY_ID,
+    CATALOG_BY_AUTHOR,
+    CATALOG_BY_GENRE,
+    CATALOG_BY_PUBLISHER,
+    CATALOG_INDEXES
+};
+
+typedef struct catalog_entry {
+    struct catalog_entry *next[CATALOG_INDEXES];  // next entry of the same bucket, per index
+    book book;                                    // owns its strings
+    int detailed;                                 // filled from get_book, not only from a listing
+    time_t confirmed_at;
+} catalog_entry;
+
+typedef struct {
+    catalog_entry **buckets[CATALOG_INDEXES];
+    size_t count;
+    size_t capacity;                              // buckets of every index
+    char *version;                                // validator of the last listing, NULL if unknown
+    int unrevalidated;                            // loaded from the store and not checked against
+                                                  // the server yet, its books are served meanwhile
+    unsigned long changes;                        // counts every change, to know when to save
+} catalog;
+
+// initializes an empty catalog
+catalog catalog_init(void);
+
+// frees all the books of a catalog
+void catalog_destroy(catalog *catalog);
+
+// drops all the books of a catalog
+void catalog_clear(catalog *catalog);
+
+// adds or updates the decoded books of a response; a list of books is the
+// whole library, so books missing from it are dropped; returns -1 on failure
+int catalog_update(catalog *catalog, const book_list *list);
+
+// adds or updates a single book, confirmed at the given time; returns -1 on failure
+int catalog_insert(catalog *catalog, const book *book, int detailed, time_t confirmed_at);
+
+// records the ETag or Last-Modified of the listing the catalog was filled from
+void catalog_set_version(catalog *catalog, const char *version);
+
+// marks every book as confirmed now, after the server said the listing is unchanged;
+// a listing, confirmed or updated, revalidates a catalog loaded from the store
+void catalog_confirm(catalog *catalog);
+
+// calls visit with every entry of a catalog
+void catalog_visit(const catalog *catalog,
+                   void (*visit)(const catalog_entry *entry, void *context), void *context);
+
+// returns the details of a book if they can be served without asking the server:
+// confirmed recently, or, for a catalog loaded from the store and not
+// revalidated yet, confirmed within CATALOG_UNREVALIDATED_TTL
+const book *catalog_get(catalog *catalog, int id);
+
+// drops a book
+void catalog_remove(catalog *catalog, int id);
+
+// calls visit with every book whose author, genre or publisher (index)
+// is value and returns how many there were
+size_t catalog_find(catalog *catalog, enum catalog_index index, const char *value,
+                    void (*visit)(const book *book, void *context), void *context);
+
+#endif
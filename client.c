@@ -4,24 +4,65 @@
 #include <unistd.h>     /* read, write, close */
 #include <string.h>     /* memcpy, memset */
 #include <ctype.h>      /* isdigit */
+#include <errno.h>      /* errno */
+#include <limits.h>     /* INT_MAX */
 #include <sys/socket.h> /* socket, connect */
 #include <netinet/in.h> /* struct sockaddr_in, struct sockaddr */
 #include <netdb.h>      /* struct hostent, gethostbyname */
 #include <arpa/inet.h>  
+#include <pthread.h>    /* pthread_create, pthread_mutex_lock */
+#include <signal.h>     /* signal, SIGPIPE */
 
 #include "requests.h"   /* custom header for HTTP requests */
 #include "helpers.h"
+#include "books.h"      /* book decoder */
+#include "cache.h"      /* HTTP response cache */
+#include "catalog.h"    /* indexed books */
+#include "store.h"      /* catalog saved between runs */
+#include "session.h"    /* encrypted session file, JWT expiry */
 #include "parson.h"     /* JSON parsing library */
+#include "library.h"    /* server address and routes */
+#include "batch.h"      /* non-interactive mode */
+#include "client.h"     /* token renewal shared with batch mode */
+
+#define STORE_PATH ".library_store"
+
+/* State of the listing revalidation that runs in the background */
+typedef struct {
+    pthread_t thread;
+    bool running;
+    bool done;          /* the thread ended, but wasn't joined yet */
+    char *jwt;
+    catalog *catalog;
+} revalidation;
+
+/* The JWT token a command is sent with, renewed once if the server refuses it */
+typedef struct {
+    char **jwt;
+    char *cookie;       /* to enter the library again */
+    char *user;
+    bool renewed;       /* already renewed during the command */
+    bool refused;       /* the session cookie was refused too, a new login is needed */
+} token_renewal;
+
+/* Held by the main loop while it runs a command, and by the
+   revalidation while it updates the catalog */
+static pthread_mutex_t catalog_lock = PTHREAD_MUTEX_INITIALIZER;
 
-#define HOST "34.246.184.49:8080"
-#define IP "34.246.184.49"
-#define PORT 8080
-#define REGISTER_ACCESS "/api/v1/tema/auth/register"
-#define LOGIN_ACCESS "/api/v1/tema/auth/login"
-#define LIBRARY_ACCESS "/api/v1/tema/library/access"
-#define BOOKS_ACCESS "/api/v1/tema/library/books"
-#define LOGOUT_ACCESS "/api/v1/tema/auth/logout"
-#define PAYLOAD_TYPE "application/json"
+/**
+ * @brief Opens a connection to the server for a command.
+ *
+ * @return The socket file descriptor, -1 if the server can't be reached.
+ */
+int connect_to_server(void) {
+    int sockfd = try_open_connection(IP, PORT, AF_INET, SOCK_STREAM, 0);
+
+    if (sockfd < 0) {
+        printf("Error: Failed to reach the server. Please try again.\n");
+    }
+
+    return sockfd;
+}
 
 /**
  * @brief Handles user registration by collecting username and password,
@@ -69,11 +110,17 @@ void registration(int sockfd) {
     json_object_set_string(obj, "username", username);
     json_object_set_string(obj, "password", password);
 
-    /* Serialize JSON object to string */
-    char *json_string = json_serialize_to_string_pretty(val);
-    char *message = compute_post_request(HOST, REGISTER_ACCESS, PAYLOAD_TYPE, json_string, NULL);
+    /* Serialize the JSON object in a single pass, then send it with the headers */
+    size_t body_size;
+    char *body = json_serialize_to_string_pretty_with_len(val, &body_size);
+    if (!body) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    char *message = compute_post_request_headers(HOST, REGISTER_ACCESS, PAYLOAD_TYPE, body_size, NULL);
 
-    send_to_server(sockfd, message);
+    send_request_to_server(sockfd, message, body, body_size);
+    json_free_serialized_string(body);
     char *response = receive_from_server(sockfd);
 
     if (strstr(response, "error")) {
@@ -94,9 +141,10 @@ void registration(int sockfd) {
  *        creating a JSON object, and sending it to the server.
  *
  * @param sockfd The socket file descriptor.
+ * @param user Set to a copy of the username if login is successful.
  * @return The session cookie if login is successful, NULL otherwise.
  */
-char *login(int sockfd) {
+char *login(int sockfd, char **user) {
     char *username = malloc(sizeof(char) * LINELEN);
     char *password = malloc(sizeof(char) * LINELEN);
     char *cookie = NULL;
@@ -136,10 +184,16 @@ char *login(int sockfd) {
     json_object_set_string(obj, "username", username);
     json_object_set_string(obj, "password", password);
 
-    char *json_string = json_serialize_to_string_pretty(val);
-    char *message = compute_post_request(HOST, LOGIN_ACCESS, PAYLOAD_TYPE, json_string, NULL);
+    size_t body_size;
+    char *body = json_serialize_to_string_pretty_with_len(val, &body_size);
+    if (!body) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    char *message = compute_post_request_headers(HOST, LOGIN_ACCESS, PAYLOAD_TYPE, body_size, NULL);
 
-    send_to_server(sockfd, message);
+    send_request_to_server(sockfd, message, body, body_size);
+    json_free_serialized_string(body);
     char *response = receive_from_server(sockfd);
     char *error = strstr(response, "error");
 
@@ -160,6 +214,7 @@ char *login(int sockfd) {
             /* Duplicate the cookie string to manage memory correctly */
             cookie = strdup(cookie); 
         }
+        *user = strdup(username);
     }
 
     free(username);
@@ -171,6 +226,42 @@ char *login(int sockfd) {
     return cookie;
 }
 
+/**
+ * @brief Asks the server for a JWT token with the session cookie, without
+ *        printing anything.
+ *
+ * @param sockfd The socket file descriptor.
+ * @param cookie The session cookie.
+ * @param status Set to the status of the response, 0 if none arrived.
+ * @return The JWT token, NULL if the response has none.
+ */
+char *fetch_token(int sockfd, const char *cookie, int *status) {
+    char *message = compute_get_request(HOST, LIBRARY_ACCESS, (char *) cookie, NULL);
+    char *response = NULL;
+
+    if (try_send_to_server(sockfd, message, strlen(message)) == 0) {
+        response = try_receive_from_server(sockfd);
+    }
+    free(message);
+
+    *status = response ? response_status(response) : 0;
+    if (response == NULL) {
+        return NULL;
+    }
+
+    /* Extract token from the response body */
+    const char *json = basic_extract_json_response(response);
+    JSON_Value *body = json ? json_parse_string(json) : NULL;
+    const char *token = json_object_get_string(json_object(body), "token");
+    /* Duplicate the token string to manage memory correctly */
+    char *jwt = token ? strdup(token) : NULL;
+
+    json_value_free(body);
+    free(response);
+
+    return jwt;
+}
+
 /**
  * @brief Enters the library by sending a GET request with the session cookie.
  *
@@ -179,57 +270,212 @@ char *login(int sockfd) {
  * @return The JWT token if successful, NULL otherwise.
  */
 char *enter_library(int sockfd, char *cookie) {
-    char *message = compute_get_request(HOST, LIBRARY_ACCESS, cookie, NULL);
+    int status;
+    char *jwt = fetch_token(sockfd, cookie, &status);
+
+    if (jwt) {
+        printf("User entered the library successfully.\n");
+        return jwt;
+    }
+    printf("Error: Failed to enter the library.\n");
+    return NULL;
+}
+
+/**
+ * @brief Sends a request and receives a book or a list of books,
+ *        decoding the response body while it arrives.
+ *
+ * @param sockfd The socket file descriptor.
+ * @param message The request to send.
+ * @param books The list to decode into.
+ * @param decoded Set to 1 if the body had the expected shape, 0 otherwise.
+ * @return The whole response.
+ */
+char *receive_books(int sockfd, char *message, book_list *books, int *decoded) {
+    book_decoder decoder;
+
+    if (book_decoder_init(&decoder, books) < 0) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
 
     send_to_server(sockfd, message);
-    char *response = receive_from_server(sockfd);
+    char *response = receive_stream_from_server(sockfd, decoder.parser);
+    *decoded = book_decoder_finish(&decoder) == 0;
 
-    /* Extract token from response */
-    char *token = strstr(response, "token");
-    if (token) {
-        token = strtok(token, "\"");
-        token = strtok(NULL, "\"");
-        token = strtok(NULL, "\"");
+    return response;
+}
+
+/**
+ * @brief Gets a book or a list of books through the response cache. Fresh
+ *        entries are served without a request; stale ones are revalidated
+ *        with their ETag / Last-Modified and a 304 reuses the stored body.
+ *
+ * @param sockfd The socket file descriptor.
+ * @param cache The response cache.
+ * @param url The URL of the books.
+ * @param jwt The JWT token.
+ * @param books The list to decode into.
+ * @param decoded Set to 1 if the body had the expected shape, 0 otherwise.
+ * @return The whole response.
+ */
+char *receive_cached_books(int sockfd, http_cache *cache, char *url, char *jwt,
+                           book_list *books, int *decoded) {
+    http_cache_entry *entry = http_cache_lookup(cache, "GET", url, jwt);
+
+    if (entry == NULL || !http_cache_is_fresh(entry)) {
+        char *message = compute_conditional_get_request(HOST, url, NULL, jwt,
+                                                        entry ? entry->etag : NULL,
+                                                        entry ? entry->last_modified : NULL);
+        char *response = receive_books(sockfd, message, books, decoded);
+        free(message);
+
+        if (entry == NULL || response_status(response) != 304) {
+            http_cache_store(cache, "GET", url, jwt, response);
+            return response;
+        }
+
+        /* nothing changed, the body is the stored one */
+        http_cache_refresh(entry, response);
+        free(response);
+        book_list_destroy(books);
     }
 
-    free(message);
-    free(response);
+    char *response = strdup(entry->response);
+    if (!response) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *body = strstr(response, "\r\n\r\n");
+    *decoded = body && books_decode(books, body + 4, strlen(body + 4)) == 0;
 
-    if (token) {
-        /* Duplicate the token string to manage memory correctly */
-        char *jwt = malloc(strlen(token) + 1);
-        if (jwt) {
-            strcpy(jwt, token);
-            printf("User entered the library successfully.\n");
-            return jwt;
+    return response;
+}
+
+/**
+ * @brief Prints decoded books, falling back to parsing the response body
+ *        with parson when it didn't have the expected shape.
+ *
+ * @param response The whole response.
+ * @param books The decoded books.
+ * @param decoded Whether books holds the decoded body.
+ */
+void print_books(char *response, book_list *books, int decoded) {
+    if (decoded) {
+        books_print(books);
+        return;
+    }
+
+    char *body = strstr(response, "\r\n\r\n");
+    JSON_Value *val = body ? json_parse_string(body + 4) : NULL;
+    if (val) {
+        char *json_string = json_serialize_to_string(val);
+        if (json_string) {
+            puts(json_string);
         }
+        json_free_serialized_string(json_string);
+        json_value_free(val);
     }
-    printf("Error: Failed to enter the library.\n");
-    return NULL;
+}
+
+/**
+ * @brief Enters the library again, on a separate connection, to replace
+ *        a JWT token that expired or was refused.
+ *
+ * @param cookie The session cookie.
+ * @param user The logged in user.
+ * @param jwt The JWT token, replaced by the new one or NULL if it was refused.
+ * @return The status of the response, 0 if the server couldn't be reached
+ *         and the token was kept.
+ */
+int renew_token(const char *cookie, const char *user, char **jwt) {
+    int sockfd = try_open_connection(IP, PORT, AF_INET, SOCK_STREAM, 0);
+    int status = 0;
+
+    if (sockfd < 0) {
+        return 0;
+    }
+
+    char *renewed = fetch_token(sockfd, cookie, &status);
+    close(sockfd);
+    if (status == 0) {
+        return 0;
+    }
+
+    free(*jwt);
+    *jwt = renewed;
+    if (*jwt) {
+        session_save(SESSION_PATH, user, cookie, *jwt);
+    }
+
+    return status;
+}
+
+/**
+ * @brief Renews the JWT token the first time the server refuses it during a
+ *        command, and connects again to send the request with the new one.
+ *
+ * @param response The response to the request.
+ * @param renewal The token of the command.
+ * @return A new connection to send the request again on, -1 if it shouldn't be.
+ */
+int retry_with_new_token(const char *response, token_renewal *renewal) {
+    int status = response_status(response);
+
+    if ((status != 401 && status != 403) || renewal->renewed) {
+        return -1;
+    }
+
+    renewal->renewed = true;
+    if (renew_token(renewal->cookie, renewal->user, renewal->jwt) == 0) {
+        return -1;
+    }
+
+    if (*renewal->jwt == NULL) {
+        renewal->refused = true;
+        return -1;
+    }
+
+    return connect_to_server();
 }
 
 /**
  * @brief Retrieves the list of books from the library.
  *
  * @param sockfd The socket file descriptor.
- * @param jwt The JWT token.
+ * @param renewal The JWT token, renewed once if the server refuses it.
+ * @param cache The response cache.
+ * @param catalog The books known so far, updated with the listing.
  */
-void get_books(int sockfd, char *jwt) {
-    char *message = compute_get_request(HOST, BOOKS_ACCESS, NULL, jwt);
-
-    send_to_server(sockfd, message);
-    char *response = receive_from_server(sockfd);
+void get_books(int sockfd, token_renewal *renewal, http_cache *cache, catalog *catalog) {
+    book_list books = book_list_init();
+    int decoded;
+
+    char *response = receive_cached_books(sockfd, cache, BOOKS_ACCESS, *renewal->jwt, &books, &decoded);
+
+    int retry = retry_with_new_token(response, renewal);
+    if (retry >= 0) {
+        free(response);
+        book_list_destroy(&books);
+        response = receive_cached_books(retry, cache, BOOKS_ACCESS, *renewal->jwt, &books, &decoded);
+        close(retry);
+    }
 
     if (strstr(response, "error")) {
         printf("Error: Failed to get books\n");
     } else {
-        char *books = strstr(response, "[");
-        if (books) {
-            puts(books);
+        print_books(response, &books, decoded);
+        if (decoded) {
+            /* The ETag is the version of the listing, to revalidate it on the next run */
+            char *version = response_header(response, "ETag");
+            catalog_update(catalog, &books);
+            catalog_set_version(catalog, version);
+            free(version);
         }
     }
 
-    free(message);
+    book_list_destroy(&books);
     free(response);
 }
 
@@ -238,9 +484,10 @@ void get_books(int sockfd, char *jwt) {
  *        creating a JSON object, and sending it to the server.
  *
  * @param sockfd The socket file descriptor.
- * @param jwt The JWT token.
+ * @param renewal The JWT token, renewed once if the server refuses it.
+ * @param cache The response cache.
  */
-void add_book(int sockfd, char *jwt) {
+void add_book(int sockfd, token_renewal *renewal, http_cache *cache) {
     char *title = malloc(sizeof(char) * LINELEN);
     char *author = malloc(sizeof(char) * LINELEN);
     char *genre = malloc(sizeof(char) * LINELEN);
@@ -275,8 +522,9 @@ void add_book(int sockfd, char *jwt) {
     fgets(page_count, LINELEN - 1, stdin);
     page_count[strlen(page_count) - 1] = '\0';
 
-    if (strlen(title) == 0 || strlen(author) == 0 || strlen(genre) == 0 || strlen(publisher) == 0 || strlen(page_count) == 0) {
-        printf("Error: All fields must be completed. Please try again.\n");
+    const char *invalid = book_input_error(title, author, genre, publisher, page_count);
+    if (invalid) {
+        printf("Error: %s Please try again.\n", invalid);
         free(title);
         free(author);
         free(genre);
@@ -285,18 +533,6 @@ void add_book(int sockfd, char *jwt) {
         return;
     }
 
-    for (int i = 0; i < strlen(page_count) - 1; i++) {
-        if (!isdigit(page_count[i])) {
-            printf("Error: Page count must be a number. Please try again.\n");
-            free(title);
-            free(author);
-            free(genre);
-            free(publisher);
-            free(page_count);
-            return;
-        }
-    }
-
     /* Create JSON object with book details */
     JSON_Value *val = json_value_init_object();
     JSON_Object *obj = json_value_get_object(val);
@@ -306,13 +542,32 @@ void add_book(int sockfd, char *jwt) {
     json_object_set_string(obj, "publisher", publisher);
     json_object_set_string(obj, "page_count", page_count);
 
-    /* Serialize JSON object to string */
-    char *json_string = json_serialize_to_string_pretty(val);
-    char *message = compute_post_request(HOST, BOOKS_ACCESS, PAYLOAD_TYPE, json_string, jwt);
+    /* Serialize the JSON object in a single pass, then send it with the headers */
+    size_t body_size;
+    char *body = json_serialize_to_string_pretty_with_len(val, &body_size);
+    if (!body) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    char *message = compute_post_request_headers(HOST, BOOKS_ACCESS, PAYLOAD_TYPE, body_size, *renewal->jwt);
 
-    send_to_server(sockfd, message);
+    send_request_to_server(sockfd, message, body, body_size);
     char *response = receive_from_server(sockfd);
 
+    int retry = retry_with_new_token(response, renewal);
+    if (retry >= 0) {
+        free(message);
+        free(response);
+        message = compute_post_request_headers(HOST, BOOKS_ACCESS, PAYLOAD_TYPE, body_size, *renewal->jwt);
+        send_request_to_server(retry, message, body, body_size);
+        response = receive_from_server(retry);
+        close(retry);
+    }
+    json_free_serialized_string(body);
+
+    /* the stored list no longer matches the library */
+    http_cache_invalidate(cache, BOOKS_ACCESS);
+
     if (strstr(response, "error")) {
         printf("Error: Failed to add book\n");
     } else {
@@ -330,12 +585,66 @@ void add_book(int sockfd, char *jwt) {
 }
 
 /**
- * @brief Retrieves the details of a specific book from the library using its ID.
+ * @brief Adds the books of a CSV or JSONL file to the library, posting
+ *        several of them at the same time.
  *
- * @param sockfd The socket file descriptor.
- * @param jwt The JWT token.
+ * @param renewal The JWT token, with the session cookie and user to renew it
+ *        during a long import; it is replaced by the token the import ended with.
+ * @param cache The response cache.
+ */
+void import_books(token_renewal *renewal, http_cache *cache) {
+    char *path = malloc(sizeof(char) * LINELEN);
+
+    if (!path) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Consume newline character (from previous input) */
+    fgets(path, LINELEN - 1, stdin);
+
+    printf("file=");
+    fgets(path, LINELEN - 1, stdin);
+    path[strcspn(path, "\n")] = '\0';
+
+    batch_import(path, BATCH_IMPORT_JOBS, renewal->user, renewal->cookie, renewal->jwt);
+
+    /* the import already saved a renewed token, or forgot the session */
+    if (*renewal->jwt == NULL) {
+        renewal->refused = true;
+    }
+
+    /* the stored list no longer matches the library */
+    http_cache_invalidate(cache, BOOKS_ACCESS);
+
+    free(path);
+}
+
+/**
+ * @brief Checks that a book ID is a number, so the catalog and the server
+ *        look up the same book.
+ *
+ * @param id The ID read from the user.
+ * @return true if it is made of digits only and fits in an int, false otherwise.
+ */
+bool valid_id(const char *id) {
+    char *end;
+
+    errno = 0;
+    long value = strtol(id, &end, 10);
+
+    return isdigit((unsigned char) *id) && *end == '\0' && errno == 0 && value <= INT_MAX;
+}
+
+/**
+ * @brief Retrieves the details of a specific book from the library using its ID,
+ *        connecting to the server only if the catalog can't answer.
+ *
+ * @param renewal The JWT token, renewed once if the server refuses it.
+ * @param cache The response cache.
+ * @param catalog The books known so far, answers the request while fresh.
  */
-void get_book(int sockfd, char *jwt) {
+void get_book(token_renewal *renewal, http_cache *cache, catalog *catalog) {
     char *id = malloc(sizeof(char) * LINELEN);
 
     if (!id) {
@@ -350,12 +659,10 @@ void get_book(int sockfd, char *jwt) {
     fgets(id, LINELEN - 1, stdin);
     id[strlen(id) - 1] = '\0';
 
-    for (int i = 0; i < strlen(id) - 1; i++) {
-        if (!isdigit(id[i])) {
-            printf("Error: ID must be a number. Please try again.\n");
-            free(id);
-            return;
-        }
+    if (!valid_id(id)) {
+        printf("Error: ID must be a number. Please try again.\n");
+        free(id);
+        return;
     }
 
     /* Construct URL with book ID */
@@ -367,33 +674,129 @@ void get_book(int sockfd, char *jwt) {
     }
     sprintf(url, "%s/%s", BOOKS_ACCESS, id);
 
-    char *message = compute_get_request(HOST, url, NULL, jwt);
+    /* Answer locally if the book was fetched and confirmed recently */
+    const book *known = catalog_get(catalog, atoi(id));
+    if (known) {
+        book_print(known);
+        putchar('\n');
+        free(id);
+        free(url);
+        return;
+    }
 
-    send_to_server(sockfd, message);
-    char *response = receive_from_server(sockfd);
+    int sockfd = connect_to_server();
+    if (sockfd < 0) {
+        free(id);
+        free(url);
+        return;
+    }
+
+    book_list books = book_list_init();
+    int decoded;
+
+    char *response = receive_cached_books(sockfd, cache, url, *renewal->jwt, &books, &decoded);
+    close(sockfd);
+
+    int retry = retry_with_new_token(response, renewal);
+    if (retry >= 0) {
+        free(response);
+        book_list_destroy(&books);
+        response = receive_cached_books(retry, cache, url, *renewal->jwt, &books, &decoded);
+        close(retry);
+    }
 
     if (strstr(response, "error")) {
         printf("Error: Invalid ID. Please try again.\n");
+        /* Only a missing book is dropped, not one behind a refused token */
+        if (response_status(response) == 404) {
+            catalog_remove(catalog, atoi(id));
+        }
     } else {
-        char *book = strstr(response, "{");
-        if (book) {
-            puts(book);
+        print_books(response, &books, decoded);
+        if (decoded) {
+            catalog_update(catalog, &books);
         }
     }
 
+    book_list_destroy(&books);
     free(id);
     free(url);
-    free(message);
     free(response);
 }
 
+/**
+ * @brief Prints a book as an element of a JSON array.
+ *
+ * @param book The book.
+ * @param context Points to the number of books printed so far.
+ */
+void print_found_book(const book *book, void *context) {
+    size_t *printed = context;
+
+    if ((*printed)++ > 0) {
+        putchar(',');
+    }
+    book_print(book);
+}
+
+/**
+ * @brief Lists the known books with a given author, genre or publisher,
+ *        looking them up in the catalog without contacting the server.
+ *
+ * @param catalog The books known so far.
+ */
+void find_books(catalog *catalog) {
+    char *field = malloc(sizeof(char) * LINELEN);
+    char *value = malloc(sizeof(char) * LINELEN);
+
+    if (!field || !value) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Consume newline character (from previous input) */
+    fgets(field, LINELEN - 1, stdin);
+
+    printf("field=");
+    fgets(field, LINELEN - 1, stdin);
+    field[strlen(field) - 1] = '\0';
+
+    printf("value=");
+    fgets(value, LINELEN - 1, stdin);
+    value[strlen(value) - 1] = '\0';
+
+    enum catalog_index index;
+    if (!strcmp(field, "author")) {
+        index = CATALOG_BY_AUTHOR;
+    } else if (!strcmp(field, "genre")) {
+        index = CATALOG_BY_GENRE;
+    } else if (!strcmp(field, "publisher")) {
+        index = CATALOG_BY_PUBLISHER;
+    } else {
+        printf("Error: Field must be author, genre or publisher. Please try again.\n");
+        free(field);
+        free(value);
+        return;
+    }
+
+    size_t printed = 0;
+    putchar('[');
+    catalog_find(catalog, index, value, print_found_book, &printed);
+    printf("]\n");
+
+    free(field);
+    free(value);
+}
+
 /**
  * @brief Deletes a specific book from the library using its ID.
  *
  * @param sockfd The socket file descriptor.
- * @param jwt The JWT token.
+ * @param renewal The JWT token, renewed once if the server refuses it.
+ * @param cache The response cache.
+ * @param catalog The books known so far.
  */
-void delete_book(int sockfd, char *jwt) {
+void delete_book(int sockfd, token_renewal *renewal, http_cache *cache, catalog *catalog) {
     char *id = malloc(sizeof(char) * LINELEN);
 
     if (!id) {
@@ -408,12 +811,10 @@ void delete_book(int sockfd, char *jwt) {
     fgets(id, LINELEN - 1, stdin);
     id[strlen(id) - 1] = '\0';
 
-    for (int i = 0; i < strlen(id) - 1; i++) {
-        if (!isdigit(id[i])) {
-            printf("Error: ID must be a number. Please try again.\n");
-            free(id);
-            return;
-        }
+    if (!valid_id(id)) {
+        printf("Error: ID must be a number. Please try again.\n");
+        free(id);
+        return;
     }
 
     /* Construct URL with book ID */
@@ -425,15 +826,30 @@ void delete_book(int sockfd, char *jwt) {
     }
     sprintf(url, "%s/%s", BOOKS_ACCESS, id);
 
-    char *message = compute_delete_request(HOST, url, NULL, jwt);
+    char *message = compute_delete_request(HOST, url, NULL, *renewal->jwt);
 
     send_to_server(sockfd, message);
     char *response = receive_from_server(sockfd);
 
+    int retry = retry_with_new_token(response, renewal);
+    if (retry >= 0) {
+        free(message);
+        free(response);
+        message = compute_delete_request(HOST, url, NULL, *renewal->jwt);
+        send_to_server(retry, message);
+        response = receive_from_server(retry);
+        close(retry);
+    }
+
+    /* neither the book nor the list can be served from the cache anymore */
+    http_cache_invalidate(cache, url);
+    http_cache_invalidate(cache, BOOKS_ACCESS);
+
     if (strstr(response, "error")) {
         printf("Error: Invalid ID. Please try again.\n");
     } else {
         printf("Book deleted successfully.\n");
+        catalog_remove(catalog, atoi(id));
     }
 
     free(id);
@@ -470,12 +886,199 @@ void logout(int sockfd, char *cookie) {
     free(response);
 }
 
-int main() { 
+/**
+ * @brief Revalidates a catalog loaded from the store with a conditional
+ *        request for the listing, while the user types the next command.
+ *
+ * @param arg The revalidation.
+ * @return NULL.
+ */
+void *revalidate_catalog(void *arg) {
+    revalidation *task = arg;
+
+    pthread_mutex_lock(&catalog_lock);
+    char *version = task->catalog->version ? strdup(task->catalog->version) : NULL;
+    pthread_mutex_unlock(&catalog_lock);
+
+    /* Nothing is printed if it fails, the stored books keep being served */
+    int sockfd = try_open_connection(IP, PORT, AF_INET, SOCK_STREAM, 0);
+    char *message = compute_conditional_get_request(HOST, BOOKS_ACCESS, NULL, task->jwt, version, NULL);
+    char *response = NULL;
+
+    if (sockfd >= 0) {
+        if (try_send_to_server(sockfd, message, strlen(message)) == 0) {
+            response = try_receive_from_server(sockfd);
+        }
+        close(sockfd);
+    }
+
+    int status = response ? response_status(response) : 0;
+    char *body = response ? strstr(response, "\r\n\r\n") : NULL;
+    book_list books = book_list_init();
+    int decoded = status == 200 && body && books_decode(&books, body + 4, strlen(body + 4)) == 0;
+
+    pthread_mutex_lock(&catalog_lock);
+    if (status == 304) {
+        /* Same listing, so every stored book still exists */
+        catalog_confirm(task->catalog);
+    } else if (decoded && books.is_array) {
+        char *etag = response_header(response, "ETag");
+        catalog_update(task->catalog, &books);
+        catalog_set_version(task->catalog, etag);
+        free(etag);
+    }
+    task->done = true;
+    pthread_mutex_unlock(&catalog_lock);
+
+    book_list_destroy(&books);
+    free(version);
+    free(message);
+    free(response);
+
+    return NULL;
+}
+
+/**
+ * @brief Waits for the background revalidation, if any, to end.
+ *        Called with the catalog lock held.
+ *
+ * @param task The revalidation.
+ */
+void finish_revalidation(revalidation *task) {
+    if (!task->running) {
+        return;
+    }
+
+    pthread_mutex_unlock(&catalog_lock);
+    pthread_join(task->thread, NULL);
+    pthread_mutex_lock(&catalog_lock);
+
+    free(task->jwt);
+    task->jwt = NULL;
+    task->running = false;
+    task->done = false;
+}
+
+/**
+ * @brief Starts revalidating the catalog in the background, again if the
+ *        last revalidation ended without reaching the server.
+ *        Called with the catalog lock held.
+ *
+ * @param task The revalidation.
+ * @param catalog The catalog, loaded from the store.
+ * @param jwt The JWT token.
+ */
+void start_revalidation(revalidation *task, catalog *catalog, char *jwt) {
+    if (task->running && task->done) {
+        finish_revalidation(task);
+    }
+
+    if (task->running || !catalog->unrevalidated || catalog->count == 0) {
+        return;
+    }
+
+    task->catalog = catalog;
+    task->jwt = strdup(jwt);
+    task->done = false;
+    task->running = task->jwt && pthread_create(&task->thread, NULL, revalidate_catalog, task) == 0;
+    if (!task->running) {
+        free(task->jwt);
+        task->jwt = NULL;
+    }
+}
+
+/**
+ * @brief Forgets a session the server no longer accepts, along with
+ *        everything fetched with it. Called with the catalog lock held.
+ *
+ * @param task The revalidation.
+ * @param cache The response cache.
+ * @param catalog The books known so far.
+ */
+void forget_session(revalidation *task, http_cache *cache, catalog *catalog) {
+    finish_revalidation(task);
+    session_forget(SESSION_PATH);
+    http_cache_clear(cache);
+    catalog_clear(catalog);
+}
+
+/**
+ * @brief Saves the catalog if it changed since it was last saved or loaded.
+ *
+ * @param catalog The catalog.
+ * @param user The user the catalog belongs to, NULL if none is logged in.
+ * @param saved_changes The changes of the catalog when it was last saved.
+ */
+void save_catalog(catalog *catalog, char *user, unsigned long *saved_changes) {
+    if (!user || catalog->changes == *saved_changes) {
+        return;
+    }
+
+    if (store_save(STORE_PATH, user, catalog) < 0) {
+        fprintf(stderr, "Warning: Failed to save the catalog.\n");
+    }
+    *saved_changes = catalog->changes;
+}
+
+/**
+ * @brief Checks if a command sends the JWT token to the server.
+ *
+ * @param command The command.
+ * @return true if it does, false otherwise.
+ */
+bool needs_token(const char *command) {
+    return !strcmp(command, "get_books") || !strcmp(command, "add_book")
+           || !strcmp(command, "get_book") || !strcmp(command, "delete_book")
+           || !strcmp(command, "import_books");
+}
+
+/**
+ * @brief Runs the client without prompts, for client --batch [FILE] [--jobs N].
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments, argv[1] being --batch.
+ * @return The exit status, 0 if every command succeeded.
+ */
+int run_batch(int argc, char *argv[]) {
+    FILE *input = stdin;
+    int jobs = 1;
+
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "--jobs") && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (input == stdin && strcmp(argv[i], "-")) {
+            input = fopen(argv[i], "r");
+            if (!input) {
+                perror(argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    int status = batch_run(input, jobs);
+
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    return status;
+}
+
+int main(int argc, char *argv[]) { 
     int sockfd;
 
+    if (argc > 1 && !strcmp(argv[1], "--batch")) {
+        return run_batch(argc, argv);
+    }
+
     char *command = malloc(sizeof(char) * LINELEN);
     char *cookie = NULL;
     char *jwt = NULL;
+    char *user = NULL;
+    http_cache cache = http_cache_init();
+    catalog catalog = catalog_init();
+    unsigned long saved_changes = catalog.changes;
+    revalidation task = { .running = false };
 
     if (!command) {
         fprintf(stderr, "Memory allocation failed\n");
@@ -484,86 +1087,203 @@ int main() {
 
     bool logged_in = false;         /* Track login status */
     bool entered_library = false;   /* Track library access status */
+    bool restored = false;          /* Track if the session was saved by an earlier run */
+
+    /* Pick up the session saved by the last run, if any */
+    if (session_load(SESSION_PATH, &user, &cookie, &jwt) == 0) {
+        logged_in = true;
+        entered_library = jwt != NULL;
+        restored = true;
+        printf("Restored the session of %s.\n", user);
 
+        store_load(STORE_PATH, user, &catalog);
+        saved_changes = catalog.changes;
+
+        /* An expired token is only renewed when a command needs it */
+        if (entered_library && !jwt_expired(jwt)) {
+            start_revalidation(&task, &catalog, jwt);
+        }
+    }
+
+    /* A server closing the connection early fails the write instead of killing the client */
+    signal(SIGPIPE, SIG_IGN);
+
+    token_renewal renewal = { &jwt, NULL, NULL, false, false };
+
+    pthread_mutex_lock(&catalog_lock);
     while (true) {
-        sockfd = open_connection(IP, PORT, AF_INET, SOCK_STREAM, 0);
+        /* The last command found out the session cookie was refused, a new login is needed */
+        if (renewal.refused) {
+            printf("Error: The session is no longer valid. Please log in again.\n");
+            forget_session(&task, &cache, &catalog);
+            logged_in = false;
+            entered_library = false;
+            restored = false;
+            free(cookie);
+            free(user);
+            free(jwt);
+            cookie = NULL;
+            user = NULL;
+            jwt = NULL;
+        }
+
+        save_catalog(&catalog, user, &saved_changes);
+
+        /* Connected to only by the commands that reach the server */
+        sockfd = -1;
+
+        /* The revalidation can update the catalog while waiting for a command */
+        pthread_mutex_unlock(&catalog_lock);
         scanf("%s", command);
+        pthread_mutex_lock(&catalog_lock);
+
+        renewal = (token_renewal) { &jwt, cookie, user, false, false };
+
+        /* Never send a token that is known to be expired; without the server,
+           the command still runs and answers what it can from the catalog */
+        if (entered_library && needs_token(command) && jwt_expired(jwt)
+            && renew_token(cookie, user, &jwt) != 0) {
+            /* A token refused right after it was issued won't be renewed again */
+            renewal.renewed = true;
+            renewal.refused = jwt == NULL;
+            entered_library = jwt != NULL;
+            if (jwt) {
+                start_revalidation(&task, &catalog, jwt);
+            }
+        }
 
         if (!strcmp(command, "register")) {
+            if ((sockfd = connect_to_server()) < 0) {
+                continue;
+            }
             registration(sockfd);
         } else if (!strcmp(command, "exit")) {
-            close(sockfd);
             printf("Succesfully exited the program.\n");
             break;
         } else if (!strcmp(command, "login")) {
             if (logged_in) {
                 printf("Error: You are already logged in.\n");
-                close(sockfd);
                 continue;
             }
-            cookie = login(sockfd);
+            if ((sockfd = connect_to_server()) < 0) {
+                continue;
+            }
+            cookie = login(sockfd, &user);
             if (cookie) {
                 logged_in = true;
+                session_save(SESSION_PATH, user, cookie, NULL);
+                /* Start from the catalog of the last run, if there is one */
+                store_load(STORE_PATH, user, &catalog);
+                saved_changes = catalog.changes;
             }
         } else if (!strcmp(command, "enter_library")) {
             if (!logged_in) {
                 printf("Error: You must be logged in to enter the library.\n");
-                close(sockfd);
                 continue;
             }
+            if ((sockfd = connect_to_server()) < 0) {
+                continue;
+            }
+            free(jwt);
             jwt = enter_library(sockfd, cookie);
             if (jwt) {
                 entered_library = true;
+                session_save(SESSION_PATH, user, cookie, jwt);
+                start_revalidation(&task, &catalog, jwt);
+            } else if (restored) {
+                /* The saved session cookie was rejected */
+                renewal.refused = true;
             }
         } else if (!strcmp(command, "get_books")) {
             if (!entered_library) {
                 printf("Error: You must enter the library in order to access books.\n");
-                close(sockfd);
                 continue;
             }
-            get_books(sockfd, jwt);
+            if ((sockfd = connect_to_server()) < 0) {
+                continue;
+            }
+            get_books(sockfd, &renewal, &cache, &catalog);
         } else if (!strcmp(command, "add_book")) {
             if (!entered_library) {
                 printf("Error: You must enter the library in order to add a book.\n");
-                close(sockfd);
                 continue;
             }
-            add_book(sockfd, jwt);
+            if ((sockfd = connect_to_server()) < 0) {
+                continue;
+            }
+            add_book(sockfd, &renewal, &cache);
+        } else if (!strcmp(command, "import_books")) {
+            if (!entered_library) {
+                printf("Error: You must enter the library in order to import books.\n");
+                continue;
+            }
+            import_books(&renewal, &cache);
         } else if (!strcmp(command, "get_book")) {
             if (!entered_library) {
                 printf("Error: You must enter the library in order to access a book.\n");
-                close(sockfd);
                 continue;
             }
-            get_book(sockfd, jwt);
+            get_book(&renewal, &cache, &catalog);
+        } else if (!strcmp(command, "find_books")) {
+            if (!entered_library) {
+                printf("Error: You must enter the library in order to find books.\n");
+                continue;
+            }
+            find_books(&catalog);
         } else if (!strcmp(command, "delete_book")) {
             if (!entered_library) {
                 printf("Error: You must enter the library in order to delete a book.\n");
-                close(sockfd);
                 continue;
             }
-            delete_book(sockfd, jwt);
+            if ((sockfd = connect_to_server()) < 0) {
+                continue;
+            }
+            delete_book(sockfd, &renewal, &cache, &catalog);
         } else if (!strcmp(command, "logout")) {
             if (!logged_in) {
                 printf("Error: You are not logged in.\n");
-                close(sockfd);
+                continue;
+            }
+            if ((sockfd = connect_to_server()) < 0) {
                 continue;
             }
             logout(sockfd, cookie);
+            finish_revalidation(&task);
+            save_catalog(&catalog, user, &saved_changes);
+            session_forget(SESSION_PATH);
             logged_in = false;
             entered_library = false;
+            restored = false;
             free(cookie);
             free(jwt);
             cookie = NULL;
             jwt = NULL;
+            http_cache_clear(&cache);
+            catalog_clear(&catalog);
+            free(user);
+            user = NULL;
         } else {
             printf("Error: Invalid command. Please try again.\n");
         }
         /* Ensure the connection is closed after each command */
-        close(sockfd);
+        if (sockfd >= 0) {
+            close(sockfd);
+
+            /* The server is reachable, retry a revalidation that failed */
+            if (entered_library && jwt) {
+                start_revalidation(&task, &catalog, jwt);
+            }
+        }
     }
 
+    finish_revalidation(&task);
+    save_catalog(&catalog, user, &saved_changes);
+    pthread_mutex_unlock(&catalog_lock);
+
     free(command);
+    free(user);
+    http_cache_destroy(&cache);
+    catalog_destroy(&catalog);
     if (cookie) {
         free(cookie);
     }
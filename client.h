@@ -0,0 +1,10 @@
+#ifndef _CLIENT_
+#define _CLIENT_
+
+// enters the library again on a new connection, without printing anything,
+// and saves the new token with the session of user; *jwt is replaced by the
+// new token, NULL if the server refused the cookie, and kept if the server
+// couldn't be reached; returns the status of the response, 0 if there was none
+int renew_token(const char *cookie, const char *user, char **jwt);
+
+#endif
@@ -2,12 +2,18 @@
 #include <stdio.h>
 #include <unistd.h>     /* read, write, close */
 #include <string.h>     /* memcpy, memset */
+#include <strings.h>    /* strncasecmp */
+#include <ctype.h>      /* isdigit */
+#include <errno.h>      /* errno */
+#include <fcntl.h>      /* open */
+#include <libgen.h>     /* dirname */
 #include <sys/socket.h> /* socket, connect */
 #include <netinet/in.h> /* struct sockaddr_in, struct sockaddr */
 #include <netdb.h>      /* struct hostent, gethostbyname */
 #include <arpa/inet.h>
 #include "helpers.h"
 #include "buffer.h"
+#include "parson.h"
 
 #define HEADER_TERMINATOR "\r\n\r\n"
 #define HEADER_TERMINATOR_SIZE (sizeof(HEADER_TERMINATOR) - 1)
@@ -26,20 +32,33 @@ void compute_message(char *message, const char *line)
     strcat(message, "\r\n");
 }
 
-int open_connection(char *host_ip, int portno, int ip_type, int socket_type, int flag)
+int try_open_connection(char *host_ip, int portno, int ip_type, int socket_type, int flag)
 {
     struct sockaddr_in serv_addr;
     int sockfd = socket(ip_type, socket_type, flag);
     if (sockfd < 0)
-        error("ERROR opening socket");
+        return -1;
 
     memset(&serv_addr, 0, sizeof(serv_addr));
     serv_addr.sin_family = ip_type;
     serv_addr.sin_port = htons(portno);
     inet_aton(host_ip, &serv_addr.sin_addr);
 
-    /* connect the socket */
-    if (connect(sockfd, (struct sockaddr*) &serv_addr, sizeof(serv_addr)) < 0)
+    /* connect the socket, keeping the reason it failed for the caller */
+    if (connect(sockfd, (struct sockaddr*) &serv_addr, sizeof(serv_addr)) < 0) {
+        int saved = errno;
+        close(sockfd);
+        errno = saved;
+        return -1;
+    }
+
+    return sockfd;
+}
+
+int open_connection(char *host_ip, int portno, int ip_type, int socket_type, int flag)
+{
+    int sockfd = try_open_connection(host_ip, portno, ip_type, socket_type, flag);
+    if (sockfd < 0)
         error("ERROR connecting");
 
     return sockfd;
@@ -70,18 +89,62 @@ void send_to_server(int sockfd, char *message)
     } while (sent < total);
 }
 
-char *receive_from_server(int sockfd)
+int try_send_to_server(int sockfd, const char *data, size_t size)
+{
+    size_t sent = 0;
+
+    while (sent < size) {
+        ssize_t bytes = write(sockfd, data + sent, size - sent);
+        if (bytes <= 0) {
+            return -1;
+        }
+
+        sent += bytes;
+    }
+
+    return 0;
+}
+
+void send_request_to_server(int sockfd, const char *message, const char *body, size_t body_size)
+{
+    size_t message_size = strlen(message);
+    char *request = malloc(message_size + body_size);
+
+    if (request == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* a single write, so that the body doesn't wait for the ACK of the headers */
+    memcpy(request, message, message_size);
+    memcpy(request + message_size, body, body_size);
+
+    if (try_send_to_server(sockfd, request, message_size + body_size) < 0) {
+        error("ERROR writing message to socket");
+    }
+
+    free(request);
+}
+
+/* Called with every part of the response body as soon as it arrives */
+typedef void (*body_consumer)(void *context, const char *data, size_t size);
+
+/* Reads a whole response; if consume is not NULL, body bytes are passed to it as they arrive.
+   Returns NULL if reading from the socket failed */
+static char *receive_response(int sockfd, body_consumer consume, void *context)
 {
     char response[BUFLEN];
     buffer buffer = buffer_init();
     int header_end = 0;
     int content_length = 0;
+    size_t fed = 0;
 
     do {
         int bytes = read(sockfd, response, BUFLEN);
 
         if (bytes < 0){
-            error("ERROR reading response from socket");
+            buffer_destroy(&buffer);
+            return NULL;
         }
 
         if (bytes == 0) {
@@ -98,6 +161,11 @@ char *receive_from_server(int sockfd)
             int content_length_start = buffer_find_insensitive(&buffer, CONTENT_LENGTH, CONTENT_LENGTH_SIZE);
             
             if (content_length_start < 0) {
+                /* 204 and 304 responses never have a body */
+                int status = response_status(buffer.data);
+                if (status == 204 || status == 304) {
+                    break;
+                }
                 continue;           
             }
 
@@ -107,12 +175,25 @@ char *receive_from_server(int sockfd)
         }
     } while (1);
     size_t total = content_length + (size_t) header_end;
-    
-    while (buffer.size < total) {
+    fed = (size_t) header_end;
+
+    while (1) {
+        /* parse whatever part of the body has arrived before waiting for more */
+        if (consume && header_end > 0 && fed < buffer.size && fed < total) {
+            size_t available = (buffer.size < total ? buffer.size : total) - fed;
+            consume(context, buffer.data + fed, available);
+            fed += available;
+        }
+
+        if (buffer.size >= total) {
+            break;
+        }
+
         int bytes = read(sockfd, response, BUFLEN);
 
         if (bytes < 0) {
-            error("ERROR reading response from socket");
+            buffer_destroy(&buffer);
+            return NULL;
         }
 
         if (bytes == 0) {
@@ -125,6 +206,178 @@ char *receive_from_server(int sockfd)
     return buffer.data;
 }
 
+static void feed_incremental_parser(void *context, const char *data, size_t size)
+{
+    json_incremental_parser_feed(context, data, size);
+}
+
+static void feed_stream_parser(void *context, const char *data, size_t size)
+{
+    json_stream_parser_feed(context, data, size);
+}
+
+/* Exits if reading a response failed, like the rest of the interactive client */
+static char *checked_response(char *response)
+{
+    if (response == NULL) {
+        error("ERROR reading response from socket");
+    }
+
+    return response;
+}
+
+char *receive_from_server(int sockfd)
+{
+    return checked_response(receive_response(sockfd, NULL, NULL));
+}
+
+char *try_receive_from_server(int sockfd)
+{
+    char *response = receive_response(sockfd, NULL, NULL);
+
+    /* a kept alive connection closed by the server returns nothing */
+    if (response != NULL && strstr(response, HEADER_TERMINATOR) == NULL) {
+        free(response);
+        response = NULL;
+    }
+
+    return response;
+}
+
+char *receive_json_from_server(int sockfd, JSON_Value **json)
+{
+    JSON_Incremental_Parser *parser = json_incremental_parser_init();
+    char *response = checked_response(receive_response(sockfd, parser ? feed_incremental_parser : NULL, parser));
+
+    *json = NULL;
+    if (parser) {
+        json_incremental_parser_finish(parser);
+        *json = json_incremental_parser_take_value(parser);
+        json_incremental_parser_free(parser);
+    }
+
+    return response;
+}
+
+char *receive_stream_from_server(int sockfd, JSON_Stream_Parser *parser)
+{
+    return checked_response(receive_response(sockfd, parser ? feed_stream_parser : NULL, parser));
+}
+
+int response_status(const char *response)
+{
+    int status = 0;
+
+    /* parsed by hand, the response may not be null terminated yet */
+    if (strncmp(response, "HTTP/", 5) != 0) {
+        return -1;
+    }
+
+    response += 5;
+    while (*response != ' ' && *response != '\r') {
+        response++;
+    }
+
+    if (*response != ' ' || !isdigit((unsigned char) response[1])) {
+        return -1;
+    }
+
+    for (response++; isdigit((unsigned char) *response); response++) {
+        status = status * 10 + (*response - '0');
+    }
+
+    return status;
+}
+
+char *response_header(const char *response, const char *name)
+{
+    size_t name_len = strlen(name);
+    const char *line = strstr(response, "\r\n");
+
+    /* headers are the lines between the status line and the first empty one */
+    while (line != NULL && strncmp(line, HEADER_TERMINATOR, HEADER_TERMINATOR_SIZE) != 0) {
+        line += 2;
+
+        const char *end = strstr(line, "\r\n");
+        if (end == NULL) {
+            return NULL;
+        }
+
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char *value = line + name_len + 1;
+            while (value < end && (*value == ' ' || *value == '\t')) {
+                value++;
+            }
+            return strndup(value, end - value);
+        }
+
+        line = end;
+    }
+
+    return NULL;
+}
+
+static int write_all(int fd, const void *data, size_t size)
+{
+    size_t written = 0;
+
+    while (written < size) {
+        ssize_t bytes = write(fd, (const char *) data + written, size - written);
+        if (bytes <= 0) {
+            return -1;
+        }
+        written += bytes;
+    }
+
+    return 0;
+}
+
+int replace_file(const char *path, const struct iovec *parts, int count)
+{
+    size_t tmp_size = strlen(path) + sizeof(".tmp");
+    char *tmp = malloc(tmp_size);
+    char *dir = strdup(path);
+    int status = -1;
+
+    if (tmp == NULL || dir == NULL) {
+        free(tmp);
+        free(dir);
+        return -1;
+    }
+    snprintf(tmp, tmp_size, "%s.tmp", path);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0) {
+        status = 0;
+        for (int i = 0; i < count && status == 0; i++) {
+            status = write_all(fd, parts[i].iov_base, parts[i].iov_len);
+        }
+        if (status == 0 && fsync(fd) < 0) {
+            status = -1;
+        }
+        if (close(fd) < 0) {
+            status = -1;
+        }
+    }
+
+    /* the rename is atomic, and syncing the directory makes it durable */
+    if (status == 0 && rename(tmp, path) == 0) {
+        int dir_fd = open(dirname(dir), O_RDONLY);
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+    } else {
+        unlink(tmp);
+        status = -1;
+    }
+
+    free(tmp);
+    free(dir);
+
+    return status;
+}
+
 char *basic_extract_json_response(char *str)
 {
     return strstr(str, "{\"");
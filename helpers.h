@@ -1,6 +1,9 @@
 #ifndef _HELPERS_
 #define _HELPERS_
 
+#include <sys/uio.h>
+#include "parson.h"
+
 #define BUFLEN 4096
 #define LINELEN 1000
 
@@ -13,15 +16,51 @@ void compute_message(char *message, const char *line);
 // opens a connection with server host_ip on port portno, returns a socket
 int open_connection(char *host_ip, int portno, int ip_type, int socket_type, int flag);
 
+// opens a connection like open_connection, returns -1 instead of exiting
+// if the server can't be reached
+int try_open_connection(char *host_ip, int portno, int ip_type, int socket_type, int flag);
+
 // closes a server connection on socket sockfd
 void close_connection(int sockfd);
 
 // send a message to a server
 void send_to_server(int sockfd, char *message);
 
+// sends size bytes of data to a server, returns -1 instead of exiting
+// if the connection failed
+int try_send_to_server(int sockfd, const char *data, size_t size);
+
+// sends the headers in message followed by body_size bytes of body
+// with a single write
+void send_request_to_server(int sockfd, const char *message, const char *body, size_t body_size);
+
 // receives and returns the message from a server
 char *receive_from_server(int sockfd);
 
+// receives and returns the message from a server, NULL instead of exiting
+// if the connection failed or was closed before a response arrived
+char *try_receive_from_server(int sockfd);
+
+// receives and returns the message from a server, parsing its JSON body
+// while it arrives; *json is set to the body or NULL if it isn't valid JSON
+char *receive_json_from_server(int sockfd, JSON_Value **json);
+
+// receives and returns the message from a server, feeding its body to parser
+// while it arrives; the caller finishes and frees the parser
+char *receive_stream_from_server(int sockfd, JSON_Stream_Parser *parser);
+
+// returns the status code of a server response, -1 if it has no status line
+int response_status(const char *response);
+
+// returns a copy of the value of a response header (name is matched in a
+// case-insensitive fashion), NULL if the response doesn't have it
+char *response_header(const char *response, const char *name);
+
+// writes the count parts to a temporary file next to path, syncs it and
+// renames it over path, so a crash leaves either the old or the new file;
+// returns 0 on success, -1 on error
+int replace_file(const char *path, const struct iovec *parts, int count);
+
 // extracts and returns a JSON from a server response
 char *basic_extract_json_response(char *str);
 
@@ -0,0 +1,20 @@
+#ifndef _LIBRARY_
+#define _LIBRARY_
+
+// address of the library server
+#define HOST "34.246.184.49:8080"
+#define IP "34.246.184.49"
+#define PORT 8080
+
+// routes of the library API
+#define REGISTER_ACCESS "/api/v1/tema/auth/register"
+#define LOGIN_ACCESS "/api/v1/tema/auth/login"
+#define LIBRARY_ACCESS "/api/v1/tema/library/access"
+#define BOOKS_ACCESS "/api/v1/tema/library/books"
+#define LOGOUT_ACCESS "/api/v1/tema/auth/logout"
+#define PAYLOAD_TYPE "application/json"
+
+// session saved between runs, see session.h
+#define SESSION_PATH ".library_session"
+
+#endif
@@ -47,6 +47,23 @@
 #include <ctype.h>
 #include <math.h>
 #include <errno.h>
+#include <float.h>
+#include <limits.h>
+
+/* Files are parsed from a private memory mapping instead of a heap copy where available */
+#if !defined(PARSON_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define PARSON_USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+/* Strings are scanned 16 bytes at a time with SSE2 where available */
+#if !defined(PARSON_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PARSON_USE_SSE2
+#include <emmintrin.h>
+#endif
+#include <stdint.h>
 
 /* Apparently sscanf is not implemented in some "standard" libraries, so don't use it, if you
  * don't have to. */
@@ -62,11 +79,17 @@
 #define strcpy USE_MEMCPY_INSTEAD_OF_STRCPY
 
 #define STARTING_CAPACITY 16
-#define MAX_NESTING       2048
 
-#ifndef PARSON_DEFAULT_FLOAT_FORMAT
-#define PARSON_DEFAULT_FLOAT_FORMAT "%1.17g" /* do not increase precision without incresing NUM_BUF_SIZE */
+/* Parsing, serialization and freeing don't recurse per nesting level, so the limit
+   only guards against runaway memory use */
+#ifndef PARSON_MAX_NESTING
+#define PARSON_MAX_NESTING 65536
 #endif
+#define MAX_NESTING       PARSON_MAX_NESTING
+
+/* Numbers are serialized with the shortest representation that round-trips unless
+   PARSON_DEFAULT_FLOAT_FORMAT is defined (e.g. "%1.17g"; do not increase precision
+   without increasing NUM_BUF_SIZE). */
 
 #ifndef PARSON_NUM_BUF_SIZE
 #define PARSON_NUM_BUF_SIZE 64 /* double printed with "%1.17g" shouldn't be longer than 25 bytes so let's be paranoid and use 64 */
@@ -78,9 +101,24 @@
 
 #define SIZEOF_TOKEN(a)       (sizeof(a) - 1)
 #define SKIP_CHAR(str)        ((*str)++)
-#define SKIP_WHITESPACES(str) while (isspace((unsigned char)(**str))) { SKIP_CHAR(str); }
+#define CURRENT_CHAR(str, end) (*(str) < (end) ? **(str) : '\0') /* input ends at end or first \0 */
+#define SKIP_WHITESPACES(str, end) while (*(str) < (end) && isspace((unsigned char)(**str))) { SKIP_CHAR(str); }
 #define MAX(a, b)             ((a) > (b) ? (a) : (b))
 
+/* Same as SKIP_WHITESPACES, but jumps to the next token through a structural index if there is one */
+#define SKIP_TO_TOKEN(str, end, index) do {\
+                                           if ((index) == NULL) {\
+                                               SKIP_WHITESPACES(str, end);\
+                                           } else if (*(str) < (end) && IS_INDEX_WHITESPACE(**(str))) {\
+                                               *(str) = structural_index_next((index), *(str), (end));\
+                                           }\
+                                       } while (0)
+
+/* Inputs at least this long are parsed with a structural index */
+#ifndef PARSON_INDEX_MIN_LENGTH
+#define PARSON_INDEX_MIN_LENGTH 4096
+#endif
+
 #undef malloc
 #undef free
 
@@ -92,14 +130,42 @@
 
 #define OBJECT_INVALID_IX ((size_t)-1)
 
-static JSON_Malloc_Function parson_malloc = malloc;
-static JSON_Free_Function parson_free = free;
+#ifndef OBJECT_LINEAR_MAX
+#define OBJECT_LINEAR_MAX 8 /* objects with up to this many items aren't hashed */
+#endif
+
+#define OBJECT_STARTING_ITEMS 4
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define PARSON_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define PARSON_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define PARSON_THREAD_LOCAL __declspec(thread)
+#else
+#define PARSON_THREAD_LOCAL /* contexts are shared by all threads */
+#endif
+
+/* Allocator and settings, the json_set_* functions change the default context */
+struct json_context_t {
+    JSON_Malloc_Function malloc_fun;
+    JSON_Free_Function   free_fun;
+    int                  escape_slashes;
+    char                *float_format;
+    JSON_Number_Serialization_Function number_serialization_function;
+};
 
-static int parson_escape_slashes = 1;
+static JSON_Context parson_default_context = { malloc, free, 1, NULL, NULL };
 
-static char *parson_float_format = NULL;
+static PARSON_THREAD_LOCAL JSON_Context *parson_current_context = NULL; /* NULL means default context */
 
-static JSON_Number_Serialization_Function parson_number_serialization_function = NULL;
+#define PARSON_CONTEXT() (parson_current_context != NULL ? parson_current_context : &parson_default_context)
+
+#define parson_malloc(size) (PARSON_CONTEXT()->malloc_fun((size)))
+#define parson_free(ptr) (PARSON_CONTEXT()->free_fun((ptr)))
+#define parson_escape_slashes (PARSON_CONTEXT()->escape_slashes)
+#define parson_float_format (PARSON_CONTEXT()->float_format)
+#define parson_number_serialization_function (PARSON_CONTEXT()->number_serialization_function)
 
 #define IS_CONT(b) (((unsigned char)(b) & 0xC0) == 0x80) /* is utf-8 continuation byte */
 
@@ -126,19 +192,28 @@ typedef union json_value_value {
 struct json_value_t {
     JSON_Value      *parent;
     JSON_Value_Type  type;
+    unsigned int     refs;   /* references besides the owner, see json_value_share */
     JSON_Value_Value value;
 };
 
+typedef struct json_object_item {
+    char          *name;
+    size_t         name_len;
+    unsigned long  hash;    /* hash and cell_ix are only valid when object is hashed */
+    size_t         cell_ix;
+    JSON_Value    *value;
+} JSON_Object_Item;
+
+/* Items are kept in insertion order in a single array. Small objects are searched
+   linearly, an open addressing index (cells) is only built once an object grows
+   past OBJECT_LINEAR_MAX items. */
 struct json_object_t {
-    JSON_Value    *wrapping_value;
-    size_t        *cells;
-    unsigned long *hashes;
-    char         **names;
-    JSON_Value   **values;
-    size_t        *cell_ixs;
-    size_t         count;
-    size_t         item_capacity;
-    size_t         cell_capacity;
+    JSON_Value       *wrapping_value;
+    JSON_Object_Item *items;
+    size_t           *cells;  /* NULL in linear mode */
+    size_t            count;
+    size_t            item_capacity;
+    size_t            cell_capacity;
 };
 
 struct json_array_t {
@@ -149,8 +224,11 @@ struct json_array_t {
 };
 
 /* Various */
-static char * read_file(const char *filename);
-static void   remove_comments(char *string, const char *start_token, const char *end_token);
+typedef struct json_file_contents JSON_File_Contents;
+static char * read_file(const char *filename, size_t *len);
+static JSON_Status file_contents_load(const char *filename, parson_bool_t writable, JSON_File_Contents *contents);
+static void   file_contents_release(JSON_File_Contents *contents);
+static void   remove_comments(char *string, size_t len, const char *start_token, const char *end_token);
 static char * parson_strndup(const char *string, size_t n);
 static char * parson_strdup(const char *string);
 static int    parson_sprintf(char * s, const char * format, ...);
@@ -160,15 +238,22 @@ static JSON_Status parse_utf16_hex(const char *string, unsigned int *result);
 static int         num_bytes_in_utf8_sequence(unsigned char c);
 static JSON_Status   verify_utf8_sequence(const unsigned char *string, int *len);
 static parson_bool_t is_valid_utf8(const char *string, size_t string_len);
+static size_t        scan_ascii(const char *string, size_t len);
+static size_t        scan_plain_chars(const char *string, size_t len, parson_bool_t escape_slashes);
 static parson_bool_t is_decimal(const char *string, size_t length);
 static unsigned long hash_string(const char *string, size_t n);
+static int    serialize_number_shortest(double num, char *buf);
 
 /* JSON Object */
 static JSON_Object * json_object_make(JSON_Value *wrapping_value);
-static JSON_Status   json_object_init(JSON_Object *object, size_t capacity);
+static void          json_object_init(JSON_Object *object);
 static void          json_object_deinit(JSON_Object *object, parson_bool_t free_keys, parson_bool_t free_values);
-static JSON_Status   json_object_grow_and_rehash(JSON_Object *object);
+static JSON_Status   json_object_grow_items(JSON_Object *object);
+static JSON_Status   json_object_rehash(JSON_Object *object, size_t new_capacity);
 static size_t        json_object_get_cell_ix(const JSON_Object *object, const char *key, size_t key_len, unsigned long hash, parson_bool_t *out_found);
+static size_t        json_object_find_item_with_hash(const JSON_Object *object, const char *name, size_t name_len, unsigned long hash);
+static size_t        json_object_find_item(const JSON_Object *object, const char *name, size_t name_len);
+static JSON_Status   json_object_append_item(JSON_Object *object, char *name, size_t name_len, JSON_Value *value);
 static JSON_Status   json_object_add(JSON_Object *object, char *name, JSON_Value *value);
 static JSON_Value  * json_object_getn_value(const JSON_Object *object, const char *name, size_t name_len);
 static JSON_Status   json_object_remove_internal(JSON_Object *object, const char *name, parson_bool_t free_value);
@@ -183,27 +268,58 @@ static void         json_array_free(JSON_Array *array);
 
 /* JSON Value */
 static JSON_Value * json_value_init_string_no_copy(char *string, size_t length);
+static void         json_value_release(JSON_Value *value);
 static const JSON_String * json_value_get_string_desc(const JSON_Value *value);
 
 /* Parser */
-static JSON_Status   skip_quotes(const char **string);
+typedef struct json_structural_index {
+    const char *base;
+    uint64_t   *words; /* bit per input byte, see structural_index_build */
+    size_t      count;
+} JSON_Structural_Index;
+static JSON_Status   structural_index_build(JSON_Structural_Index *index, const char *string, size_t len);
+static const char *  structural_index_next(const JSON_Structural_Index *index, const char *position, const char *end);
+static JSON_Status   skip_quotes(const char **string, const char *end);
 static JSON_Status   parse_utf16(const char **unprocessed, char **processed);
 static char *        process_string(const char *input, size_t input_len, size_t *output_len);
-static char *        get_quoted_string(const char **string, size_t *output_string_len);
-static JSON_Value *  parse_object_value(const char **string, size_t nesting);
-static JSON_Value *  parse_array_value(const char **string, size_t nesting);
-static JSON_Value *  parse_string_value(const char **string);
-static JSON_Value *  parse_boolean_value(const char **string);
-static JSON_Value *  parse_number_value(const char **string);
-static JSON_Value *  parse_null_value(const char **string);
-static JSON_Value *  parse_value(const char **string, size_t nesting);
+static char *        get_quoted_string(const char **string, const char *end, const JSON_Structural_Index *index, size_t *output_string_len);
+static JSON_Value *  parse_string_value(const char **string, const char *end, const JSON_Structural_Index *index);
+static JSON_Value *  parse_boolean_value(const char **string, const char *end);
+static JSON_Status   parse_number_fast(const char **string, double *result);
+static JSON_Status   parse_number(const char **string, double *result);
+static JSON_Value *  parse_number_value(const char **string, const char *end);
+static JSON_Value *  parse_null_value(const char **string, const char *end);
+static JSON_Value *  parse_value(const char **string, const char *end, const JSON_Structural_Index *index);
 
 /* Serialization */
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, parson_bool_t is_pretty, char *num_buf);
-static int json_serialize_string(const char *string, size_t len, char *buf);
+typedef struct json_output JSON_Output;
+typedef struct json_serialize_stack JSON_Serialize_Stack;
+static JSON_Status json_serialize_value(const JSON_Value *value, JSON_Output *output, parson_bool_t is_pretty, char *num_buf, JSON_Serialize_Stack *stack);
+static JSON_Status json_serialize_string(const char *string, size_t len, JSON_Output *output);
 
 /* Various */
-static char * read_file(const char * filename) {
+/* Makes room for one more item in an array that is grown by doubling, returns the
+   (possibly moved) array or NULL if it can't grow */
+static void * grow_array(void *items, size_t count, size_t *capacity, size_t item_size) {
+    void *new_items = NULL;
+    size_t new_capacity = 0;
+    if (count < *capacity) {
+        return items;
+    }
+    new_capacity = MAX(*capacity * 2, STARTING_CAPACITY);
+    new_items = parson_malloc(new_capacity * item_size);
+    if (new_items == NULL) {
+        return NULL;
+    }
+    if (count > 0) {
+        memcpy(new_items, items, count * item_size);
+    }
+    parson_free(items);
+    *capacity = new_capacity;
+    return new_items;
+}
+
+static char * read_file(const char * filename, size_t *len) {
     FILE *fp = fopen(filename, "r");
     size_t size_to_read = 0;
     size_t size_read = 0;
@@ -233,37 +349,95 @@ static char * read_file(const char * filename) {
     }
     fclose(fp);
     file_contents[size_read] = '\0';
+    *len = size_read;
     return file_contents;
 }
 
-static void remove_comments(char *string, const char *start_token, const char *end_token) {
+/* Contents of a file, mapped read only or copy-on-write when possible, so only
+   pages that are written to (e.g. by remove_comments) get copied */
+struct json_file_contents {
+    char          *data;
+    size_t         len;
+    parson_bool_t  is_mapped;
+};
+
+static JSON_Status file_contents_load(const char *filename, parson_bool_t writable, JSON_File_Contents *contents) {
+#ifdef PARSON_USE_MMAP
+    struct stat file_stat;
+    void *mapping = MAP_FAILED;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return JSONFailure;
+    }
+    /* empty files and special files (pipes, /proc) have no size to map */
+    if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0
+        && (unsigned long long)file_stat.st_size <= (unsigned long long)SIZE_MAX) {
+        mapping = mmap(NULL, (size_t)file_stat.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                       MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+        madvise(mapping, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+#endif
+        contents->data = (char*)mapping;
+        contents->len = (size_t)file_stat.st_size;
+        contents->is_mapped = PARSON_TRUE;
+        return JSONSuccess;
+    }
+#else
+    (void)writable; /* heap copies are always writable */
+#endif
+    contents->data = read_file(filename, &contents->len);
+    contents->is_mapped = PARSON_FALSE;
+    return contents->data != NULL ? JSONSuccess : JSONFailure;
+}
+
+static void file_contents_release(JSON_File_Contents *contents) {
+#ifdef PARSON_USE_MMAP
+    if (contents->is_mapped) {
+        munmap(contents->data, contents->len);
+        contents->data = NULL;
+        return;
+    }
+#endif
+    parson_free(contents->data);
+    contents->data = NULL;
+}
+
+/* Blanks out comments in place, stops at len or at the first \0 */
+static void remove_comments(char *string, size_t len, const char *start_token, const char *end_token) {
     parson_bool_t in_string = PARSON_FALSE, escaped = PARSON_FALSE;
-    size_t i;
+    const char *end = string + len;
     char *ptr = NULL, current_char;
     size_t start_token_len = strlen(start_token);
     size_t end_token_len = strlen(end_token);
     if (start_token_len == 0 || end_token_len == 0) {
         return;
     }
-    while ((current_char = *string) != '\0') {
+    while (string < end && (current_char = *string) != '\0') {
         if (current_char == '\\' && !escaped) {
             escaped = PARSON_TRUE;
             string++;
             continue;
         } else if (current_char == '\"' && !escaped) {
             in_string = !in_string;
-        } else if (!in_string && strncmp(string, start_token, start_token_len) == 0) {
-            for(i = 0; i < start_token_len; i++) {
-                string[i] = ' ';
-            }
+        } else if (!in_string && (size_t)(end - string) >= start_token_len
+                   && memcmp(string, start_token, start_token_len) == 0) {
+            memset(string, ' ', start_token_len);
             string = string + start_token_len;
-            ptr = strstr(string, end_token);
-            if (!ptr) {
-                return;
+            for (ptr = string; (size_t)(end - ptr) >= end_token_len; ptr++) {
+                if (*ptr == '\0') {
+                    return;
+                }
+                if (memcmp(ptr, end_token, end_token_len) == 0) {
+                    break;
+                }
             }
-            for (i = 0; i < (ptr - string) + end_token_len; i++) {
-                string[i] = ' ';
+            if ((size_t)(end - ptr) < end_token_len) {
+                return;
             }
+            memset(string, ' ', (ptr - string) + end_token_len);
             string = ptr + end_token_len - 1;
         }
         escaped = PARSON_FALSE;
@@ -393,6 +567,13 @@ static int is_valid_utf8(const char *string, size_t string_len) {
     int len = 0;
     const char *string_end =  string + string_len;
     while (string < string_end) {
+        string += scan_ascii(string, (size_t)(string_end - string));
+        if (string == string_end) {
+            break;
+        }
+        if (num_bytes_in_utf8_sequence((unsigned char)*string) > string_end - string) {
+            return PARSON_FALSE; /* truncated sequence */
+        }
         if (verify_utf8_sequence((const unsigned char*)string, &len) != JSONSuccess) {
             return PARSON_FALSE;
         }
@@ -401,6 +582,72 @@ static int is_valid_utf8(const char *string, size_t string_len) {
     return PARSON_TRUE;
 }
 
+#ifdef PARSON_USE_SSE2
+static size_t first_set_bit(unsigned int mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_ctz(mask);
+#else
+    size_t i = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+#endif
+
+/* Returns the length of the leading run of 7-bit characters */
+static size_t scan_ascii(const char *string, size_t len) {
+    size_t i = 0;
+#ifdef PARSON_USE_SSE2
+    unsigned int mask = 0;
+    for (; i + 16 <= len; i += 16) {
+        mask = (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(string + i)));
+        if (mask != 0) {
+            return i + first_set_bit(mask);
+        }
+    }
+#endif
+    while (i < len && ((unsigned char)string[i] & 0x80) == 0) {
+        i++;
+    }
+    return i;
+}
+
+/* Returns the length of the leading run that can be written between quotes as is:
+   no quote, backslash, control character (including \0) or, if requested, slash */
+static size_t scan_plain_chars(const char *string, size_t len, parson_bool_t escape_slashes) {
+    size_t i = 0;
+    unsigned char c = '\0';
+#ifdef PARSON_USE_SSE2
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i slash = _mm_set1_epi8(escape_slashes ? '/' : '\"');
+    const __m128i last_control = _mm_set1_epi8(0x1F);
+    __m128i chunk, special;
+    unsigned int mask = 0;
+    for (; i + 16 <= len; i += 16) {
+        chunk = _mm_loadu_si128((const __m128i*)(string + i));
+        special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+        special = _mm_or_si128(special, _mm_cmpeq_epi8(chunk, slash));
+        /* unsigned chunk <= 0x1f */
+        special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_min_epu8(chunk, last_control), chunk));
+        mask = (unsigned int)_mm_movemask_epi8(special);
+        if (mask != 0) {
+            return i + first_set_bit(mask);
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        c = (unsigned char)string[i];
+        if (c < 0x20 || c == '\"' || c == '\\' || (c == '/' && escape_slashes)) {
+            break;
+        }
+    }
+    return i;
+}
+
 static parson_bool_t is_decimal(const char *string, size_t length) {
     if (length > 1 && string[0] == '0' && string[1] != '.') {
         return PARSON_FALSE;
@@ -416,150 +663,123 @@ static parson_bool_t is_decimal(const char *string, size_t length) {
     return PARSON_TRUE;
 }
 
+/* Reads 8 bytes at a time and mixes them with multiply-xorshift steps (from splitmix64) */
 static unsigned long hash_string(const char *string, size_t n) {
 #ifdef PARSON_FORCE_HASH_COLLISIONS
     (void)string;
     (void)n;
     return 0;
 #else
-    unsigned long hash = 5381;
-    unsigned char c;
-    size_t i = 0;
-    for (i = 0; i < n; i++) {
-        c = string[i];
-        if (c == '\0') {
-            break;
-        }
-        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-    }
-    return hash;
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ (uint64_t)n;
+    uint64_t word = 0;
+    while (n >= sizeof(word)) {
+        memcpy(&word, string, sizeof(word));
+        hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 31;
+        string += sizeof(word);
+        n -= sizeof(word);
+    }
+    if (n > 0) {
+        word = 0;
+        memcpy(&word, string, n);
+        hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 31;
+    }
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    hash ^= hash >> 31;
+    return (unsigned long)hash;
 #endif
 }
 
 /* JSON Object */
 static JSON_Object * json_object_make(JSON_Value *wrapping_value) {
-    JSON_Status res = JSONFailure;
     JSON_Object *new_obj = (JSON_Object*)parson_malloc(sizeof(JSON_Object));
     if (new_obj == NULL) {
         return NULL;
     }
     new_obj->wrapping_value = wrapping_value;
-    res = json_object_init(new_obj, 0);
-    if (res != JSONSuccess) {
-        parson_free(new_obj);
-        return NULL;
-    }
+    json_object_init(new_obj);
     return new_obj;
 }
 
-static JSON_Status json_object_init(JSON_Object *object, size_t capacity) {
-    unsigned int i = 0;
-
+static void json_object_init(JSON_Object *object) {
+    object->items = NULL;
     object->cells = NULL;
-    object->names = NULL;
-    object->values = NULL;
-    object->cell_ixs = NULL;
-    object->hashes = NULL;
-
     object->count = 0;
-    object->cell_capacity = capacity;
-    object->item_capacity = (unsigned int)(capacity * 7/10);
-
-    if (capacity == 0) {
-        return JSONSuccess;
-    }
-
-    object->cells = (size_t*)parson_malloc(object->cell_capacity * sizeof(*object->cells));
-    object->names = (char**)parson_malloc(object->item_capacity * sizeof(*object->names));
-    object->values = (JSON_Value**)parson_malloc(object->item_capacity * sizeof(*object->values));
-    object->cell_ixs = (size_t*)parson_malloc(object->item_capacity * sizeof(*object->cell_ixs));
-    object->hashes = (unsigned long*)parson_malloc(object->item_capacity * sizeof(*object->hashes));
-    if (object->cells == NULL
-        || object->names == NULL
-        || object->values == NULL
-        || object->cell_ixs == NULL
-        || object->hashes == NULL) {
-        goto error;
-    }
-    for (i = 0; i < object->cell_capacity; i++) {
-        object->cells[i] = OBJECT_INVALID_IX;
-    }
-    return JSONSuccess;
-error:
-    parson_free(object->cells);
-    parson_free(object->names);
-    parson_free(object->values);
-    parson_free(object->cell_ixs);
-    parson_free(object->hashes);
-    return JSONFailure;
+    object->item_capacity = 0;
+    object->cell_capacity = 0;
 }
 
 static void json_object_deinit(JSON_Object *object, parson_bool_t free_keys, parson_bool_t free_values) {
-    unsigned int i = 0;
+    size_t i = 0;
     for (i = 0; i < object->count; i++) {
         if (free_keys) {
-            parson_free(object->names[i]);
+            parson_free(object->items[i].name);
         }
         if (free_values) {
-            json_value_free(object->values[i]);
+            json_value_release(object->items[i].value);
         }
     }
-
-    object->count = 0;
-    object->item_capacity = 0;
-    object->cell_capacity = 0;
-
+    parson_free(object->items);
     parson_free(object->cells);
-    parson_free(object->names);
-    parson_free(object->values);
-    parson_free(object->cell_ixs);
-    parson_free(object->hashes);
-
-    object->cells = NULL;
-    object->names = NULL;
-    object->values = NULL;
-    object->cell_ixs = NULL;
-    object->hashes = NULL;
+    json_object_init(object);
 }
 
-static JSON_Status json_object_grow_and_rehash(JSON_Object *object) {
-    JSON_Value *wrapping_value = NULL;
-    JSON_Object new_object;
-    char *key = NULL;
-    JSON_Value *value = NULL;
-    unsigned int i = 0;
-    size_t new_capacity = MAX(object->cell_capacity * 2, STARTING_CAPACITY);
-    JSON_Status res = json_object_init(&new_object, new_capacity);
-    if (res != JSONSuccess) {
+static JSON_Status json_object_grow_items(JSON_Object *object) {
+    JSON_Object_Item *new_items = NULL;
+    size_t new_capacity = object->item_capacity == 0 ? OBJECT_STARTING_ITEMS : object->item_capacity * 2;
+    new_items = (JSON_Object_Item*)parson_malloc(new_capacity * sizeof(JSON_Object_Item));
+    if (new_items == NULL) {
         return JSONFailure;
     }
+    if (object->count > 0) {
+        memcpy(new_items, object->items, object->count * sizeof(JSON_Object_Item));
+    }
+    parson_free(object->items);
+    object->items = new_items;
+    object->item_capacity = new_capacity;
+    return JSONSuccess;
+}
 
-    wrapping_value = json_object_get_wrapping_value(object);
-    new_object.wrapping_value = wrapping_value;
-
+/* Builds a new hash index with given capacity (power of 2) for all items, computing
+   their hashes if object is switching from linear mode */
+static JSON_Status json_object_rehash(JSON_Object *object, size_t new_capacity) {
+    size_t *new_cells = NULL;
+    size_t i = 0, ix = 0;
+    parson_bool_t was_hashed = object->cells != NULL;
+    JSON_Object_Item *item = NULL;
+    new_cells = (size_t*)parson_malloc(new_capacity * sizeof(size_t));
+    if (new_cells == NULL) {
+        return JSONFailure;
+    }
+    for (i = 0; i < new_capacity; i++) {
+        new_cells[i] = OBJECT_INVALID_IX;
+    }
     for (i = 0; i < object->count; i++) {
-        key = object->names[i];
-        value = object->values[i];
-        res = json_object_add(&new_object, key, value);
-        if (res != JSONSuccess) {
-            json_object_deinit(&new_object, PARSON_FALSE, PARSON_FALSE);
-            return JSONFailure;
+        item = &object->items[i];
+        if (!was_hashed) {
+            item->hash = hash_string(item->name, item->name_len);
+        }
+        ix = item->hash & (new_capacity - 1);
+        while (new_cells[ix] != OBJECT_INVALID_IX) {
+            ix = (ix + 1) & (new_capacity - 1);
         }
-        value->parent = wrapping_value;
+        new_cells[ix] = i;
+        item->cell_ix = ix;
     }
-    json_object_deinit(object, PARSON_FALSE, PARSON_FALSE);
-    *object = new_object;
+    parson_free(object->cells);
+    object->cells = new_cells;
+    object->cell_capacity = new_capacity;
     return JSONSuccess;
 }
 
+/* Only used for hashed objects, returns cell containing the key or first free cell */
 static size_t json_object_get_cell_ix(const JSON_Object *object, const char *key, size_t key_len, unsigned long hash, parson_bool_t *out_found) {
     size_t cell_ix = hash & (object->cell_capacity - 1);
     size_t cell = 0;
     size_t ix = 0;
-    unsigned int i = 0;
-    unsigned long hash_to_check = 0;
-    const char *key_to_check = NULL;
-    size_t key_to_check_len = 0;
+    size_t i = 0;
+    const JSON_Object_Item *item = NULL;
 
     *out_found = PARSON_FALSE;
 
@@ -569,13 +789,8 @@ static size_t json_object_get_cell_ix(const JSON_Object *object, const char *key
         if (cell == OBJECT_INVALID_IX) {
             return ix;
         }
-        hash_to_check = object->hashes[cell];
-        if (hash != hash_to_check) {
-            continue;
-        }
-        key_to_check = object->names[cell];
-        key_to_check_len = strlen(key_to_check);
-        if (key_to_check_len == key_len && strncmp(key, key_to_check, key_len) == 0) {
+        item = &object->items[cell];
+        if (item->hash == hash && item->name_len == key_len && memcmp(key, item->name, key_len) == 0) {
             *out_found = PARSON_TRUE;
             return ix;
         }
@@ -583,63 +798,91 @@ static size_t json_object_get_cell_ix(const JSON_Object *object, const char *key
     return OBJECT_INVALID_IX;
 }
 
-static JSON_Status json_object_add(JSON_Object *object, char *name, JSON_Value *value) {
-    unsigned long hash = 0;
+/* Returns index of item with given name or OBJECT_INVALID_IX. hash is only used
+   (and only has to be valid) if object is hashed. */
+static size_t json_object_find_item_with_hash(const JSON_Object *object, const char *name, size_t name_len, unsigned long hash) {
+    size_t i = 0;
+    size_t cell_ix = 0;
+    parson_bool_t found = PARSON_FALSE;
+    const JSON_Object_Item *item = NULL;
+    if (object->cells == NULL) {
+        for (i = 0; i < object->count; i++) {
+            item = &object->items[i];
+            if (item->name_len == name_len && memcmp(item->name, name, name_len) == 0) {
+                return i;
+            }
+        }
+        return OBJECT_INVALID_IX;
+    }
+    cell_ix = json_object_get_cell_ix(object, name, name_len, hash, &found);
+    return found ? object->cells[cell_ix] : OBJECT_INVALID_IX;
+}
+
+static size_t json_object_find_item(const JSON_Object *object, const char *name, size_t name_len) {
+    unsigned long hash = object->cells != NULL ? hash_string(name, name_len) : 0;
+    return json_object_find_item_with_hash(object, name, name_len, hash);
+}
+
+/* Appends a name-value pair, name must not be present in object yet */
+static JSON_Status json_object_append_item(JSON_Object *object, char *name, size_t name_len, JSON_Value *value) {
+    JSON_Object_Item *item = NULL;
     parson_bool_t found = PARSON_FALSE;
+    parson_bool_t needs_rehash = PARSON_FALSE;
+    unsigned long hash = 0;
     size_t cell_ix = 0;
-    JSON_Status res = JSONFailure;
 
-    if (!object || !name || !value) {
+    if (object->count >= object->item_capacity && json_object_grow_items(object) != JSONSuccess) {
         return JSONFailure;
     }
-
-    hash = hash_string(name, strlen(name));
-    found = PARSON_FALSE;
-    cell_ix = json_object_get_cell_ix(object, name, strlen(name), hash, &found);
-    if (found) {
+    if (object->cells == NULL) {
+        needs_rehash = object->count + 1 > OBJECT_LINEAR_MAX;
+    } else {
+        needs_rehash = (object->count + 1) * 10 > object->cell_capacity * 7;
+    }
+    if (needs_rehash && json_object_rehash(object, MAX(object->cell_capacity * 2, STARTING_CAPACITY * 2)) != JSONSuccess) {
         return JSONFailure;
     }
-
-    if (object->count >= object->item_capacity) {
-        res = json_object_grow_and_rehash(object);
-        if (res != JSONSuccess) {
-            return JSONFailure;
-        }
-        cell_ix = json_object_get_cell_ix(object, name, strlen(name), hash, &found);
+    item = &object->items[object->count];
+    item->name = name;
+    item->name_len = name_len;
+    item->value = value;
+    if (object->cells != NULL) {
+        hash = hash_string(name, name_len);
+        cell_ix = json_object_get_cell_ix(object, name, name_len, hash, &found);
+        item->hash = hash;
+        item->cell_ix = cell_ix;
+        object->cells[cell_ix] = object->count;
     }
-
-    object->names[object->count] = name;
-    object->cells[cell_ix] = object->count;
-    object->values[object->count] = value;
-    object->cell_ixs[object->count] = cell_ix;
-    object->hashes[object->count] = hash;
     object->count++;
     value->parent = json_object_get_wrapping_value(object);
-
     return JSONSuccess;
 }
 
+static JSON_Status json_object_add(JSON_Object *object, char *name, JSON_Value *value) {
+    size_t name_len = 0;
+    if (!object || !name || !value) {
+        return JSONFailure;
+    }
+    name_len = strlen(name);
+    if (json_object_find_item(object, name, name_len) != OBJECT_INVALID_IX) {
+        return JSONFailure;
+    }
+    return json_object_append_item(object, name, name_len, value);
+}
+
 static JSON_Value * json_object_getn_value(const JSON_Object *object, const char *name, size_t name_len) {
-    unsigned long hash = 0;
-    parson_bool_t found = PARSON_FALSE;
-    size_t cell_ix = 0;
     size_t item_ix = 0;
     if (!object || !name) {
         return NULL;
     }
-    hash = hash_string(name, name_len);
-    found = PARSON_FALSE;
-    cell_ix = json_object_get_cell_ix(object, name, name_len, hash, &found);
-    if (!found) {
+    item_ix = json_object_find_item(object, name, name_len);
+    if (item_ix == OBJECT_INVALID_IX) {
         return NULL;
     }
-    item_ix = object->cells[cell_ix];
-    return object->values[item_ix];
+    return object->items[item_ix].value;
 }
 
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name, parson_bool_t free_value) {
-    unsigned long hash = 0;
-    parson_bool_t found = PARSON_FALSE;
     size_t cell = 0;
     size_t item_ix = 0;
     size_t last_item_ix = 0;
@@ -647,37 +890,37 @@ static JSON_Status json_object_remove_internal(JSON_Object *object, const char *
     size_t j = 0;
     size_t x = 0;
     size_t k = 0;
-    JSON_Value *val = NULL;
 
-    if (object == NULL) {
+    if (object == NULL || name == NULL || json_value_is_shared(json_object_get_wrapping_value(object))) {
         return JSONFailure;
     }
 
-    hash = hash_string(name, strlen(name));
-    found = PARSON_FALSE;
-    cell = json_object_get_cell_ix(object, name, strlen(name), hash, &found);
-    if (!found) {
+    item_ix = json_object_find_item(object, name, strlen(name));
+    if (item_ix == OBJECT_INVALID_IX) {
         return JSONFailure;
     }
 
-    item_ix = object->cells[cell];
     if (free_value) {
-        val = object->values[item_ix];
-        json_value_free(val);
-        val = NULL;
+        json_value_release(object->items[item_ix].value);
     }
 
-    parson_free(object->names[item_ix]);
+    parson_free(object->items[item_ix].name);
+    if (object->cells != NULL) {
+        cell = object->items[item_ix].cell_ix;
+    }
     last_item_ix = object->count - 1;
     if (item_ix < last_item_ix) {
-        object->names[item_ix] = object->names[last_item_ix];
-        object->values[item_ix] = object->values[last_item_ix];
-        object->cell_ixs[item_ix] = object->cell_ixs[last_item_ix];
-        object->hashes[item_ix] = object->hashes[last_item_ix];
-        object->cells[object->cell_ixs[item_ix]] = item_ix;
+        object->items[item_ix] = object->items[last_item_ix];
+        if (object->cells != NULL) {
+            object->cells[object->items[item_ix].cell_ix] = item_ix;
+        }
     }
     object->count--;
 
+    if (object->cells == NULL) {
+        return JSONSuccess;
+    }
+
     i = cell;
     j = i;
     for (x = 0; x < (object->cell_capacity - 1); x++) {
@@ -685,10 +928,10 @@ static JSON_Status json_object_remove_internal(JSON_Object *object, const char *
         if (object->cells[j] == OBJECT_INVALID_IX) {
             break;
         }
-        k = object->hashes[object->cells[j]] & (object->cell_capacity - 1);
+        k = object->items[object->cells[j]].hash & (object->cell_capacity - 1);
         if ((j > i && (k <= i || k > j))
          || (j < i && (k <= i && k > j))) {
-            object->cell_ixs[object->cells[j]] = i;
+            object->items[object->cells[j]].cell_ix = i;
             object->cells[i] = object->cells[j];
             i = j;
         }
@@ -764,7 +1007,7 @@ static JSON_Status json_array_resize(JSON_Array *array, size_t new_capacity) {
 static void json_array_free(JSON_Array *array) {
     size_t i;
     for (i = 0; i < array->count; i++) {
-        json_value_free(array->items[i]);
+        json_value_release(array->items[i]);
     }
     parson_free(array->items);
     parson_free(array);
@@ -777,6 +1020,7 @@ static JSON_Value * json_value_init_string_no_copy(char *string, size_t length)
         return NULL;
     }
     new_value->parent = NULL;
+    new_value->refs = 0;
     new_value->type = JSONString;
     new_value->value.string.chars = string;
     new_value->value.string.length = length;
@@ -784,17 +1028,181 @@ static JSON_Value * json_value_init_string_no_copy(char *string, size_t length)
 }
 
 /* Parser */
-static JSON_Status skip_quotes(const char **string) {
-    if (**string != '\"') {
+/* Structural index, the first stage of parsing large inputs: one sweep over the input
+   marks quotes delimiting strings, structural characters outside of strings and the
+   first character after every run of whitespace outside of strings. The parser then
+   jumps over whitespace and string contents with the index instead of byte by byte. */
+#define INDEX_CLASS_QUOTE      1
+#define INDEX_CLASS_BACKSLASH  2
+#define INDEX_CLASS_WHITESPACE 4
+#define INDEX_CLASS_STRUCTURAL 8
+
+#define IS_INDEX_WHITESPACE(c) ((c) == ' ' || ((unsigned char)(c) >= 0x09 && (unsigned char)(c) <= 0x0D)) /* isspace in the "C" locale */
+
+typedef struct json_index_masks {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t whitespace;
+    uint64_t structural;
+} JSON_Index_Masks;
+
+static size_t lowest_set_bit64(uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_ctzll(mask);
+#else
+    size_t i = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+#ifdef PARSON_USE_SSE2
+static uint64_t index_movemask(__m128i matches, size_t offset) {
+    return (uint64_t)(unsigned int)_mm_movemask_epi8(matches) << offset;
+}
+#endif
+
+/* Classifies 64 bytes, one bit per byte */
+static void index_classify(const char *block, JSON_Index_Masks *masks) {
+#ifdef PARSON_USE_SSE2
+    const __m128i quote = _mm_set1_epi8('\"'), backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8(0x09), last_space = _mm_set1_epi8(0x0D - 0x09);
+    __m128i chunk, shifted, structural;
+    size_t i = 0;
+    memset(masks, 0, sizeof(JSON_Index_Masks));
+    for (i = 0; i < 64; i += 16) {
+        chunk = _mm_loadu_si128((const __m128i*)(block + i));
+        masks->quote |= index_movemask(_mm_cmpeq_epi8(chunk, quote), i);
+        masks->backslash |= index_movemask(_mm_cmpeq_epi8(chunk, backslash), i);
+        shifted = _mm_sub_epi8(chunk, tab); /* 0x09-0x0D map to 0-4 */
+        masks->whitespace |= index_movemask(_mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+            _mm_cmpeq_epi8(_mm_min_epu8(shifted, last_space), shifted)), i);
+        structural = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('{')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('}')));
+        structural = _mm_or_si128(structural, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('[')));
+        structural = _mm_or_si128(structural, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(']')));
+        structural = _mm_or_si128(structural, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(':')));
+        structural = _mm_or_si128(structural, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(',')));
+        masks->structural |= index_movemask(structural, i);
+    }
+#else
+    uint64_t bit = 1;
+    size_t i = 0;
+    memset(masks, 0, sizeof(JSON_Index_Masks));
+    for (i = 0; i < 64; i++, bit <<= 1) {
+        switch (block[i]) {
+            case '\"': masks->quote |= bit; break;
+            case '\\': masks->backslash |= bit; break;
+            case '{': case '}': case '[': case ']': case ':': case ',':
+                masks->structural |= bit;
+                break;
+            default:
+                if (IS_INDEX_WHITESPACE(block[i])) {
+                    masks->whitespace |= bit;
+                }
+                break;
+        }
+    }
+#endif
+}
+
+static JSON_Status structural_index_build(JSON_Structural_Index *index, const char *string, size_t len) {
+    JSON_Index_Masks masks;
+    char last_block[64];
+    const char *block = NULL;
+    uint64_t escaped = 0, backslashes = 0, bit = 0, quotes = 0, in_string = 0, whitespace_outside = 0;
+    uint64_t escape_carry = 0, string_carry = 0, whitespace_carry = 1; /* input starts after whitespace */
+    size_t word_ix = 0;
+    index->base = string;
+    index->count = (len + 63) / 64;
+    index->words = (uint64_t*)parson_malloc(MAX(index->count, 1) * sizeof(uint64_t));
+    if (index->words == NULL) {
+        return JSONFailure;
+    }
+    for (word_ix = 0; word_ix < index->count; word_ix++) {
+        block = string + word_ix * 64;
+        if (len - word_ix * 64 < 64) { /* pad the last block with whitespace */
+            memset(last_block, ' ', sizeof(last_block));
+            memcpy(last_block, block, len - word_ix * 64);
+            block = last_block;
+        }
+        index_classify(block, &masks);
+        /* a backslash escapes the next character unless it is escaped itself */
+        escaped = escape_carry;
+        escape_carry = 0;
+        backslashes = masks.backslash & ~escaped;
+        while (backslashes != 0) {
+            bit = backslashes & (~backslashes + 1);
+            backslashes &= backslashes - 1;
+            if (escaped & bit) {
+                continue;
+            }
+            if (bit == ((uint64_t)1 << 63)) {
+                escape_carry = 1;
+            } else {
+                escaped |= bit << 1;
+            }
+        }
+        quotes = masks.quote & ~escaped;
+        /* prefix xor of quotes: set from an opening quote up to, not including, its closing quote */
+        in_string = quotes;
+        in_string ^= in_string << 1;
+        in_string ^= in_string << 2;
+        in_string ^= in_string << 4;
+        in_string ^= in_string << 8;
+        in_string ^= in_string << 16;
+        in_string ^= in_string << 32;
+        in_string ^= string_carry;
+        string_carry = (uint64_t)0 - (in_string >> 63);
+        whitespace_outside = masks.whitespace & ~in_string;
+        index->words[word_ix] = quotes | (masks.structural & ~in_string)
+                              | (((whitespace_outside << 1) | whitespace_carry) & ~masks.whitespace & ~in_string);
+        whitespace_carry = whitespace_outside >> 63;
+    }
+    if (len % 64 != 0) {
+        index->words[index->count - 1] &= ((uint64_t)1 << (len % 64)) - 1;
+    }
+    return JSONSuccess;
+}
+
+/* Returns the first indexed position at or after position, or end if there is none */
+static const char * structural_index_next(const JSON_Structural_Index *index, const char *position, const char *end) {
+    size_t offset = (size_t)(position - index->base);
+    size_t word_ix = offset / 64;
+    uint64_t word = 0;
+    if (word_ix >= index->count) {
+        return end;
+    }
+    word = index->words[word_ix] & ((uint64_t)0 - ((uint64_t)1 << (offset % 64)));
+    while (word == 0) {
+        word_ix++;
+        if (word_ix >= index->count) {
+            return end;
+        }
+        word = index->words[word_ix];
+    }
+    position = index->base + word_ix * 64 + lowest_set_bit64(word);
+    return position < end ? position : end;
+}
+
+static JSON_Status skip_quotes(const char **string, const char *end) {
+    if (CURRENT_CHAR(string, end) != '\"') {
         return JSONFailure;
     }
     SKIP_CHAR(string);
-    while (**string != '\"') {
-        if (**string == '\0') {
+    while (PARSON_TRUE) {
+        if (*string < end) {
+            *string += scan_plain_chars(*string, (size_t)(end - *string), PARSON_FALSE);
+        }
+        if (CURRENT_CHAR(string, end) == '\"') {
+            break;
+        } else if (CURRENT_CHAR(string, end) == '\0') {
             return JSONFailure;
-        } else if (**string == '\\') {
+        } else if (CURRENT_CHAR(string, end) == '\\') {
             SKIP_CHAR(string);
-            if (**string == '\0') {
+            if (CURRENT_CHAR(string, end) == '\0') {
                 return JSONFailure;
             }
         }
@@ -856,7 +1264,7 @@ Example: "\u006Corem ipsum" -> lorem ipsum */
 static char* process_string(const char *input, size_t input_len, size_t *output_len) {
     const char *input_ptr = input;
     size_t initial_size = (input_len + 1) * sizeof(char);
-    size_t final_size = 0;
+    size_t final_size = 0, run_len = 0;
     char *output = NULL, *output_ptr = NULL, *resized_output = NULL;
     output = (char*)parson_malloc(initial_size);
     if (output == NULL) {
@@ -864,6 +1272,13 @@ static char* process_string(const char *input, size_t input_len, size_t *output_
     }
     output_ptr = output;
     while ((*input_ptr != '\0') && (size_t)(input_ptr - input) < input_len) {
+        run_len = scan_plain_chars(input_ptr, input_len - (size_t)(input_ptr - input), PARSON_FALSE);
+        if (run_len > 0) {
+            memcpy(output_ptr, input_ptr, run_len);
+            output_ptr += run_len;
+            input_ptr += run_len;
+            continue;
+        }
         if (*input_ptr == '\\') {
             input_ptr++;
             switch (*input_ptr) {
@@ -910,10 +1325,24 @@ error:
 
 /* Return processed contents of a string between quotes and
    skips passed argument to a matching quote. */
-static char * get_quoted_string(const char **string, size_t *output_string_len) {
+static char * get_quoted_string(const char **string, const char *end, const JSON_Structural_Index *index,
+                                size_t *output_string_len) {
     const char *string_start = *string;
     size_t input_string_len = 0;
-    JSON_Status status = skip_quotes(string);
+    JSON_Status status = JSONFailure;
+    if (index != NULL) { /* the closing quote is the next indexed position */
+        if (CURRENT_CHAR(string, end) != '\"') {
+            return NULL;
+        }
+        *string = structural_index_next(index, *string + 1, end);
+        if (*string == end) {
+            return NULL;
+        }
+        SKIP_CHAR(string);
+        status = JSONSuccess;
+    } else {
+        status = skip_quotes(string, end);
+    }
     if (status != JSONSuccess) {
         return NULL;
     }
@@ -921,157 +1350,121 @@ static char * get_quoted_string(const char **string, size_t *output_string_len)
     return process_string(string_start + 1, input_string_len, output_string_len);
 }
 
-static JSON_Value * parse_value(const char **string, size_t nesting) {
-    if (nesting > MAX_NESTING) {
-        return NULL;
-    }
-    SKIP_WHITESPACES(string);
-    switch (**string) {
-        case '{':
-            return parse_object_value(string, nesting + 1);
-        case '[':
-            return parse_array_value(string, nesting + 1);
-        case '\"':
-            return parse_string_value(string);
-        case 'f': case 't':
-            return parse_boolean_value(string);
-        case '-':
-        case '0': case '1': case '2': case '3': case '4':
-        case '5': case '6': case '7': case '8': case '9':
-            return parse_number_value(string);
-        case 'n':
-            return parse_null_value(string);
-        default:
-            return NULL;
-    }
-}
-
-static JSON_Value * parse_object_value(const char **string, size_t nesting) {
-    JSON_Status status = JSONFailure;
-    JSON_Value *output_value = NULL, *new_value = NULL;
-    JSON_Object *output_object = NULL;
+/* Parses the first value of string without recursion: open objects and arrays are
+   tracked through the parent pointers of their values, so nesting depth is only
+   limited by MAX_NESTING and not by the call stack. */
+static JSON_Value * parse_value(const char **string, const char *end, const JSON_Structural_Index *index) {
+    JSON_Value *root = NULL, *container = NULL, *new_value = NULL;
     char *new_key = NULL;
-
-    output_value = json_value_init_object();
-    if (output_value == NULL) {
-        return NULL;
-    }
-    if (**string != '{') {
-        json_value_free(output_value);
-        return NULL;
-    }
-    output_object = json_value_get_object(output_value);
-    SKIP_CHAR(string);
-    SKIP_WHITESPACES(string);
-    if (**string == '}') { /* empty object */
-        SKIP_CHAR(string);
-        return output_value;
-    }
-    while (**string != '\0') {
-        size_t key_len = 0;
-        new_key = get_quoted_string(string, &key_len);
-        /* We do not support key names with embedded \0 chars */
-        if (!new_key) {
-            json_value_free(output_value);
-            return NULL;
-        }
-        if (key_len != strlen(new_key)) {
-            parson_free(new_key);
-            json_value_free(output_value);
-            return NULL;
+    size_t key_len = 0, nesting = 0;
+    parson_bool_t is_container = PARSON_FALSE;
+    char close_char = '\0';
+
+    while (PARSON_TRUE) {
+        SKIP_TO_TOKEN(string, end, index);
+        if (container != NULL && json_value_get_type(container) == JSONObject) {
+            new_key = get_quoted_string(string, end, index, &key_len);
+            /* We do not support key names with embedded \0 chars */
+            if (new_key == NULL || key_len != strlen(new_key)) {
+                goto error;
+            }
+            SKIP_TO_TOKEN(string, end, index);
+            if (CURRENT_CHAR(string, end) != ':') {
+                goto error;
+            }
+            SKIP_CHAR(string);
+            SKIP_TO_TOKEN(string, end, index);
         }
-        SKIP_WHITESPACES(string);
-        if (**string != ':') {
-            parson_free(new_key);
-            json_value_free(output_value);
-            return NULL;
+        is_container = PARSON_FALSE;
+        switch (CURRENT_CHAR(string, end)) {
+            case '{':
+            case '[':
+                if (nesting >= MAX_NESTING) {
+                    goto error;
+                }
+                new_value = **string == '{' ? json_value_init_object() : json_value_init_array();
+                SKIP_CHAR(string);
+                is_container = PARSON_TRUE;
+                break;
+            case '\"':
+                new_value = parse_string_value(string, end, index);
+                break;
+            case 'f': case 't':
+                new_value = parse_boolean_value(string, end);
+                break;
+            case '-':
+            case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9':
+                new_value = parse_number_value(string, end);
+                break;
+            case 'n':
+                new_value = parse_null_value(string, end);
+                break;
+            default:
+                goto error;
         }
-        SKIP_CHAR(string);
-        new_value = parse_value(string, nesting);
         if (new_value == NULL) {
-            parson_free(new_key);
-            json_value_free(output_value);
-            return NULL;
+            goto error;
         }
-        status = json_object_add(output_object, new_key, new_value);
-        if (status != JSONSuccess) {
-            parson_free(new_key);
+        if (container == NULL) {
+            root = new_value;
+        } else if (json_value_get_type(container) == JSONObject) {
+            if (json_object_add(json_value_get_object(container), new_key, new_value) != JSONSuccess) {
+                json_value_free(new_value);
+                goto error;
+            }
+            new_key = NULL;
+        } else if (json_array_add(json_value_get_array(container), new_value) != JSONSuccess) {
             json_value_free(new_value);
-            json_value_free(output_value);
-            return NULL;
+            goto error;
         }
-        SKIP_WHITESPACES(string);
-        if (**string != ',') {
-            break;
+        if (is_container) {
+            container = new_value;
+            nesting++;
+            SKIP_TO_TOKEN(string, end, index);
+            close_char = json_value_get_type(container) == JSONObject ? '}' : ']';
+            if (CURRENT_CHAR(string, end) != close_char) {
+                continue; /* parse first member */
+            }
+            SKIP_CHAR(string); /* empty object or array */
+            container = json_value_get_parent(container);
+            nesting--;
         }
-        SKIP_CHAR(string);
-        SKIP_WHITESPACES(string);
-        if (**string == '}') {
-            break;
+        /* Closes finished containers until the next member or the end of the root value */
+        while (container != NULL) {
+            SKIP_TO_TOKEN(string, end, index);
+            close_char = json_value_get_type(container) == JSONObject ? '}' : ']';
+            if (CURRENT_CHAR(string, end) == ',') {
+                SKIP_CHAR(string);
+                SKIP_TO_TOKEN(string, end, index);
+                if (CURRENT_CHAR(string, end) != close_char) {
+                    break; /* trailing commas are allowed */
+                }
+            } else if (CURRENT_CHAR(string, end) != close_char) {
+                goto error;
+            }
+            if (close_char == ']' /* Trim array after parsing is over */
+                && json_array_resize(json_value_get_array(container), json_array_get_count(json_value_get_array(container))) != JSONSuccess) {
+                goto error;
+            }
+            SKIP_CHAR(string);
+            container = json_value_get_parent(container);
+            nesting--;
+        }
+        if (container == NULL) {
+            return root;
         }
     }
-    SKIP_WHITESPACES(string);
-    if (**string != '}') {
-        json_value_free(output_value);
-        return NULL;
-    }
-    SKIP_CHAR(string);
-    return output_value;
-}
-
-static JSON_Value * parse_array_value(const char **string, size_t nesting) {
-    JSON_Value *output_value = NULL, *new_array_value = NULL;
-    JSON_Array *output_array = NULL;
-    output_value = json_value_init_array();
-    if (output_value == NULL) {
-        return NULL;
-    }
-    if (**string != '[') {
-        json_value_free(output_value);
-        return NULL;
-    }
-    output_array = json_value_get_array(output_value);
-    SKIP_CHAR(string);
-    SKIP_WHITESPACES(string);
-    if (**string == ']') { /* empty array */
-        SKIP_CHAR(string);
-        return output_value;
-    }
-    while (**string != '\0') {
-        new_array_value = parse_value(string, nesting);
-        if (new_array_value == NULL) {
-            json_value_free(output_value);
-            return NULL;
-        }
-        if (json_array_add(output_array, new_array_value) != JSONSuccess) {
-            json_value_free(new_array_value);
-            json_value_free(output_value);
-            return NULL;
-        }
-        SKIP_WHITESPACES(string);
-        if (**string != ',') {
-            break;
-        }
-        SKIP_CHAR(string);
-        SKIP_WHITESPACES(string);
-        if (**string == ']') {
-            break;
-        }
-    }
-    SKIP_WHITESPACES(string);
-    if (**string != ']' || /* Trim array after parsing is over */
-        json_array_resize(output_array, json_array_get_count(output_array)) != JSONSuccess) {
-            json_value_free(output_value);
-            return NULL;
-    }
-    SKIP_CHAR(string);
-    return output_value;
+error:
+    parson_free(new_key);
+    json_value_free(root);
+    return NULL;
 }
 
-static JSON_Value * parse_string_value(const char **string) {
+static JSON_Value * parse_string_value(const char **string, const char *end, const JSON_Structural_Index *index) {
     JSON_Value *value = NULL;
     size_t new_string_len = 0;
-    char *new_string = get_quoted_string(string, &new_string_len);
+    char *new_string = get_quoted_string(string, end, index, &new_string_len);
     if (new_string == NULL) {
         return NULL;
     }
@@ -1083,37 +1476,180 @@ static JSON_Value * parse_string_value(const char **string) {
     return value;
 }
 
-static JSON_Value * parse_boolean_value(const char **string) {
+static JSON_Value * parse_boolean_value(const char **string, const char *end) {
     size_t true_token_size = SIZEOF_TOKEN("true");
     size_t false_token_size = SIZEOF_TOKEN("false");
-    if (strncmp("true", *string, true_token_size) == 0) {
+    size_t available = (size_t)(end - *string);
+    if (available >= true_token_size && strncmp("true", *string, true_token_size) == 0) {
         *string += true_token_size;
         return json_value_init_boolean(1);
-    } else if (strncmp("false", *string, false_token_size) == 0) {
+    } else if (available >= false_token_size && strncmp("false", *string, false_token_size) == 0) {
         *string += false_token_size;
         return json_value_init_boolean(0);
     }
     return NULL;
 }
 
-static JSON_Value * parse_number_value(const char **string) {
+/* Exact powers of ten representable in a double, used by the fast path below. */
+static const double parson_exact_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define PARSON_MAX_EXACT_MANTISSA ((uint64_t)1 << 53)
+#define PARSON_MAX_EXACT_POW10    22
+
+/* Parses numbers which can be converted exactly without strtod (Clinger's fast path):
+   strict JSON grammar, at most 19 significant digits, mantissa <= 2^53 and
+   |exponent| <= 22. Returns JSONFailure without moving *string for anything else,
+   in which case the caller falls back to strtod. */
+static JSON_Status parse_number_fast(const char **string, double *result) {
+    const char *ptr = *string;
+    parson_bool_t negative = PARSON_FALSE;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    int exponent_part = 0;
+    parson_bool_t exponent_negative = PARSON_FALSE;
+    double number = 0.0;
+
+    if (*ptr == '-') {
+        negative = PARSON_TRUE;
+        ptr++;
+    }
+    if (*ptr == '0') {
+        ptr++;
+        if (isdigit((unsigned char)*ptr)) {
+            return JSONFailure;
+        }
+    } else if (*ptr >= '1' && *ptr <= '9') {
+        while (isdigit((unsigned char)*ptr)) {
+            if (digits == 19) {
+                return JSONFailure;
+            }
+            mantissa = mantissa * 10 + (uint64_t)(*ptr - '0');
+            digits++;
+            ptr++;
+        }
+    } else {
+        return JSONFailure;
+    }
+    if (*ptr == '.') {
+        ptr++;
+        if (!isdigit((unsigned char)*ptr)) {
+            return JSONFailure;
+        }
+        while (isdigit((unsigned char)*ptr)) {
+            if (digits == 19) {
+                return JSONFailure;
+            }
+            mantissa = mantissa * 10 + (uint64_t)(*ptr - '0');
+            if (mantissa != 0) { /* leading zeros of a fraction aren't significant */
+                digits++;
+            }
+            exponent--;
+            ptr++;
+        }
+    }
+    if (*ptr == 'e' || *ptr == 'E') {
+        ptr++;
+        if (*ptr == '-' || *ptr == '+') {
+            exponent_negative = *ptr == '-';
+            ptr++;
+        }
+        if (!isdigit((unsigned char)*ptr)) {
+            return JSONFailure;
+        }
+        while (isdigit((unsigned char)*ptr)) {
+            if (exponent_part > 9999) {
+                return JSONFailure;
+            }
+            exponent_part = exponent_part * 10 + (*ptr - '0');
+            ptr++;
+        }
+        exponent += exponent_negative ? -exponent_part : exponent_part;
+    }
+    if (mantissa > PARSON_MAX_EXACT_MANTISSA) {
+        return JSONFailure;
+    }
+    number = (double)mantissa;
+    if (mantissa != 0 && exponent != 0) {
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+        return JSONFailure; /* excess precision breaks exactness of single multiplication */
+#else
+        if (exponent > PARSON_MAX_EXACT_POW10 || exponent < -PARSON_MAX_EXACT_POW10) {
+            return JSONFailure;
+        }
+        if (exponent > 0) {
+            number = number * parson_exact_pow10[exponent];
+        } else {
+            number = number / parson_exact_pow10[-exponent];
+        }
+#endif
+    }
+    *result = negative ? -number : number;
+    *string = ptr;
+    return JSONSuccess;
+}
+
+static JSON_Status parse_number(const char **string, double *result) {
     char *end;
     double number = 0;
+    if (parse_number_fast(string, result) == JSONSuccess) {
+        return JSONSuccess;
+    }
     errno = 0;
     number = strtod(*string, &end);
     if (errno == ERANGE && (number <= -HUGE_VAL || number >= HUGE_VAL)) {
-        return NULL;
+        return JSONFailure;
     }
     if ((errno && errno != ERANGE) || !is_decimal(*string, end - *string)) {
-        return NULL;
+        return JSONFailure;
     }
     *string = end;
+    *result = number;
+    return JSONSuccess;
+}
+
+/* Input isn't necessarily NUL terminated, so the number is copied out before
+   being handed to parse_number (and possibly strtod). */
+static JSON_Value * parse_number_value(const char **string, const char *end) {
+    char local_buf[PARSON_NUM_BUF_SIZE];
+    char *number_string = local_buf;
+    const char *number_ptr = NULL;
+    const char *span_end = *string;
+    size_t span_len = 0;
+    double number = 0;
+    JSON_Status status = JSONFailure;
+    while (span_end < end && *span_end != '\0'
+           && (isdigit((unsigned char)*span_end) || strchr("+-.eE", *span_end) != NULL)) {
+        span_end++;
+    }
+    span_len = (size_t)(span_end - *string);
+    if (span_len < sizeof(local_buf)) {
+        memcpy(local_buf, *string, span_len);
+        local_buf[span_len] = '\0';
+    } else {
+        number_string = parson_strndup(*string, span_len);
+        if (number_string == NULL) {
+            return NULL;
+        }
+    }
+    number_ptr = number_string;
+    status = parse_number(&number_ptr, &number);
+    *string += number_ptr - number_string;
+    if (number_string != local_buf) {
+        parson_free(number_string);
+    }
+    if (status != JSONSuccess) {
+        return NULL;
+    }
     return json_value_init_number(number);
 }
 
-static JSON_Value * parse_null_value(const char **string) {
+static JSON_Value * parse_null_value(const char **string, const char *end) {
     size_t token_size = SIZEOF_TOKEN("null");
-    if (strncmp("null", *string, token_size) == 0) {
+    if ((size_t)(end - *string) >= token_size && strncmp("null", *string, token_size) == 0) {
         *string += token_size;
         return json_value_init_null();
     }
@@ -1122,18 +1658,410 @@ static JSON_Value * parse_null_value(const char **string) {
 
 /* Serialization */
 
+/* Shortest round-trip number formatting (Grisu2, after Florian Loitsch's
+   "Printing Floating-Point Numbers Quickly and Accurately with Integers").
+   Produces the shortest digit string that parses back to the same double in the
+   vast majority of cases and a correct (if slightly longer) one otherwise. */
+typedef struct parson_diy_fp {
+    uint64_t f;
+    int      e;
+} parson_diy_fp;
+
+#define PARSON_DP_SIGNIFICAND_MASK ((uint64_t)0x000FFFFFFFFFFFFFULL)
+#define PARSON_DP_EXPONENT_MASK    ((uint64_t)0x7FF0000000000000ULL)
+#define PARSON_DP_HIDDEN_BIT       ((uint64_t)0x0010000000000000ULL)
+#define PARSON_DP_EXPONENT_BIAS    (0x3FF + 52)
+
+/* Normalized 64-bit significands and binary exponents of 10^k for k = -348, -340, ..., 340 */
+static const uint64_t parson_cached_powers_f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+
+static const short parson_cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static const uint32_t parson_pow10_u32[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static parson_diy_fp diy_fp_from_double(double d) {
+    parson_diy_fp result;
+    uint64_t bits = 0;
+    int biased_e = 0;
+    uint64_t significand = 0;
+    memcpy(&bits, &d, sizeof(bits));
+    biased_e = (int)((bits & PARSON_DP_EXPONENT_MASK) >> 52);
+    significand = bits & PARSON_DP_SIGNIFICAND_MASK;
+    if (biased_e != 0) {
+        result.f = significand + PARSON_DP_HIDDEN_BIT;
+        result.e = biased_e - PARSON_DP_EXPONENT_BIAS;
+    } else {
+        result.f = significand;
+        result.e = 1 - PARSON_DP_EXPONENT_BIAS;
+    }
+    return result;
+}
+
+static parson_diy_fp diy_fp_multiply(parson_diy_fp x, parson_diy_fp y) {
+    const uint64_t m32 = 0xFFFFFFFFu;
+    uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+    parson_diy_fp result;
+    tmp += (uint64_t)1 << 31; /* round */
+    result.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    result.e = x.e + y.e + 64;
+    return result;
+}
+
+static parson_diy_fp diy_fp_normalize(parson_diy_fp x) {
+    while (!(x.f & ((uint64_t)1 << 63))) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+static void diy_fp_normalized_boundaries(parson_diy_fp v, parson_diy_fp *minus, parson_diy_fp *plus) {
+    parson_diy_fp pl, mi;
+    pl.f = (v.f << 1) + 1;
+    pl.e = v.e - 1;
+    while (!(pl.f & (PARSON_DP_HIDDEN_BIT << 1))) {
+        pl.f <<= 1;
+        pl.e--;
+    }
+    pl.f <<= 64 - 52 - 2;
+    pl.e -= 64 - 52 - 2;
+    if (v.f == PARSON_DP_HIDDEN_BIT) {
+        mi.f = (v.f << 2) - 1;
+        mi.e = v.e - 2;
+    } else {
+        mi.f = (v.f << 1) - 1;
+        mi.e = v.e - 1;
+    }
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+    *minus = mi;
+    *plus = pl;
+}
+
+static parson_diy_fp diy_fp_cached_power(int e, int *k) {
+    parson_diy_fp result;
+    double dk = (-61 - e) * 0.30102999566398114 + 347; /* dk must be positive, so can do ceiling in positive */
+    int ik = (int)dk;
+    unsigned int index = 0;
+    if (dk - ik > 0.0) {
+        ik++;
+    }
+    index = (unsigned int)((ik >> 3) + 1);
+    *k = -(-348 + (int)(index << 3)); /* decimal exponent doesn't need a lookup table */
+    result.f = parson_cached_powers_f[index];
+    result.e = parson_cached_powers_e[index];
+    return result;
+}
+
+static void grisu_round(char *buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int count_decimal_digits_u32(uint32_t n) {
+    int digits = 1;
+    while (digits < 10 && n >= parson_pow10_u32[digits]) {
+        digits++;
+    }
+    return digits;
+}
+
+static void grisu_digit_gen(parson_diy_fp w, parson_diy_fp mp, uint64_t delta, char *buf, int *len, int *k) {
+    parson_diy_fp one;
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = 0;
+    uint64_t p2 = 0;
+    int kappa = 0;
+    uint32_t d = 0;
+    one.f = (uint64_t)1 << -mp.e;
+    one.e = mp.e;
+    p1 = (uint32_t)(mp.f >> -one.e);
+    p2 = mp.f & (one.f - 1);
+    kappa = count_decimal_digits_u32(p1);
+    *len = 0;
+    while (kappa > 0) {
+        d = p1 / parson_pow10_u32[kappa - 1];
+        p1 %= parson_pow10_u32[kappa - 1];
+        if (d || *len) {
+            buf[(*len)++] = (char)('0' + d);
+        }
+        kappa--;
+        if ((((uint64_t)p1) << -one.e) + p2 <= delta) {
+            *k += kappa;
+            grisu_round(buf, *len, delta, (((uint64_t)p1) << -one.e) + p2,
+                        ((uint64_t)parson_pow10_u32[kappa]) << -one.e, wp_w);
+            return;
+        }
+    }
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        d = (uint32_t)(p2 >> -one.e);
+        if (d || *len) {
+            buf[(*len)++] = (char)('0' + d);
+        }
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k += kappa;
+            grisu_round(buf, *len, delta, p2, one.f, -kappa < 10 ? wp_w * parson_pow10_u32[-kappa] : 0);
+            return;
+        }
+    }
+}
+
+static void grisu2(double value, char *buf, int *len, int *k) {
+    parson_diy_fp v = diy_fp_from_double(value);
+    parson_diy_fp w_m, w_p, c_mk, w, wp, wm;
+    diy_fp_normalized_boundaries(v, &w_m, &w_p);
+    c_mk = diy_fp_cached_power(w_p.e, k);
+    w = diy_fp_multiply(diy_fp_normalize(v), c_mk);
+    wp = diy_fp_multiply(w_p, c_mk);
+    wm = diy_fp_multiply(w_m, c_mk);
+    wm.f++;
+    wp.f--;
+    grisu_digit_gen(w, wp, wp.f - wm.f, buf, len, k);
+}
+
+static int write_exponent(int k, char *buf) {
+    char *start = buf;
+    if (k < 0) {
+        *buf++ = '-';
+        k = -k;
+    }
+    if (k >= 100) {
+        *buf++ = (char)('0' + k / 100);
+        k %= 100;
+        *buf++ = (char)('0' + k / 10);
+        *buf++ = (char)('0' + k % 10);
+    } else if (k >= 10) {
+        *buf++ = (char)('0' + k / 10);
+        *buf++ = (char)('0' + k % 10);
+    } else {
+        *buf++ = (char)('0' + k);
+    }
+    return (int)(buf - start);
+}
+
+/* Lays out len digits with decimal exponent k the way %g would, without trailing zeros. */
+static int prettify_number(char *buf, int len, int k) {
+    int kk = len + k; /* 10^(kk-1) <= v < 10^kk */
+    int i = 0;
+    if (k >= 0 && kk <= 21) { /* 1234e7 -> 12340000000 */
+        for (i = len; i < kk; i++) {
+            buf[i] = '0';
+        }
+        return kk;
+    } else if (kk > 0 && kk <= 21) { /* 1234e-2 -> 12.34 */
+        memmove(&buf[kk + 1], &buf[kk], (size_t)(len - kk));
+        buf[kk] = '.';
+        return len + 1;
+    } else if (kk > -6 && kk <= 0) { /* 1234e-6 -> 0.001234 */
+        int offset = 2 - kk;
+        memmove(&buf[offset], &buf[0], (size_t)len);
+        buf[0] = '0';
+        buf[1] = '.';
+        for (i = 2; i < offset; i++) {
+            buf[i] = '0';
+        }
+        return len + offset;
+    } else if (len == 1) { /* 1e30 */
+        buf[1] = 'e';
+        return 2 + write_exponent(kk - 1, &buf[2]);
+    }
+    /* 1234e30 -> 1.234e33 */
+    memmove(&buf[2], &buf[1], (size_t)(len - 1));
+    buf[1] = '.';
+    buf[len + 1] = 'e';
+    return len + 2 + write_exponent(kk - 1, &buf[len + 2]);
+}
+
+/* Default number serializer. Integers up to 2^53 are written directly, everything
+   else goes through Grisu2. Output is always NUL terminated and never longer
+   than 25 characters. */
+static int serialize_number_shortest(double num, char *buf) {
+    char *ptr = buf;
+    int len = 0, k = 0;
+    if (num < 0) {
+        *ptr++ = '-';
+        num = -num;
+    } else if (num == 0.0 && signbit(num)) {
+        *ptr++ = '-';
+    }
+    if (num == 0.0) {
+        *ptr++ = '0';
+        *ptr = '\0';
+        return (int)(ptr - buf);
+    }
+    if (num < (double)PARSON_MAX_EXACT_MANTISSA && num == (double)(uint64_t)num) {
+        char digits[20];
+        uint64_t integer = (uint64_t)num;
+        while (integer > 0) {
+            digits[len++] = (char)('0' + integer % 10);
+            integer /= 10;
+        }
+        while (len > 0) {
+            *ptr++ = digits[--len];
+        }
+        *ptr = '\0';
+        return (int)(ptr - buf);
+    }
+    grisu2(num, ptr, &len, &k);
+    len = prettify_number(ptr, len, k);
+    ptr[len] = '\0';
+    return (int)(ptr - buf) + len;
+}
+
+/* Serialization output: counts bytes when buf is NULL, otherwise writes into buf,
+   growing it as needed if it's owned by the serializer. buf is always kept NUL
+   terminated so callers can hand it out as a string directly.
+   With a write function (sink mode) buf is a fixed buffer that's flushed to it
+   whenever it fills up, and isn't NUL terminated. */
+struct json_output {
+    char               *buf;
+    size_t              len;
+    size_t              capacity;
+    parson_bool_t       growable;
+    JSON_Write_Function write;
+    void               *write_context;
+};
+
+#ifndef PARSON_SINK_BUF_SIZE
+#define PARSON_SINK_BUF_SIZE 4096
+#endif
+
+/* Open containers of the serializer, on the call stack unless nesting is deep */
+#define SERIALIZE_STACK_SIZE 32
+
+typedef struct json_serialize_frame {
+    const JSON_Value *container;
+    size_t            index; /* member being serialized */
+    size_t            count;
+    size_t            length_ix; /* offset of a length prefix to patch, CBOR only */
+} JSON_Serialize_Frame;
+
+struct json_serialize_stack {
+    JSON_Serialize_Frame *frames; /* local or allocated once local is full */
+    size_t                depth;
+    size_t                capacity;
+    JSON_Serialize_Frame  local[SERIALIZE_STACK_SIZE];
+};
+
+static JSON_Status output_reserve(JSON_Output *output, size_t n) {
+    char *new_buf = NULL;
+    size_t new_capacity = 0;
+    if (output->len + n + 1 <= output->capacity) {
+        return JSONSuccess;
+    }
+    if (!output->growable) {
+        return JSONFailure;
+    }
+    new_capacity = MAX(output->capacity * 2, STARTING_CAPACITY * 16);
+    while (new_capacity < output->len + n + 1) {
+        new_capacity *= 2;
+    }
+    new_buf = (char*)parson_malloc(new_capacity);
+    if (new_buf == NULL) {
+        return JSONFailure;
+    }
+    if (output->len > 0) {
+        memcpy(new_buf, output->buf, output->len);
+    }
+    parson_free(output->buf);
+    output->buf = new_buf;
+    output->capacity = new_capacity;
+    return JSONSuccess;
+}
+
+static JSON_Status output_flush(JSON_Output *output) {
+    if (output->len > 0 && output->write(output->write_context, output->buf, output->len) != JSONSuccess) {
+        return JSONFailure;
+    }
+    output->len = 0;
+    return JSONSuccess;
+}
+
+static JSON_Status output_append(JSON_Output *output, const char *data, size_t n) {
+    if (output->write != NULL) {
+        if (output->len + n > output->capacity) {
+            if (output_flush(output) != JSONSuccess) {
+                return JSONFailure;
+            }
+            if (n > output->capacity) { /* long strings bypass the buffer */
+                return output->write(output->write_context, data, n);
+            }
+        }
+        memcpy(output->buf + output->len, data, n);
+        output->len += n;
+        return JSONSuccess;
+    }
+    if (output->buf == NULL && !output->growable) {
+        output->len += n;
+        return JSONSuccess;
+    }
+    if (output_reserve(output, n) != JSONSuccess) {
+        return JSONFailure;
+    }
+    memcpy(output->buf + output->len, data, n);
+    output->len += n;
+    output->buf[output->len] = '\0';
+    return JSONSuccess;
+}
+
 /*  APPEND_STRING() is only called on string literals.
-    It's a bit hacky because it makes plenty of assumptions about the external state
-    and should eventually be tidied up into a function (same goes for APPEND_INDENT)
+    Both macros return JSONFailure from the calling function if output can't be written.
  */
 #define APPEND_STRING(str) do {\
-                                written = SIZEOF_TOKEN((str));\
-                                if (buf != NULL) {\
-                                    memcpy(buf, (str), written);\
-                                    buf[written] = '\0';\
-                                    buf += written;\
+                                if (output_append(output, (str), SIZEOF_TOKEN((str))) != JSONSuccess) {\
+                                    return JSONFailure;\
                                 }\
-                                written_total += written;\
                             } while (0)
 
 #define APPEND_INDENT(level) do {\
@@ -1143,265 +2071,2565 @@ static JSON_Value * parse_null_value(const char **string) {
                                 }\
                             } while (0)
 
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, parson_bool_t is_pretty, char *num_buf)
-{
-    const char *key = NULL, *string = NULL;
-    JSON_Value *temp_value = NULL;
-    JSON_Array *array = NULL;
-    JSON_Object *object = NULL;
-    size_t i = 0, count = 0;
+static JSON_Status serialize_stack_push(JSON_Serialize_Stack *stack, const JSON_Value *container, size_t count) {
+    JSON_Serialize_Frame *new_frames = NULL;
+    size_t new_capacity = 0;
+    if (stack->depth >= stack->capacity) {
+        new_capacity = stack->capacity * 2;
+        new_frames = (JSON_Serialize_Frame*)parson_malloc(new_capacity * sizeof(JSON_Serialize_Frame));
+        if (new_frames == NULL) {
+            return JSONFailure;
+        }
+        memcpy(new_frames, stack->frames, stack->depth * sizeof(JSON_Serialize_Frame));
+        if (stack->frames != stack->local) {
+            parson_free(stack->frames);
+        }
+        stack->frames = new_frames;
+        stack->capacity = new_capacity;
+    }
+    stack->frames[stack->depth].container = container;
+    stack->frames[stack->depth].index = 0;
+    stack->frames[stack->depth].count = count;
+    stack->depth++;
+    return JSONSuccess;
+}
+
+static JSON_Status json_serialize_scalar(const JSON_Value *value, JSON_Output *output, char *num_buf) {
+    const char *string = NULL;
     double num = 0.0;
-    int written = -1, written_total = 0;
-    size_t len = 0;
+    int written = -1;
 
     switch (json_value_get_type(value)) {
-        case JSONArray:
-            array = json_value_get_array(value);
-            count = json_array_get_count(array);
-            APPEND_STRING("[");
-            if (count > 0 && is_pretty) {
-                APPEND_STRING("\n");
+        case JSONString:
+            string = json_value_get_string(value);
+            if (string == NULL) {
+                return JSONFailure;
             }
-            for (i = 0; i < count; i++) {
-                if (is_pretty) {
-                    APPEND_INDENT(level+1);
-                }
-                temp_value = json_array_get_value(array, i);
-                written = json_serialize_to_buffer_r(temp_value, buf, level+1, is_pretty, num_buf);
-                if (written < 0) {
-                    return -1;
-                }
-                if (buf != NULL) {
-                    buf += written;
-                }
-                written_total += written;
-                if (i < (count - 1)) {
-                    APPEND_STRING(",");
-                }
-                if (is_pretty) {
-                    APPEND_STRING("\n");
-                }
+            return json_serialize_string(string, json_value_get_string_len(value), output);
+        case JSONBoolean:
+            if (json_value_get_boolean(value)) {
+                APPEND_STRING("true");
+            } else {
+                APPEND_STRING("false");
+            }
+            return JSONSuccess;
+        case JSONNumber:
+            num = json_value_get_number(value);
+            if (parson_number_serialization_function) {
+                written = parson_number_serialization_function(num, num_buf);
+            } else if (parson_float_format) {
+                written = parson_sprintf(num_buf, parson_float_format, num);
+            } else {
+#ifdef PARSON_DEFAULT_FLOAT_FORMAT
+                written = parson_sprintf(num_buf, PARSON_DEFAULT_FLOAT_FORMAT, num);
+#else
+                written = serialize_number_shortest(num, num_buf);
+#endif
             }
-            if (count > 0 && is_pretty) {
-                APPEND_INDENT(level);
+            if (written < 0) {
+                return JSONFailure;
             }
-            APPEND_STRING("]");
-            return written_total;
-        case JSONObject:
-            object = json_value_get_object(value);
-            count  = json_object_get_count(object);
-            APPEND_STRING("{");
-            if (count > 0 && is_pretty) {
-                APPEND_STRING("\n");
+            return output_append(output, num_buf, (size_t)written);
+        case JSONNull:
+            APPEND_STRING("null");
+            return JSONSuccess;
+        case JSONError:
+            return JSONFailure;
+        default:
+            return JSONFailure;
+    }
+}
+
+/* Serializes value without recursion, open objects and arrays are kept in stack
+   together with the index of the member being written. */
+static JSON_Status json_serialize_value(const JSON_Value *value, JSON_Output *output, parson_bool_t is_pretty,
+                                        char *num_buf, JSON_Serialize_Stack *stack) {
+    JSON_Serialize_Frame *frame = NULL;
+    const JSON_Object_Item *item = NULL;
+    size_t count = 0;
+    parson_bool_t is_object = PARSON_FALSE;
+
+    while (PARSON_TRUE) {
+        if (stack->depth > 0) {
+            frame = &stack->frames[stack->depth - 1];
+            if (is_pretty) {
+                APPEND_INDENT((int)stack->depth);
             }
-            for (i = 0; i < count; i++) {
-                key = json_object_get_name(object, i);
-                if (key == NULL) {
-                    return -1;
-                }
-                if (is_pretty) {
-                    APPEND_INDENT(level+1);
+            if (json_value_get_type(frame->container) == JSONObject) {
+                item = &json_value_get_object(frame->container)->items[frame->index];
+                if (item->name == NULL) {
+                    return JSONFailure;
                 }
                 /* We do not support key names with embedded \0 chars */
-                written = json_serialize_string(key, strlen(key), buf);
-                if (written < 0) {
-                    return -1;
-                }
-                if (buf != NULL) {
-                    buf += written;
+                if (json_serialize_string(item->name, item->name_len, output) != JSONSuccess) {
+                    return JSONFailure;
                 }
-                written_total += written;
                 APPEND_STRING(":");
                 if (is_pretty) {
                     APPEND_STRING(" ");
                 }
-                temp_value = json_object_get_value_at(object, i);
-                written = json_serialize_to_buffer_r(temp_value, buf, level+1, is_pretty, num_buf);
-                if (written < 0) {
-                    return -1;
-                }
-                if (buf != NULL) {
-                    buf += written;
-                }
-                written_total += written;
-                if (i < (count - 1)) {
-                    APPEND_STRING(",");
+                value = item->value;
+            } else {
+                value = json_array_get_value(json_value_get_array(frame->container), frame->index);
+            }
+        }
+        if (json_value_get_type(value) == JSONObject || json_value_get_type(value) == JSONArray) {
+            is_object = json_value_get_type(value) == JSONObject;
+            count = is_object ? json_object_get_count(json_value_get_object(value))
+                              : json_array_get_count(json_value_get_array(value));
+            if (count > 0) {
+                if (is_object) {
+                    APPEND_STRING("{");
+                } else {
+                    APPEND_STRING("[");
                 }
                 if (is_pretty) {
                     APPEND_STRING("\n");
                 }
+                if (serialize_stack_push(stack, value, count) != JSONSuccess) {
+                    return JSONFailure;
+                }
+                continue;
             }
-            if (count > 0 && is_pretty) {
-                APPEND_INDENT(level);
+            if (is_object) {
+                APPEND_STRING("{}");
+            } else {
+                APPEND_STRING("[]");
             }
-            APPEND_STRING("}");
-            return written_total;
-        case JSONString:
-            string = json_value_get_string(value);
-            if (string == NULL) {
-                return -1;
+        } else if (json_serialize_scalar(value, output, num_buf) != JSONSuccess) {
+            return JSONFailure;
+        }
+        /* value is complete, move to its next sibling or close finished containers */
+        while (stack->depth > 0) {
+            frame = &stack->frames[stack->depth - 1];
+            frame->index++;
+            if (frame->index < frame->count) {
+                APPEND_STRING(",");
+                if (is_pretty) {
+                    APPEND_STRING("\n");
+                }
+                break;
             }
-            len = json_value_get_string_len(value);
-            written = json_serialize_string(string, len, buf);
-            if (written < 0) {
-                return -1;
+            if (is_pretty) {
+                APPEND_STRING("\n");
+                APPEND_INDENT((int)stack->depth - 1);
             }
-            if (buf != NULL) {
-                buf += written;
+            if (json_value_get_type(frame->container) == JSONObject) {
+                APPEND_STRING("}");
+            } else {
+                APPEND_STRING("]");
             }
-            written_total += written;
-            return written_total;
-        case JSONBoolean:
-            if (json_value_get_boolean(value)) {
-                APPEND_STRING("true");
+            stack->depth--;
+        }
+        if (stack->depth == 0) {
+            return JSONSuccess;
+        }
+    }
+}
+
+/* Copies runs of characters that don't need escaping in one go */
+static JSON_Status json_serialize_string(const char *string, size_t len, JSON_Output *output) {
+    size_t i = 0, run_start = 0;
+    unsigned char c = '\0';
+    parson_bool_t escape_slashes = parson_escape_slashes ? PARSON_TRUE : PARSON_FALSE;
+    APPEND_STRING("\"");
+    while (i < len) {
+        run_start = i;
+        i += scan_plain_chars(string + i, len - i, escape_slashes);
+        if (i < len) {
+            c = (unsigned char)string[i];
+        }
+        if (i > run_start && output_append(output, string + run_start, i - run_start) != JSONSuccess) {
+            return JSONFailure;
+        }
+        if (i == len) {
+            break;
+        }
+        switch (c) {
+            case '\"': APPEND_STRING("\\\""); break;
+            case '\\': APPEND_STRING("\\\\"); break;
+            case '\b': APPEND_STRING("\\b"); break;
+            case '\f': APPEND_STRING("\\f"); break;
+            case '\n': APPEND_STRING("\\n"); break;
+            case '\r': APPEND_STRING("\\r"); break;
+            case '\t': APPEND_STRING("\\t"); break;
+            case '/':  APPEND_STRING("\\/"); break; /* to make json embeddable in xml\/html */
+            default: {
+                /* remaining control characters, 0x00-0x1f */
+                char escaped[7] = "\\u0000";
+                escaped[4] = "0123456789abcdef"[c >> 4];
+                escaped[5] = "0123456789abcdef"[c & 0xF];
+                if (output_append(output, escaped, 6) != JSONSuccess) {
+                    return JSONFailure;
+                }
+                break;
+            }
+        }
+        i++;
+    }
+    APPEND_STRING("\"");
+    return JSONSuccess;
+}
+
+#undef APPEND_STRING
+#undef APPEND_INDENT
+
+/* Parser API */
+JSON_Value * json_parse_file(const char *filename) {
+    JSON_File_Contents contents;
+    JSON_Value *output_value = NULL;
+    if (file_contents_load(filename, PARSON_FALSE, &contents) != JSONSuccess) {
+        return NULL;
+    }
+    output_value = json_parse_string_with_len(contents.data, contents.len);
+    file_contents_release(&contents);
+    return output_value;
+}
+
+JSON_Value * json_parse_file_with_comments(const char *filename) {
+    JSON_File_Contents contents;
+    JSON_Value *output_value = NULL;
+    if (file_contents_load(filename, PARSON_TRUE, &contents) != JSONSuccess) {
+        return NULL;
+    }
+    /* comments are blanked out in the private copy of the file */
+    remove_comments(contents.data, contents.len, "/*", "*/");
+    remove_comments(contents.data, contents.len, "//", "\n");
+    output_value = json_parse_string_with_len(contents.data, contents.len);
+    file_contents_release(&contents);
+    return output_value;
+}
+
+JSON_Value * json_parse_string(const char *string) {
+    if (string == NULL) {
+        return NULL;
+    }
+    return json_parse_string_with_len(string, strlen(string));
+}
+
+JSON_Value * json_parse_string_with_len(const char *string, size_t len) {
+    const char *end = NULL, *nul = NULL;
+    JSON_Structural_Index index;
+    JSON_Value *value = NULL;
+    if (string == NULL) {
+        return NULL;
+    }
+    end = string + len;
+    if (len >= 3 && string[0] == '\xEF' && string[1] == '\xBB' && string[2] == '\xBF') {
+        string = string + 3; /* Support for UTF-8 BOM */
+    }
+    if ((size_t)(end - string) >= PARSON_INDEX_MIN_LENGTH) {
+        nul = (const char*)memchr(string, '\0', (size_t)(end - string));
+        end = nul != NULL ? nul : end; /* input ends at the first \0 */
+        if (structural_index_build(&index, string, (size_t)(end - string)) == JSONSuccess) {
+            value = parse_value((const char**)&string, end, &index);
+            parson_free(index.words);
+            return value;
+        }
+    }
+    return parse_value((const char**)&string, end, NULL);
+}
+
+JSON_Value * json_parse_string_with_comments(const char *string) {
+    JSON_Value *result = NULL;
+    char *string_mutable_copy = NULL;
+    size_t len = 0;
+    if (string == NULL) {
+        return NULL;
+    }
+    len = strlen(string);
+    string_mutable_copy = parson_strndup(string, len);
+    if (string_mutable_copy == NULL) {
+        return NULL;
+    }
+    remove_comments(string_mutable_copy, len, "/*", "*/");
+    remove_comments(string_mutable_copy, len, "//", "\n");
+    result = json_parse_string_with_len(string_mutable_copy, len);
+    parson_free(string_mutable_copy);
+    return result;
+}
+
+/* Streaming parser */
+enum json_stream_state {
+    STREAM_STATE_VALUE,        /* value expected */
+    STREAM_STATE_ARRAY_FIRST,  /* value or ']' expected */
+    STREAM_STATE_OBJECT_FIRST, /* key or '}' expected */
+    STREAM_STATE_COLON,
+    STREAM_STATE_AFTER_VALUE,  /* ',' or closing bracket expected */
+    STREAM_STATE_STRING,
+    STREAM_STATE_STRING_ESCAPE,
+    STREAM_STATE_NUMBER,
+    STREAM_STATE_LITERAL,
+    STREAM_STATE_DONE,
+    STREAM_STATE_ERROR
+};
+
+struct json_stream_parser_t {
+    JSON_Stream_Callbacks callbacks;
+    void         *context;
+    int           state;
+    parson_bool_t string_is_key;
+    parson_bool_t string_has_escapes;
+    char         *containers; /* '{' or '[' for every open nesting level */
+    size_t        depth;
+    size_t        containers_capacity;
+    char         *token;      /* current string, number or literal, may span chunks */
+    size_t        token_len;
+    size_t        token_capacity;
+    size_t        bom_matched;
+    void         *filter;     /* state owned by json_path_stream_parser_init */
+};
+
+#define STREAM_CALLBACK(parser, name, ...) \
+    ((parser)->callbacks.name == NULL ? JSONSuccess : (parser)->callbacks.name((parser)->context, __VA_ARGS__))
+#define STREAM_CALLBACK_NOARGS(parser, name) \
+    ((parser)->callbacks.name == NULL ? JSONSuccess : (parser)->callbacks.name((parser)->context))
+
+static JSON_Status stream_parser_token_append(JSON_Stream_Parser *parser, const char *data, size_t len) {
+    char *new_token = NULL;
+    size_t new_capacity = 0;
+    if (parser->token_len + len + 1 > parser->token_capacity) {
+        new_capacity = MAX(parser->token_capacity * 2, STARTING_CAPACITY);
+        while (new_capacity < parser->token_len + len + 1) {
+            new_capacity *= 2;
+        }
+        new_token = (char*)parson_malloc(new_capacity);
+        if (new_token == NULL) {
+            return JSONFailure;
+        }
+        if (parser->token_len > 0) {
+            memcpy(new_token, parser->token, parser->token_len);
+        }
+        parson_free(parser->token);
+        parser->token = new_token;
+        parser->token_capacity = new_capacity;
+    }
+    memcpy(parser->token + parser->token_len, data, len);
+    parser->token_len += len;
+    parser->token[parser->token_len] = '\0';
+    return JSONSuccess;
+}
+
+static JSON_Status stream_parser_push(JSON_Stream_Parser *parser, char container) {
+    char *new_containers = NULL;
+    size_t new_capacity = 0;
+    if (parser->depth >= MAX_NESTING) {
+        return JSONFailure;
+    }
+    if (parser->depth == parser->containers_capacity) {
+        new_capacity = MAX(parser->containers_capacity * 2, STARTING_CAPACITY);
+        new_containers = (char*)parson_malloc(new_capacity);
+        if (new_containers == NULL) {
+            return JSONFailure;
+        }
+        if (parser->depth > 0) {
+            memcpy(new_containers, parser->containers, parser->depth);
+        }
+        parson_free(parser->containers);
+        parser->containers = new_containers;
+        parser->containers_capacity = new_capacity;
+    }
+    parser->containers[parser->depth++] = container;
+    return JSONSuccess;
+}
+
+static void stream_parser_value_done(JSON_Stream_Parser *parser) {
+    parser->state = parser->depth == 0 ? STREAM_STATE_DONE : STREAM_STATE_AFTER_VALUE;
+}
+
+static JSON_Status stream_parser_finish_string(JSON_Stream_Parser *parser) {
+    JSON_Status status = JSONFailure;
+    char *processed = NULL;
+    size_t processed_len = 0;
+    const char *string = parser->token;
+    size_t len = parser->token_len;
+    if (parser->string_has_escapes) {
+        processed = process_string(parser->token, parser->token_len, &processed_len);
+        if (processed == NULL) {
+            return JSONFailure;
+        }
+        string = processed;
+        len = processed_len;
+    }
+    if (parser->string_is_key) {
+        status = STREAM_CALLBACK(parser, key, string, len);
+        parser->state = STREAM_STATE_COLON;
+    } else {
+        status = STREAM_CALLBACK(parser, string, string, len);
+        stream_parser_value_done(parser);
+    }
+    parson_free(processed);
+    parser->token_len = 0;
+    return status;
+}
+
+static JSON_Status stream_parser_finish_scalar(JSON_Stream_Parser *parser) {
+    JSON_Status status = JSONFailure;
+    const char *ptr = parser->token;
+    double number = 0;
+    if (parser->state == STREAM_STATE_NUMBER) {
+        if (parse_number(&ptr, &number) != JSONSuccess
+            || ptr != parser->token + parser->token_len
+            || IS_NUMBER_INVALID(number)) {
+            return JSONFailure;
+        }
+        status = STREAM_CALLBACK(parser, number, number);
+    } else if (strcmp(parser->token, "true") == 0) {
+        status = STREAM_CALLBACK(parser, boolean, 1);
+    } else if (strcmp(parser->token, "false") == 0) {
+        status = STREAM_CALLBACK(parser, boolean, 0);
+    } else if (strcmp(parser->token, "null") == 0) {
+        status = STREAM_CALLBACK_NOARGS(parser, null);
+    } else {
+        return JSONFailure;
+    }
+    parser->token_len = 0;
+    stream_parser_value_done(parser);
+    return status;
+}
+
+/* Handles a single byte outside of strings, numbers and literals */
+static JSON_Status stream_parser_structural(JSON_Stream_Parser *parser, char c) {
+    char container = parser->depth > 0 ? parser->containers[parser->depth - 1] : '\0';
+    if (isspace((unsigned char)c)) {
+        return JSONSuccess;
+    }
+    switch (parser->state) {
+        case STREAM_STATE_ARRAY_FIRST:
+            if (c == ']') {
+                parser->depth--;
+                stream_parser_value_done(parser);
+                return STREAM_CALLBACK_NOARGS(parser, end_array);
+            }
+            /* fall through */
+        case STREAM_STATE_VALUE:
+            switch (c) {
+                case '{':
+                    if (stream_parser_push(parser, '{') != JSONSuccess) {
+                        return JSONFailure;
+                    }
+                    parser->state = STREAM_STATE_OBJECT_FIRST;
+                    return STREAM_CALLBACK_NOARGS(parser, begin_object);
+                case '[':
+                    if (stream_parser_push(parser, '[') != JSONSuccess) {
+                        return JSONFailure;
+                    }
+                    parser->state = STREAM_STATE_ARRAY_FIRST;
+                    return STREAM_CALLBACK_NOARGS(parser, begin_array);
+                case '\"':
+                    parser->state = STREAM_STATE_STRING;
+                    parser->string_is_key = PARSON_FALSE;
+                    parser->string_has_escapes = PARSON_FALSE;
+                    return stream_parser_token_append(parser, "", 0);
+                case '-':
+                case '0': case '1': case '2': case '3': case '4':
+                case '5': case '6': case '7': case '8': case '9':
+                    parser->state = STREAM_STATE_NUMBER;
+                    return stream_parser_token_append(parser, &c, 1);
+                case 't': case 'f': case 'n':
+                    parser->state = STREAM_STATE_LITERAL;
+                    return stream_parser_token_append(parser, &c, 1);
+                default:
+                    return JSONFailure;
+            }
+        case STREAM_STATE_OBJECT_FIRST:
+            if (c == '}') {
+                parser->depth--;
+                stream_parser_value_done(parser);
+                return STREAM_CALLBACK_NOARGS(parser, end_object);
+            }
+            if (c != '\"') {
+                return JSONFailure;
+            }
+            parser->state = STREAM_STATE_STRING;
+            parser->string_is_key = PARSON_TRUE;
+            parser->string_has_escapes = PARSON_FALSE;
+            return stream_parser_token_append(parser, "", 0);
+        case STREAM_STATE_COLON:
+            if (c != ':') {
+                return JSONFailure;
+            }
+            parser->state = STREAM_STATE_VALUE;
+            return JSONSuccess;
+        case STREAM_STATE_AFTER_VALUE:
+            if (c == ',') {
+                /* trailing commas are accepted, same as in parse_object_value/parse_array_value */
+                parser->state = container == '{' ? STREAM_STATE_OBJECT_FIRST : STREAM_STATE_ARRAY_FIRST;
+                return JSONSuccess;
+            } else if (c == '}' && container == '{') {
+                parser->depth--;
+                stream_parser_value_done(parser);
+                return STREAM_CALLBACK_NOARGS(parser, end_object);
+            } else if (c == ']' && container == '[') {
+                parser->depth--;
+                stream_parser_value_done(parser);
+                return STREAM_CALLBACK_NOARGS(parser, end_array);
+            }
+            return JSONFailure;
+        default:
+            return JSONFailure;
+    }
+}
+
+JSON_Stream_Parser * json_stream_parser_init(const JSON_Stream_Callbacks *callbacks, void *context) {
+    JSON_Stream_Parser *parser = (JSON_Stream_Parser*)parson_malloc(sizeof(JSON_Stream_Parser));
+    if (parser == NULL) {
+        return NULL;
+    }
+    memset(parser, 0, sizeof(JSON_Stream_Parser));
+    if (callbacks != NULL) {
+        parser->callbacks = *callbacks;
+    }
+    parser->context = context;
+    parser->state = STREAM_STATE_VALUE;
+    return parser;
+}
+
+JSON_Status json_stream_parser_feed(JSON_Stream_Parser *parser, const char *chunk, size_t len) {
+    static const char bom[] = "\xEF\xBB\xBF";
+    size_t i = 0, run_start = 0;
+    char c = '\0';
+    if (parser == NULL || parser->state == STREAM_STATE_ERROR || (chunk == NULL && len > 0)) {
+        return JSONFailure;
+    }
+    /* Support for UTF-8 BOM, which can itself be split between chunks */
+    while (parser->bom_matched < SIZEOF_TOKEN(bom) && i < len) {
+        if (chunk[i] != bom[parser->bom_matched]) {
+            if (parser->bom_matched > 0) {
+                parser->state = STREAM_STATE_ERROR;
+                return JSONFailure;
+            }
+            parser->bom_matched = SIZEOF_TOKEN(bom);
+            break;
+        }
+        parser->bom_matched++;
+        i++;
+    }
+    while (i < len) {
+        c = chunk[i];
+        switch (parser->state) {
+            case STREAM_STATE_DONE:
+                return JSONSuccess;
+            case STREAM_STATE_STRING:
+                /* copy runs of plain characters in bulk */
+                run_start = i;
+                while (i < len && chunk[i] != '\"' && chunk[i] != '\\' && (unsigned char)chunk[i] >= 0x20) {
+                    i++;
+                }
+                if (stream_parser_token_append(parser, chunk + run_start, i - run_start) != JSONSuccess) {
+                    goto error;
+                }
+                if (i == len) {
+                    return JSONSuccess;
+                }
+                c = chunk[i];
+                if (c == '\"') {
+                    if (stream_parser_finish_string(parser) != JSONSuccess) {
+                        goto error;
+                    }
+                } else if (c == '\\') {
+                    parser->string_has_escapes = PARSON_TRUE;
+                    parser->state = STREAM_STATE_STRING_ESCAPE;
+                    if (stream_parser_token_append(parser, &c, 1) != JSONSuccess) {
+                        goto error;
+                    }
+                } else {
+                    goto error; /* control characters are invalid in json strings */
+                }
+                i++;
+                break;
+            case STREAM_STATE_STRING_ESCAPE:
+                /* validated by process_string once the string is complete */
+                if (stream_parser_token_append(parser, &c, 1) != JSONSuccess) {
+                    goto error;
+                }
+                parser->state = STREAM_STATE_STRING;
+                i++;
+                break;
+            case STREAM_STATE_NUMBER:
+            case STREAM_STATE_LITERAL:
+                if ((parser->state == STREAM_STATE_NUMBER && (isdigit((unsigned char)c) || strchr("+-.eE", c) != NULL))
+                    || (parser->state == STREAM_STATE_LITERAL && c >= 'a' && c <= 'z')) {
+                    if (stream_parser_token_append(parser, &c, 1) != JSONSuccess) {
+                        goto error;
+                    }
+                    i++;
+                    break;
+                }
+                if (stream_parser_finish_scalar(parser) != JSONSuccess) {
+                    goto error;
+                }
+                break; /* current byte is handled in the new state */
+            default:
+                if (stream_parser_structural(parser, c) != JSONSuccess) {
+                    goto error;
+                }
+                i++;
+                break;
+        }
+    }
+    return JSONSuccess;
+error:
+    parser->state = STREAM_STATE_ERROR;
+    return JSONFailure;
+}
+
+JSON_Status json_stream_parser_finish(JSON_Stream_Parser *parser) {
+    if (parser == NULL) {
+        return JSONFailure;
+    }
+    if ((parser->state == STREAM_STATE_NUMBER || parser->state == STREAM_STATE_LITERAL)
+        && parser->depth == 0) {
+        if (stream_parser_finish_scalar(parser) != JSONSuccess) {
+            parser->state = STREAM_STATE_ERROR;
+            return JSONFailure;
+        }
+    }
+    return parser->state == STREAM_STATE_DONE ? JSONSuccess : JSONFailure;
+}
+
+int json_stream_parser_is_done(const JSON_Stream_Parser *parser) {
+    return parser != NULL && parser->state == STREAM_STATE_DONE;
+}
+
+void json_stream_parser_free(JSON_Stream_Parser *parser) {
+    if (parser == NULL) {
+        return;
+    }
+    parson_free(parser->containers);
+    parson_free(parser->token);
+    parson_free(parser->filter);
+    parson_free(parser);
+}
+
+#undef STREAM_CALLBACK
+#undef STREAM_CALLBACK_NOARGS
+
+/* Incremental parser, builds values from streaming parser events */
+struct json_incremental_parser_t {
+    JSON_Stream_Parser *stream;
+    JSON_Value         *root;
+    JSON_Value         *current;     /* innermost open object or array */
+    char               *pending_key;
+};
+
+static JSON_Status incremental_add_value(JSON_Incremental_Parser *parser, JSON_Value *value) {
+    JSON_Status status = JSONFailure;
+    if (value == NULL) {
+        return JSONFailure;
+    }
+    if (parser->current == NULL) {
+        if (parser->root != NULL) {
+            json_value_free(value);
+            return JSONFailure;
+        }
+        parser->root = value;
+        return JSONSuccess;
+    }
+    if (json_value_get_type(parser->current) == JSONObject) {
+        status = json_object_add(json_value_get_object(parser->current), parser->pending_key, value);
+        if (status != JSONSuccess) {
+            parson_free(parser->pending_key);
+        }
+        parser->pending_key = NULL;
+    } else {
+        status = json_array_add(json_value_get_array(parser->current), value);
+    }
+    if (status != JSONSuccess) {
+        json_value_free(value);
+    }
+    return status;
+}
+
+static JSON_Status incremental_open(JSON_Incremental_Parser *parser, JSON_Value *container) {
+    if (incremental_add_value(parser, container) != JSONSuccess) {
+        return JSONFailure;
+    }
+    parser->current = container;
+    return JSONSuccess;
+}
+
+static JSON_Status incremental_begin_object(void *context) {
+    return incremental_open((JSON_Incremental_Parser*)context, json_value_init_object());
+}
+
+static JSON_Status incremental_begin_array(void *context) {
+    return incremental_open((JSON_Incremental_Parser*)context, json_value_init_array());
+}
+
+static JSON_Status incremental_end_object(void *context) {
+    JSON_Incremental_Parser *parser = (JSON_Incremental_Parser*)context;
+    parser->current = json_value_get_parent(parser->current);
+    return JSONSuccess;
+}
+
+static JSON_Status incremental_end_array(void *context) {
+    JSON_Incremental_Parser *parser = (JSON_Incremental_Parser*)context;
+    JSON_Array *array = json_value_get_array(parser->current);
+    if (json_array_get_count(array) > 0 /* Trim array after parsing is over */
+        && json_array_resize(array, json_array_get_count(array)) != JSONSuccess) {
+        return JSONFailure;
+    }
+    parser->current = json_value_get_parent(parser->current);
+    return JSONSuccess;
+}
+
+static JSON_Status incremental_key(void *context, const char *name, size_t len) {
+    JSON_Incremental_Parser *parser = (JSON_Incremental_Parser*)context;
+    /* We do not support key names with embedded \0 chars */
+    if (strlen(name) != len) {
+        return JSONFailure;
+    }
+    parser->pending_key = parson_strndup(name, len);
+    return parser->pending_key != NULL ? JSONSuccess : JSONFailure;
+}
+
+static JSON_Status incremental_string(void *context, const char *string, size_t len) {
+    JSON_Value *value = NULL;
+    char *copy = parson_strndup(string, len);
+    if (copy == NULL) {
+        return JSONFailure;
+    }
+    value = json_value_init_string_no_copy(copy, len);
+    if (value == NULL) {
+        parson_free(copy);
+        return JSONFailure;
+    }
+    return incremental_add_value((JSON_Incremental_Parser*)context, value);
+}
+
+static JSON_Status incremental_number(void *context, double number) {
+    return incremental_add_value((JSON_Incremental_Parser*)context, json_value_init_number(number));
+}
+
+static JSON_Status incremental_boolean(void *context, int boolean) {
+    return incremental_add_value((JSON_Incremental_Parser*)context, json_value_init_boolean(boolean));
+}
+
+static JSON_Status incremental_null(void *context) {
+    return incremental_add_value((JSON_Incremental_Parser*)context, json_value_init_null());
+}
+
+static const JSON_Stream_Callbacks incremental_callbacks = {
+    incremental_begin_object,
+    incremental_end_object,
+    incremental_begin_array,
+    incremental_end_array,
+    incremental_key,
+    incremental_string,
+    incremental_number,
+    incremental_boolean,
+    incremental_null
+};
+
+JSON_Incremental_Parser * json_incremental_parser_init(void) {
+    JSON_Incremental_Parser *parser = (JSON_Incremental_Parser*)parson_malloc(sizeof(JSON_Incremental_Parser));
+    if (parser == NULL) {
+        return NULL;
+    }
+    parser->root = NULL;
+    parser->current = NULL;
+    parser->pending_key = NULL;
+    parser->stream = json_stream_parser_init(&incremental_callbacks, parser);
+    if (parser->stream == NULL) {
+        parson_free(parser);
+        return NULL;
+    }
+    return parser;
+}
+
+JSON_Parse_Progress json_incremental_parser_feed(JSON_Incremental_Parser *parser, const char *chunk, size_t len) {
+    if (parser == NULL) {
+        return JSONParseError;
+    }
+    if (json_stream_parser_feed(parser->stream, chunk, len) != JSONSuccess) {
+        return JSONParseError;
+    }
+    return json_stream_parser_is_done(parser->stream) ? JSONParseComplete : JSONParseNeedMore;
+}
+
+JSON_Parse_Progress json_incremental_parser_finish(JSON_Incremental_Parser *parser) {
+    if (parser == NULL) {
+        return JSONParseError;
+    }
+    return json_stream_parser_finish(parser->stream) == JSONSuccess ? JSONParseComplete : JSONParseError;
+}
+
+JSON_Value * json_incremental_parser_take_value(JSON_Incremental_Parser *parser) {
+    JSON_Value *value = NULL;
+    if (parser == NULL || !json_stream_parser_is_done(parser->stream)) {
+        return NULL;
+    }
+    value = parser->root;
+    parser->root = NULL;
+    return value;
+}
+
+void json_incremental_parser_free(JSON_Incremental_Parser *parser) {
+    if (parser == NULL) {
+        return;
+    }
+    json_stream_parser_free(parser->stream);
+    json_value_free(parser->root);
+    parson_free(parser->pending_key);
+    parson_free(parser);
+}
+
+/* Compiled paths */
+enum json_path_segment_type {
+    PATH_SEGMENT_KEY,
+    PATH_SEGMENT_INDEX,
+    PATH_SEGMENT_WILDCARD
+};
+
+enum json_path_match {
+    PATH_NO_MATCH,
+    PATH_PARTIAL_MATCH, /* value is on the path, but the path continues below it */
+    PATH_FULL_MATCH
+};
+
+typedef struct json_path_segment {
+    int      type;
+    JSON_Key key;   /* PATH_SEGMENT_KEY, name is owned by the path */
+    size_t   index; /* PATH_SEGMENT_INDEX */
+} JSON_Path_Segment;
+
+struct json_path_t {
+    JSON_Path_Segment *segments;
+    size_t             count;
+};
+
+/* State of json_path_stream_parser_init, frames are only kept for containers on the path */
+typedef struct json_path_frame {
+    parson_bool_t is_object;
+    parson_bool_t key_matched;
+    size_t        next_index;
+} JSON_Path_Frame;
+
+typedef struct json_path_filter {
+    const JSON_Path       *path;
+    JSON_Stream_Callbacks  callbacks;
+    void                  *context;
+    JSON_Path_Frame       *frames;        /* path->count + 1 entries, allocated with the filter */
+    size_t                 depth;
+    size_t                 skip_depth;    /* nesting inside a container that can't match */
+    size_t                 forward_depth; /* nesting inside a matching container */
+} JSON_Path_Filter;
+
+static const char * path_parse_segment(const char *string, JSON_Path_Segment *segment) {
+    const char *start = NULL;
+    char quote = '\0';
+    if (*string == '*') {
+        segment->type = PATH_SEGMENT_WILDCARD;
+        return string + 1;
+    }
+    if (*string != '[') {
+        start = string;
+        while (*string != '\0' && *string != '.' && *string != '[') {
+            string++;
+        }
+        if (string == start) {
+            return NULL;
+        }
+        segment->key.name = parson_strndup(start, string - start);
+        segment->type = PATH_SEGMENT_KEY;
+        segment->key = json_key_make(segment->key.name);
+        return segment->key.name != NULL ? string : NULL;
+    }
+    string++;
+    if (*string == '*') {
+        segment->type = PATH_SEGMENT_WILDCARD;
+        string++;
+    } else if (isdigit((unsigned char)*string)) {
+        segment->type = PATH_SEGMENT_INDEX;
+        while (isdigit((unsigned char)*string)) {
+            if (segment->index > (SIZE_MAX - 9) / 10) {
+                return NULL;
+            }
+            segment->index = segment->index * 10 + (size_t)(*string - '0');
+            string++;
+        }
+    } else if (*string == '\"' || *string == '\'') {
+        quote = *string++;
+        start = string;
+        while (*string != '\0' && *string != quote) {
+            string++;
+        }
+        if (*string != quote) {
+            return NULL;
+        }
+        segment->key.name = parson_strndup(start, string - start);
+        segment->type = PATH_SEGMENT_KEY;
+        segment->key = json_key_make(segment->key.name);
+        if (segment->key.name == NULL) {
+            return NULL;
+        }
+        string++;
+    } else {
+        return NULL;
+    }
+    return *string == ']' ? string + 1 : NULL;
+}
+
+JSON_Path * json_path_compile(const char *expression) {
+    JSON_Path *path = NULL;
+    const char *string = expression;
+    size_t capacity = 1;
+    parson_bool_t need_separator = PARSON_FALSE;
+    if (expression == NULL) {
+        return NULL;
+    }
+    /* every segment but the first starts with '.' or '[' */
+    for (string = expression; *string != '\0'; string++) {
+        if (*string == '.' || *string == '[') {
+            capacity++;
+        }
+    }
+    path = (JSON_Path*)parson_malloc(sizeof(JSON_Path));
+    if (path == NULL) {
+        return NULL;
+    }
+    path->count = 0;
+    path->segments = (JSON_Path_Segment*)parson_malloc(capacity * sizeof(JSON_Path_Segment));
+    if (path->segments == NULL) {
+        parson_free(path);
+        return NULL;
+    }
+    memset(path->segments, 0, capacity * sizeof(JSON_Path_Segment));
+    string = expression;
+    if (string[0] == '$' && (string[1] == '\0' || string[1] == '.' || string[1] == '[')) {
+        string++;
+        need_separator = PARSON_TRUE;
+    }
+    while (*string != '\0') {
+        if (*string == '.') {
+            string++;
+            if (*string == '[') {
+                goto error;
+            }
+        } else if (*string != '[' && need_separator) {
+            goto error;
+        }
+        string = path_parse_segment(string, &path->segments[path->count++]);
+        if (string == NULL) {
+            goto error;
+        }
+        need_separator = PARSON_TRUE;
+    }
+    return path;
+error:
+    json_path_free(path);
+    return NULL;
+}
+
+void json_path_free(JSON_Path *path) {
+    size_t i = 0;
+    if (path == NULL) {
+        return;
+    }
+    for (i = 0; i < path->count; i++) {
+        parson_free((char*)path->segments[i].key.name);
+    }
+    parson_free(path->segments);
+    parson_free(path);
+}
+
+static JSON_Status path_evaluate(const JSON_Path *path, size_t segment_ix, const JSON_Value *value,
+                                 JSON_Path_Match_Function match, void *context) {
+    const JSON_Path_Segment *segment = NULL;
+    JSON_Object *object = NULL;
+    JSON_Array *array = NULL;
+    size_t i = 0;
+    if (segment_ix == path->count) {
+        return match(value, context);
+    }
+    segment = &path->segments[segment_ix];
+    switch (segment->type) {
+        case PATH_SEGMENT_KEY:
+            value = json_object_get_value_by_key(json_value_get_object(value), &segment->key);
+            break;
+        case PATH_SEGMENT_INDEX:
+            value = json_array_get_value(json_value_get_array(value), segment->index);
+            break;
+        default:
+            object = json_value_get_object(value);
+            array = json_value_get_array(value);
+            for (i = 0; object != NULL && i < json_object_get_count(object); i++) {
+                if (path_evaluate(path, segment_ix + 1, json_object_get_value_at(object, i), match, context) != JSONSuccess) {
+                    return JSONFailure;
+                }
+            }
+            for (i = 0; array != NULL && i < json_array_get_count(array); i++) {
+                if (path_evaluate(path, segment_ix + 1, json_array_get_value(array, i), match, context) != JSONSuccess) {
+                    return JSONFailure;
+                }
+            }
+            return JSONSuccess;
+    }
+    if (value == NULL) {
+        return JSONSuccess;
+    }
+    return path_evaluate(path, segment_ix + 1, value, match, context);
+}
+
+JSON_Status json_path_evaluate(const JSON_Path *path, const JSON_Value *value,
+                               JSON_Path_Match_Function match, void *context) {
+    if (path == NULL || value == NULL || match == NULL) {
+        return JSONFailure;
+    }
+    return path_evaluate(path, 0, value, match, context);
+}
+
+static JSON_Status path_take_first(const JSON_Value *value, void *context) {
+    *(const JSON_Value**)context = value;
+    return JSONFailure; /* stops evaluation */
+}
+
+JSON_Value * json_path_get_value(const JSON_Path *path, const JSON_Value *value) {
+    const JSON_Value *result = NULL;
+    json_path_evaluate(path, value, path_take_first, &result);
+    return (JSON_Value*)result;
+}
+
+/* Decides whether the value starting now is on the path, called once for every value */
+static int path_filter_match(JSON_Path_Filter *filter) {
+    JSON_Path_Frame *frame = NULL;
+    const JSON_Path_Segment *segment = NULL;
+    parson_bool_t matched = PARSON_FALSE;
+    if (filter->depth > 0) {
+        frame = &filter->frames[filter->depth - 1];
+        segment = &filter->path->segments[filter->depth - 1];
+        if (frame->is_object) {
+            matched = frame->key_matched;
+        } else {
+            matched = segment->type == PATH_SEGMENT_WILDCARD
+                || (segment->type == PATH_SEGMENT_INDEX && segment->index == frame->next_index);
+            frame->next_index++;
+        }
+        if (!matched) {
+            return PATH_NO_MATCH;
+        }
+    }
+    return filter->depth == filter->path->count ? PATH_FULL_MATCH : PATH_PARTIAL_MATCH;
+}
+
+static JSON_Status path_filter_begin(JSON_Path_Filter *filter, parson_bool_t is_object) {
+    JSON_Status (*callback)(void *context) = is_object ? filter->callbacks.begin_object : filter->callbacks.begin_array;
+    JSON_Path_Frame *frame = NULL;
+    if (filter->skip_depth > 0) {
+        filter->skip_depth++;
+        return JSONSuccess;
+    }
+    if (filter->forward_depth == 0) {
+        switch (path_filter_match(filter)) {
+            case PATH_NO_MATCH:
+                filter->skip_depth = 1;
+                return JSONSuccess;
+            case PATH_PARTIAL_MATCH:
+                frame = &filter->frames[filter->depth++];
+                frame->is_object = is_object;
+                frame->key_matched = PARSON_FALSE;
+                frame->next_index = 0;
+                return JSONSuccess;
+            default:
+                break;
+        }
+    }
+    filter->forward_depth++;
+    return callback != NULL ? callback(filter->context) : JSONSuccess;
+}
+
+static JSON_Status path_filter_end(JSON_Path_Filter *filter, parson_bool_t is_object) {
+    JSON_Status (*callback)(void *context) = is_object ? filter->callbacks.end_object : filter->callbacks.end_array;
+    if (filter->skip_depth > 0) {
+        filter->skip_depth--;
+        return JSONSuccess;
+    }
+    if (filter->forward_depth == 0) {
+        filter->depth--;
+        return JSONSuccess;
+    }
+    filter->forward_depth--;
+    return callback != NULL ? callback(filter->context) : JSONSuccess;
+}
+
+/* Returns PARSON_TRUE if a scalar value has to be passed on */
+static parson_bool_t path_filter_scalar(JSON_Path_Filter *filter) {
+    if (filter->skip_depth > 0) {
+        return PARSON_FALSE;
+    }
+    if (filter->forward_depth > 0) {
+        return PARSON_TRUE;
+    }
+    return path_filter_match(filter) == PATH_FULL_MATCH;
+}
+
+static JSON_Status path_filter_begin_object(void *context) {
+    return path_filter_begin((JSON_Path_Filter*)context, PARSON_TRUE);
+}
+
+static JSON_Status path_filter_end_object(void *context) {
+    return path_filter_end((JSON_Path_Filter*)context, PARSON_TRUE);
+}
+
+static JSON_Status path_filter_begin_array(void *context) {
+    return path_filter_begin((JSON_Path_Filter*)context, PARSON_FALSE);
+}
+
+static JSON_Status path_filter_end_array(void *context) {
+    return path_filter_end((JSON_Path_Filter*)context, PARSON_FALSE);
+}
+
+static JSON_Status path_filter_key(void *context, const char *name, size_t len) {
+    JSON_Path_Filter *filter = (JSON_Path_Filter*)context;
+    const JSON_Path_Segment *segment = NULL;
+    if (filter->skip_depth > 0) {
+        return JSONSuccess;
+    }
+    if (filter->forward_depth > 0) {
+        return filter->callbacks.key != NULL ? filter->callbacks.key(filter->context, name, len) : JSONSuccess;
+    }
+    segment = &filter->path->segments[filter->depth - 1];
+    filter->frames[filter->depth - 1].key_matched = segment->type == PATH_SEGMENT_WILDCARD
+        || (segment->type == PATH_SEGMENT_KEY && segment->key.len == len
+            && memcmp(segment->key.name, name, len) == 0);
+    return JSONSuccess;
+}
+
+static JSON_Status path_filter_string(void *context, const char *string, size_t len) {
+    JSON_Path_Filter *filter = (JSON_Path_Filter*)context;
+    if (!path_filter_scalar(filter) || filter->callbacks.string == NULL) {
+        return JSONSuccess;
+    }
+    return filter->callbacks.string(filter->context, string, len);
+}
+
+static JSON_Status path_filter_number(void *context, double number) {
+    JSON_Path_Filter *filter = (JSON_Path_Filter*)context;
+    if (!path_filter_scalar(filter) || filter->callbacks.number == NULL) {
+        return JSONSuccess;
+    }
+    return filter->callbacks.number(filter->context, number);
+}
+
+static JSON_Status path_filter_boolean(void *context, int boolean) {
+    JSON_Path_Filter *filter = (JSON_Path_Filter*)context;
+    if (!path_filter_scalar(filter) || filter->callbacks.boolean == NULL) {
+        return JSONSuccess;
+    }
+    return filter->callbacks.boolean(filter->context, boolean);
+}
+
+static JSON_Status path_filter_null(void *context) {
+    JSON_Path_Filter *filter = (JSON_Path_Filter*)context;
+    if (!path_filter_scalar(filter) || filter->callbacks.null == NULL) {
+        return JSONSuccess;
+    }
+    return filter->callbacks.null(filter->context);
+}
+
+static const JSON_Stream_Callbacks path_filter_callbacks = {
+    path_filter_begin_object,
+    path_filter_end_object,
+    path_filter_begin_array,
+    path_filter_end_array,
+    path_filter_key,
+    path_filter_string,
+    path_filter_number,
+    path_filter_boolean,
+    path_filter_null
+};
+
+JSON_Stream_Parser * json_path_stream_parser_init(const JSON_Path *path, const JSON_Stream_Callbacks *callbacks, void *context) {
+    JSON_Path_Filter *filter = NULL;
+    JSON_Stream_Parser *parser = NULL;
+    if (path == NULL) {
+        return NULL;
+    }
+    filter = (JSON_Path_Filter*)parson_malloc(sizeof(JSON_Path_Filter) + (path->count + 1) * sizeof(JSON_Path_Frame));
+    if (filter == NULL) {
+        return NULL;
+    }
+    memset(filter, 0, sizeof(JSON_Path_Filter));
+    filter->path = path;
+    filter->frames = (JSON_Path_Frame*)(filter + 1);
+    if (callbacks != NULL) {
+        filter->callbacks = *callbacks;
+    }
+    filter->context = context;
+    parser = json_stream_parser_init(&path_filter_callbacks, filter);
+    if (parser == NULL) {
+        parson_free(filter);
+        return NULL;
+    }
+    parser->filter = filter;
+    return parser;
+}
+
+/* Binary encoding (CBOR) */
+#define CBOR_MAJOR_UNSIGNED 0
+#define CBOR_MAJOR_NEGATIVE 1
+#define CBOR_MAJOR_BYTES    2
+#define CBOR_MAJOR_TEXT     3
+#define CBOR_MAJOR_ARRAY    4
+#define CBOR_MAJOR_MAP      5
+#define CBOR_MAJOR_TAG      6
+#define CBOR_MAJOR_SIMPLE   7
+
+#define CBOR_FALSE  0xF4
+#define CBOR_TRUE   0xF5
+#define CBOR_NULL   0xF6
+#define CBOR_FLOAT  0xFA
+#define CBOR_DOUBLE 0xFB
+
+#define CBOR_TAG_ENCODED_ITEM 24 /* byte string holding one encoded item */
+#define CBOR_MAX_EXACT_INTEGER 9007199254740992.0 /* 2^53 */
+
+typedef struct json_cbor_head {
+    int      major;
+    int      info; /* low 5 bits of the initial byte */
+    uint64_t arg;  /* count, length, tag number or bits of a float */
+    size_t   size; /* initial byte and argument */
+} JSON_CBOR_Head;
+
+/* An item as seen past its tags */
+typedef struct json_cbor_item {
+    JSON_Value_Type type;
+    JSON_CBOR_Head  head;
+    size_t          start; /* offset of head */
+    size_t          end;   /* offset after an enclosing tag 24 byte string, 0 without one */
+} JSON_CBOR_Item;
+
+typedef struct json_cbor_frame {
+    size_t        end;       /* offset after a length prefixed container, 0 if unknown */
+    size_t        remaining; /* values left */
+    parson_bool_t is_object;
+    parson_bool_t has_key;   /* key of the next member has been read */
+} JSON_CBOR_Frame;
+
+struct json_cbor_reader_t {
+    const unsigned char *data;
+    size_t               len;
+    size_t               pos;
+    JSON_CBOR_Frame     *frames;
+    size_t               depth;
+    size_t               capacity;
+    parson_bool_t        failed; /* reader can't be used after malformed input */
+};
+
+/* Writes initial_byte followed by the size low bytes of arg, most significant first */
+static JSON_Status cbor_write_be(JSON_Output *output, unsigned char initial_byte, uint64_t arg, size_t size) {
+    unsigned char head[9];
+    size_t i = 0;
+    head[0] = initial_byte;
+    for (i = 0; i < size; i++) {
+        head[size - i] = (unsigned char)(arg >> (8 * i));
+    }
+    return output_append(output, (const char*)head, size + 1);
+}
+
+static JSON_Status cbor_write_head(JSON_Output *output, int major, uint64_t arg) {
+    unsigned char initial_byte = (unsigned char)(major << 5);
+    if (arg < 24) {
+        return cbor_write_be(output, (unsigned char)(initial_byte | arg), 0, 0);
+    } else if (arg <= 0xFF) {
+        return cbor_write_be(output, (unsigned char)(initial_byte | 24), arg, 1);
+    } else if (arg <= 0xFFFF) {
+        return cbor_write_be(output, (unsigned char)(initial_byte | 25), arg, 2);
+    } else if (arg <= 0xFFFFFFFFUL) {
+        return cbor_write_be(output, (unsigned char)(initial_byte | 26), arg, 4);
+    }
+    return cbor_write_be(output, (unsigned char)(initial_byte | 27), arg, 8);
+}
+
+/* Integral numbers up to 2^53 are written as integers, others as the smallest float
+   that holds them exactly */
+static JSON_Status cbor_write_number(JSON_Output *output, double number) {
+    uint64_t bits = 0;
+    uint32_t float_bits = 0;
+    float number_float = 0.0f;
+    memcpy(&bits, &number, sizeof(bits));
+    if (fabs(number) <= CBOR_MAX_EXACT_INTEGER && (double)(int64_t)number == number && (number != 0.0 || bits == 0)) {
+        if (number >= 0) {
+            return cbor_write_head(output, CBOR_MAJOR_UNSIGNED, (uint64_t)number);
+        }
+        return cbor_write_head(output, CBOR_MAJOR_NEGATIVE, (uint64_t)(-1.0 - number));
+    }
+    if (fabs(number) <= FLT_MAX) {
+        number_float = (float)number;
+        if ((double)number_float == number) {
+            memcpy(&float_bits, &number_float, sizeof(float_bits));
+            return cbor_write_be(output, CBOR_FLOAT, float_bits, 4);
+        }
+    }
+    return cbor_write_be(output, CBOR_DOUBLE, bits, 8);
+}
+
+/* Same traversal as json_serialize_value. Non-empty containers are wrapped in a tag 24
+   byte string whose 4 byte length is patched in once the container is complete. */
+static JSON_Status cbor_encode_value(const JSON_Value *value, JSON_Output *output, JSON_Serialize_Stack *stack) {
+    JSON_Serialize_Frame *frame = NULL;
+    const JSON_Object_Item *item = NULL;
+    size_t count = 0, length = 0, i = 0;
+    parson_bool_t is_object = PARSON_FALSE;
+
+    while (PARSON_TRUE) {
+        if (stack->depth > 0) {
+            frame = &stack->frames[stack->depth - 1];
+            if (json_value_get_type(frame->container) == JSONObject) {
+                item = &json_value_get_object(frame->container)->items[frame->index];
+                if (item->name == NULL
+                    || cbor_write_head(output, CBOR_MAJOR_TEXT, item->name_len) != JSONSuccess
+                    || output_append(output, item->name, item->name_len) != JSONSuccess) {
+                    return JSONFailure;
+                }
+                value = item->value;
+            } else {
+                value = json_array_get_value(json_value_get_array(frame->container), frame->index);
+            }
+        }
+        switch (json_value_get_type(value)) {
+            case JSONObject:
+            case JSONArray:
+                is_object = json_value_get_type(value) == JSONObject;
+                count = is_object ? json_object_get_count(json_value_get_object(value))
+                                  : json_array_get_count(json_value_get_array(value));
+                if (count > 0) {
+                    if (cbor_write_head(output, CBOR_MAJOR_TAG, CBOR_TAG_ENCODED_ITEM) != JSONSuccess
+                        || cbor_write_be(output, (CBOR_MAJOR_BYTES << 5) | 26, 0, 4) != JSONSuccess
+                        || serialize_stack_push(stack, value, count) != JSONSuccess) {
+                        return JSONFailure;
+                    }
+                    stack->frames[stack->depth - 1].length_ix = output->len - 4;
+                }
+                if (cbor_write_head(output, is_object ? CBOR_MAJOR_MAP : CBOR_MAJOR_ARRAY, count) != JSONSuccess) {
+                    return JSONFailure;
+                }
+                if (count > 0) {
+                    continue;
+                }
+                break;
+            case JSONString:
+                if (cbor_write_head(output, CBOR_MAJOR_TEXT, json_value_get_string_len(value)) != JSONSuccess
+                    || output_append(output, json_value_get_string(value), json_value_get_string_len(value)) != JSONSuccess) {
+                    return JSONFailure;
+                }
+                break;
+            case JSONNumber:
+                if (cbor_write_number(output, json_value_get_number(value)) != JSONSuccess) {
+                    return JSONFailure;
+                }
+                break;
+            case JSONBoolean:
+                if (output_append(output, json_value_get_boolean(value) ? "\xF5" : "\xF4", 1) != JSONSuccess) {
+                    return JSONFailure;
+                }
+                break;
+            case JSONNull:
+                if (output_append(output, "\xF6", 1) != JSONSuccess) {
+                    return JSONFailure;
+                }
+                break;
+            default:
+                return JSONFailure;
+        }
+        /* value is complete, move to its next sibling or close finished containers */
+        while (stack->depth > 0) {
+            frame = &stack->frames[stack->depth - 1];
+            frame->index++;
+            if (frame->index < frame->count) {
+                break;
+            }
+            length = output->len - (frame->length_ix + 4);
+            if (length > 0xFFFFFFFFUL) {
+                return JSONFailure;
+            }
+            for (i = 0; i < 4; i++) {
+                output->buf[frame->length_ix + 3 - i] = (char)(unsigned char)(length >> (8 * i));
+            }
+            stack->depth--;
+        }
+        if (stack->depth == 0) {
+            return JSONSuccess;
+        }
+    }
+}
+
+static JSON_Status cbor_encode_to_output(const JSON_Value *value, JSON_Output *output) {
+    JSON_Serialize_Stack stack;
+    JSON_Status status = JSONFailure;
+    stack.frames = stack.local;
+    stack.depth = 0;
+    stack.capacity = SERIALIZE_STACK_SIZE;
+    status = cbor_encode_value(value, output, &stack);
+    if (stack.frames != stack.local) {
+        parson_free(stack.frames);
+    }
+    return status;
+}
+
+static JSON_Status cbor_read_head(const unsigned char *data, size_t len, size_t pos, JSON_CBOR_Head *head) {
+    size_t i = 0;
+    if (pos >= len) {
+        return JSONFailure;
+    }
+    head->major = data[pos] >> 5;
+    head->info = data[pos] & 0x1F;
+    head->arg = 0;
+    if (head->info < 24) {
+        head->arg = (uint64_t)head->info;
+        head->size = 1;
+        return JSONSuccess;
+    } else if (head->info > 27) {
+        return JSONFailure; /* reserved or indefinite length */
+    }
+    head->size = 1 + ((size_t)1 << (head->info - 24));
+    if (len - pos < head->size) {
+        return JSONFailure;
+    }
+    for (i = 1; i < head->size; i++) {
+        head->arg = (head->arg << 8) | data[pos + i];
+    }
+    return JSONSuccess;
+}
+
+/* Describes the item at pos without consuming it, checking that it fits in the input */
+static JSON_Status cbor_peek_item(const JSON_CBOR_Reader *reader, size_t pos, JSON_CBOR_Item *item) {
+    JSON_CBOR_Head bytes_head;
+    size_t available = 0;
+    item->end = 0;
+    while (PARSON_TRUE) {
+        if (cbor_read_head(reader->data, reader->len, pos, &item->head) != JSONSuccess) {
+            return JSONFailure;
+        }
+        if (item->head.major != CBOR_MAJOR_TAG) {
+            break;
+        }
+        pos += item->head.size;
+        if (item->head.arg != CBOR_TAG_ENCODED_ITEM) {
+            continue; /* other tags have no meaning in JSON */
+        }
+        if (item->end != 0 /* nested wrapping isn't tracked */
+            || cbor_read_head(reader->data, reader->len, pos, &bytes_head) != JSONSuccess
+            || bytes_head.major != CBOR_MAJOR_BYTES
+            || bytes_head.arg > reader->len - pos - bytes_head.size) {
+            return JSONFailure;
+        }
+        pos += bytes_head.size;
+        item->end = pos + (size_t)bytes_head.arg;
+    }
+    item->start = pos;
+    if (item->end != 0 && item->end - pos < item->head.size) {
+        return JSONFailure;
+    }
+    available = (item->end != 0 ? item->end : reader->len) - pos - item->head.size;
+    switch (item->head.major) {
+        case CBOR_MAJOR_UNSIGNED:
+        case CBOR_MAJOR_NEGATIVE:
+            item->type = JSONNumber;
+            return JSONSuccess;
+        case CBOR_MAJOR_TEXT:
+            item->type = JSONString;
+            return item->head.arg <= available ? JSONSuccess : JSONFailure;
+        case CBOR_MAJOR_ARRAY:
+            item->type = JSONArray;
+            return item->head.arg <= available ? JSONSuccess : JSONFailure; /* every value takes a byte */
+        case CBOR_MAJOR_MAP:
+            item->type = JSONObject;
+            return item->head.arg <= available / 2 ? JSONSuccess : JSONFailure;
+        case CBOR_MAJOR_SIMPLE:
+            if (item->head.info == 20 || item->head.info == 21) {
+                item->type = JSONBoolean;
+            } else if (item->head.info == 22) {
+                item->type = JSONNull;
+            } else if (item->head.info >= 25 && item->head.info <= 27) {
+                item->type = JSONNumber;
+            } else {
+                return JSONFailure;
+            }
+            return JSONSuccess;
+        default:
+            return JSONFailure; /* byte strings have no JSON equivalent */
+    }
+}
+
+static JSON_Status cbor_item_number(const JSON_CBOR_Item *item, double *number) {
+    uint32_t float_bits = 0;
+    float number_float = 0.0f;
+    int exponent = 0;
+    double mantissa = 0.0;
+    switch (item->head.major) {
+        case CBOR_MAJOR_UNSIGNED:
+            *number = (double)item->head.arg;
+            return JSONSuccess;
+        case CBOR_MAJOR_NEGATIVE:
+            *number = -1.0 - (double)item->head.arg;
+            return JSONSuccess;
+        default:
+            break;
+    }
+    if (item->head.info == 25) { /* half precision */
+        exponent = (int)(item->head.arg >> 10) & 0x1F;
+        mantissa = (double)(item->head.arg & 0x3FF);
+        if (exponent == 0x1F) {
+            return JSONFailure; /* infinity and NaN */
+        }
+        if (exponent > 0) {
+            mantissa += 1024.0;
+            exponent--;
+        }
+        *number = mantissa / 16777216.0; /* 2^24 */
+        for (; exponent > 0; exponent--) {
+            *number *= 2.0;
+        }
+        if (item->head.arg & 0x8000) {
+            *number = -*number;
+        }
+    } else if (item->head.info == 26) {
+        float_bits = (uint32_t)item->head.arg;
+        memcpy(&number_float, &float_bits, sizeof(number_float));
+        *number = number_float;
+    } else {
+        memcpy(number, &item->head.arg, sizeof(*number));
+    }
+    return IS_NUMBER_INVALID(*number) ? JSONFailure : JSONSuccess;
+}
+
+/* Checks that a value can be read here and describes it */
+static JSON_Status cbor_reader_next(JSON_CBOR_Reader *reader, JSON_CBOR_Item *item) {
+    JSON_CBOR_Frame *frame = NULL;
+    if (reader->failed) {
+        return JSONFailure;
+    }
+    if (reader->depth > 0) {
+        frame = &reader->frames[reader->depth - 1];
+        if (frame->remaining == 0 || (frame->is_object && !frame->has_key)) {
+            return JSONFailure;
+        }
+    }
+    if (cbor_peek_item(reader, reader->pos, item) != JSONSuccess) {
+        reader->failed = PARSON_TRUE;
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+/* Moves past a scalar item, which has to fill its tag 24 byte string exactly */
+static JSON_Status cbor_reader_consume(JSON_CBOR_Reader *reader, const JSON_CBOR_Item *item, size_t size) {
+    JSON_CBOR_Frame *frame = NULL;
+    reader->pos = item->start + size;
+    if (item->end != 0 && reader->pos != item->end) {
+        reader->failed = PARSON_TRUE;
+        return JSONFailure;
+    }
+    if (reader->depth > 0) {
+        frame = &reader->frames[reader->depth - 1];
+        frame->remaining--;
+        frame->has_key = PARSON_FALSE;
+    }
+    return JSONSuccess;
+}
+
+/* Walks over an item without decoding it, jumping over length prefixed containers */
+static JSON_Status cbor_skip_item(JSON_CBOR_Reader *reader, size_t pos, size_t *new_pos) {
+    JSON_CBOR_Item item;
+    size_t pending = 1;
+    while (pending > 0) {
+        if (cbor_peek_item(reader, pos, &item) != JSONSuccess) {
+            return JSONFailure;
+        }
+        pending--;
+        if (item.end != 0) {
+            pos = item.end;
+            continue;
+        }
+        pos = item.start + item.head.size;
+        if (item.type == JSONString) {
+            pos += (size_t)item.head.arg;
+        } else if (item.type == JSONArray) {
+            pending += (size_t)item.head.arg;
+        } else if (item.type == JSONObject) {
+            pending += 2 * (size_t)item.head.arg;
+        }
+    }
+    *new_pos = pos;
+    return JSONSuccess;
+}
+
+unsigned char * json_cbor_encode(const JSON_Value *value, size_t *len) {
+    JSON_Output output = { NULL, 0, 0, PARSON_TRUE, NULL, NULL };
+    if (cbor_encode_to_output(value, &output) != JSONSuccess) {
+        parson_free(output.buf);
+        return NULL;
+    }
+    if (len != NULL) {
+        *len = output.len;
+    }
+    return (unsigned char*)output.buf;
+}
+
+JSON_Status json_cbor_encode_to_file(const JSON_Value *value, const char *filename) {
+    JSON_Status return_code = JSONSuccess;
+    unsigned char *data = NULL;
+    size_t len = 0;
+    FILE *fp = NULL;
+    data = json_cbor_encode(value, &len);
+    if (data == NULL) {
+        return JSONFailure;
+    }
+    fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        json_cbor_free(data);
+        return JSONFailure;
+    }
+    if (fwrite(data, 1, len, fp) != len) {
+        return_code = JSONFailure;
+    }
+    if (fclose(fp) == EOF) {
+        return_code = JSONFailure;
+    }
+    json_cbor_free(data);
+    return return_code;
+}
+
+void json_cbor_free(unsigned char *data) {
+    parson_free(data);
+}
+
+JSON_Value * json_cbor_decode(const unsigned char *data, size_t len) {
+    JSON_CBOR_Reader *reader = json_cbor_reader_init(data, len);
+    JSON_Value *value = NULL;
+    if (reader == NULL) {
+        return NULL;
+    }
+    value = json_cbor_reader_read_value(reader);
+    json_cbor_reader_free(reader);
+    return value;
+}
+
+JSON_Value * json_cbor_decode_file(const char *filename) {
+    JSON_File_Contents contents;
+    JSON_Value *value = NULL;
+    if (file_contents_load(filename, PARSON_FALSE, &contents) != JSONSuccess) {
+        return NULL;
+    }
+    value = json_cbor_decode((const unsigned char*)contents.data, contents.len);
+    file_contents_release(&contents);
+    return value;
+}
+
+JSON_CBOR_Reader * json_cbor_reader_init(const unsigned char *data, size_t len) {
+    JSON_CBOR_Reader *reader = NULL;
+    if (data == NULL && len > 0) {
+        return NULL;
+    }
+    reader = (JSON_CBOR_Reader*)parson_malloc(sizeof(JSON_CBOR_Reader));
+    if (reader == NULL) {
+        return NULL;
+    }
+    memset(reader, 0, sizeof(JSON_CBOR_Reader));
+    reader->data = data;
+    reader->len = len;
+    return reader;
+}
+
+void json_cbor_reader_free(JSON_CBOR_Reader *reader) {
+    if (reader == NULL) {
+        return;
+    }
+    parson_free(reader->frames);
+    parson_free(reader);
+}
+
+JSON_Value_Type json_cbor_reader_peek(JSON_CBOR_Reader *reader) {
+    JSON_CBOR_Item item;
+    if (reader == NULL || (reader->depth == 0 && reader->pos == reader->len)
+        || cbor_reader_next(reader, &item) != JSONSuccess) {
+        return JSONError;
+    }
+    return item.type;
+}
+
+const char * json_cbor_reader_read_key(JSON_CBOR_Reader *reader, size_t *len) {
+    JSON_CBOR_Frame *frame = NULL;
+    JSON_CBOR_Item item;
+    if (reader == NULL || reader->failed || reader->depth == 0) {
+        return NULL;
+    }
+    frame = &reader->frames[reader->depth - 1];
+    if (!frame->is_object || frame->has_key || frame->remaining == 0) {
+        return NULL;
+    }
+    if (cbor_peek_item(reader, reader->pos, &item) != JSONSuccess || item.type != JSONString || item.end != 0) {
+        reader->failed = PARSON_TRUE;
+        return NULL;
+    }
+    reader->pos = item.start + item.head.size + (size_t)item.head.arg;
+    frame->has_key = PARSON_TRUE;
+    if (len != NULL) {
+        *len = (size_t)item.head.arg;
+    }
+    return (const char*)reader->data + item.start + item.head.size;
+}
+
+JSON_Status json_cbor_reader_enter(JSON_CBOR_Reader *reader, size_t *count) {
+    JSON_CBOR_Frame *new_frames = NULL;
+    JSON_CBOR_Item item;
+    if (reader == NULL || cbor_reader_next(reader, &item) != JSONSuccess
+        || (item.type != JSONObject && item.type != JSONArray)) {
+        return JSONFailure;
+    }
+    new_frames = (JSON_CBOR_Frame*)grow_array(reader->frames, reader->depth, &reader->capacity, sizeof(JSON_CBOR_Frame));
+    if (new_frames == NULL) {
+        return JSONFailure;
+    }
+    reader->frames = new_frames;
+    reader->frames[reader->depth].end = item.end;
+    reader->frames[reader->depth].remaining = (size_t)item.head.arg;
+    reader->frames[reader->depth].is_object = item.type == JSONObject;
+    reader->frames[reader->depth].has_key = PARSON_FALSE;
+    reader->depth++;
+    reader->pos = item.start + item.head.size;
+    if (count != NULL) {
+        *count = (size_t)item.head.arg;
+    }
+    return JSONSuccess;
+}
+
+JSON_Status json_cbor_reader_leave(JSON_CBOR_Reader *reader) {
+    JSON_CBOR_Frame *frame = NULL;
+    if (reader == NULL || reader->failed || reader->depth == 0) {
+        return JSONFailure;
+    }
+    frame = &reader->frames[reader->depth - 1];
+    if (frame->end != 0) {
+        if (frame->remaining == 0 && reader->pos != frame->end) {
+            reader->failed = PARSON_TRUE; /* length prefix doesn't match the content */
+            return JSONFailure;
+        }
+        reader->pos = frame->end;
+    } else {
+        if (frame->has_key) {
+            frame->remaining = frame->remaining * 2 - 1; /* walk keys and values alike */
+        } else if (frame->is_object) {
+            frame->remaining *= 2;
+        }
+        while (frame->remaining > 0) {
+            if (cbor_skip_item(reader, reader->pos, &reader->pos) != JSONSuccess) {
+                reader->failed = PARSON_TRUE;
+                return JSONFailure;
+            }
+            frame->remaining--;
+        }
+    }
+    reader->depth--;
+    if (reader->depth > 0) {
+        frame = &reader->frames[reader->depth - 1];
+        frame->remaining--;
+        frame->has_key = PARSON_FALSE;
+    }
+    return JSONSuccess;
+}
+
+JSON_Status json_cbor_reader_skip(JSON_CBOR_Reader *reader) {
+    JSON_CBOR_Item item;
+    size_t new_pos = 0;
+    if (reader == NULL || cbor_reader_next(reader, &item) != JSONSuccess) {
+        return JSONFailure;
+    }
+    if (cbor_skip_item(reader, reader->pos, &new_pos) != JSONSuccess) {
+        reader->failed = PARSON_TRUE;
+        return JSONFailure;
+    }
+    return cbor_reader_consume(reader, &item, new_pos - item.start);
+}
+
+const char * json_cbor_reader_read_string(JSON_CBOR_Reader *reader, size_t *len) {
+    JSON_CBOR_Item item;
+    if (reader == NULL || cbor_reader_next(reader, &item) != JSONSuccess || item.type != JSONString
+        || cbor_reader_consume(reader, &item, item.head.size + (size_t)item.head.arg) != JSONSuccess) {
+        return NULL;
+    }
+    if (len != NULL) {
+        *len = (size_t)item.head.arg;
+    }
+    return (const char*)reader->data + item.start + item.head.size;
+}
+
+JSON_Status json_cbor_reader_read_number(JSON_CBOR_Reader *reader, double *number) {
+    JSON_CBOR_Item item;
+    double result = 0.0;
+    if (reader == NULL || number == NULL || cbor_reader_next(reader, &item) != JSONSuccess
+        || item.type != JSONNumber || cbor_item_number(&item, &result) != JSONSuccess
+        || cbor_reader_consume(reader, &item, item.head.size) != JSONSuccess) {
+        return JSONFailure;
+    }
+    *number = result;
+    return JSONSuccess;
+}
+
+JSON_Status json_cbor_reader_read_boolean(JSON_CBOR_Reader *reader, int *boolean) {
+    JSON_CBOR_Item item;
+    if (reader == NULL || boolean == NULL || cbor_reader_next(reader, &item) != JSONSuccess
+        || item.type != JSONBoolean || cbor_reader_consume(reader, &item, item.head.size) != JSONSuccess) {
+        return JSONFailure;
+    }
+    *boolean = item.head.info == 21;
+    return JSONSuccess;
+}
+
+/* Decodes without recursion like parse_value, containers are tracked through the
+   reader's frames and the parent pointers of their values */
+JSON_Value * json_cbor_reader_read_value(JSON_CBOR_Reader *reader) {
+    JSON_Value *root = NULL, *container = NULL, *new_value = NULL;
+    const char *key = NULL, *string = NULL;
+    char *new_key = NULL;
+    size_t key_len = 0, string_len = 0, count = 0, base_depth = 0;
+    double number = 0.0;
+    int boolean = 0;
+    if (reader == NULL) {
+        return NULL;
+    }
+    base_depth = reader->depth;
+    while (PARSON_TRUE) {
+        if (container != NULL && json_value_get_type(container) == JSONObject) {
+            key = json_cbor_reader_read_key(reader, &key_len);
+            /* We do not support key names with embedded \0 chars */
+            if (key == NULL || memchr(key, '\0', key_len) != NULL) {
+                goto error;
+            }
+            new_key = parson_strndup(key, key_len);
+            if (new_key == NULL) {
+                goto error;
+            }
+        }
+        new_value = NULL;
+        switch (json_cbor_reader_peek(reader)) {
+            case JSONObject:
+            case JSONArray:
+                if (reader->depth - base_depth >= MAX_NESTING) {
+                    goto error;
+                }
+                new_value = json_cbor_reader_peek(reader) == JSONObject ? json_value_init_object() : json_value_init_array();
+                if (new_value != NULL && json_cbor_reader_enter(reader, &count) != JSONSuccess) {
+                    json_value_free(new_value);
+                    goto error;
+                }
+                if (new_value != NULL && json_value_get_type(new_value) == JSONArray && count > 0
+                    && json_array_resize(json_value_get_array(new_value), count) != JSONSuccess) {
+                    json_value_free(new_value);
+                    goto error;
+                }
+                break;
+            case JSONString:
+                string = json_cbor_reader_read_string(reader, &string_len);
+                if (string != NULL) {
+                    new_value = json_value_init_string_with_len(string, string_len);
+                }
+                break;
+            case JSONNumber:
+                if (json_cbor_reader_read_number(reader, &number) == JSONSuccess) {
+                    new_value = json_value_init_number(number);
+                }
+                break;
+            case JSONBoolean:
+                if (json_cbor_reader_read_boolean(reader, &boolean) == JSONSuccess) {
+                    new_value = json_value_init_boolean(boolean);
+                }
+                break;
+            case JSONNull:
+                if (json_cbor_reader_skip(reader) == JSONSuccess) {
+                    new_value = json_value_init_null();
+                }
+                break;
+            default:
+                break;
+        }
+        if (new_value == NULL) {
+            goto error;
+        }
+        if (container == NULL) {
+            root = new_value;
+        } else if (json_value_get_type(container) == JSONObject) {
+            if (json_object_add(json_value_get_object(container), new_key, new_value) != JSONSuccess) {
+                json_value_free(new_value);
+                goto error;
+            }
+            new_key = NULL;
+        } else if (json_array_add(json_value_get_array(container), new_value) != JSONSuccess) {
+            json_value_free(new_value);
+            goto error;
+        }
+        if (json_value_get_type(new_value) == JSONObject || json_value_get_type(new_value) == JSONArray) {
+            container = new_value;
+        }
+        /* Closes finished containers until the next member or the end of the root value */
+        while (container != NULL && reader->frames[reader->depth - 1].remaining == 0) {
+            if (json_cbor_reader_leave(reader) != JSONSuccess) {
+                goto error;
+            }
+            container = json_value_get_parent(container);
+        }
+        if (container == NULL) {
+            return root;
+        }
+    }
+error:
+    reader->failed = PARSON_TRUE;
+    parson_free(new_key);
+    json_value_free(root);
+    return NULL;
+}
+
+/* JSON Patch */
+typedef struct json_diff_frame {
+    const JSON_Value *from;
+    const JSON_Value *to;
+    char             *path; /* JSON Pointer of both values */
+} JSON_Diff_Frame;
+
+typedef struct json_diff {
+    JSON_Array      *patch;
+    const char      *id_key;
+    JSON_Diff_Frame *frames;
+    size_t           depth;
+    size_t           capacity;
+} JSON_Diff;
+
+/* Returns path extended by one reference token, escaped as ~0 and ~1 */
+static char * pointer_append(const char *path, const char *token, size_t token_len) {
+    size_t path_len = strlen(path), escaped_len = 0, i = 0;
+    char *result = NULL, *out = NULL;
+    for (i = 0; i < token_len; i++) {
+        escaped_len += (token[i] == '~' || token[i] == '/') ? 2 : 1;
+    }
+    result = (char*)parson_malloc(path_len + escaped_len + 2);
+    if (result == NULL) {
+        return NULL;
+    }
+    memcpy(result, path, path_len);
+    out = result + path_len;
+    *out++ = '/';
+    for (i = 0; i < token_len; i++) {
+        if (token[i] == '~' || token[i] == '/') {
+            *out++ = '~';
+            *out++ = token[i] == '~' ? '0' : '1';
+        } else {
+            *out++ = token[i];
+        }
+    }
+    *out = '\0';
+    return result;
+}
+
+static char * pointer_append_index(const char *path, size_t ix) {
+    char token[PARSON_NUM_BUF_SIZE];
+    int written = sprintf(token, "%lu", (unsigned long)ix);
+    return written < 0 ? NULL : pointer_append(path, token, (size_t)written);
+}
+
+/* Appends {"op": op, "path": path, "from": from, "value": copy of value} to the patch */
+static JSON_Status diff_emit(JSON_Diff *diff, const char *op, const char *path, const char *from, const JSON_Value *value) {
+    JSON_Value *op_value = json_value_init_object(), *value_copy = NULL;
+    JSON_Object *op_object = json_value_get_object(op_value);
+    if (op_value == NULL
+        || json_object_set_string(op_object, "op", op) != JSONSuccess
+        || json_object_set_string(op_object, "path", path) != JSONSuccess
+        || (from != NULL && json_object_set_string(op_object, "from", from) != JSONSuccess)) {
+        json_value_free(op_value);
+        return JSONFailure;
+    }
+    if (value != NULL) {
+        value_copy = json_value_deep_copy(value);
+        if (value_copy == NULL || json_object_set_value(op_object, "value", value_copy) != JSONSuccess) {
+            json_value_free(value_copy);
+            json_value_free(op_value);
+            return JSONFailure;
+        }
+    }
+    if (json_array_append_value(diff->patch, op_value) != JSONSuccess) {
+        json_value_free(op_value);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+/* Compares two values at path: containers of the same type are queued to be compared
+   member by member, anything else that differs is replaced. Takes ownership of path. */
+static JSON_Status diff_values(JSON_Diff *diff, const JSON_Value *from, const JSON_Value *to, char *path) {
+    JSON_Diff_Frame *new_frames = NULL;
+    JSON_Value_Type type = json_value_get_type(from);
+    JSON_Status status = JSONSuccess;
+    if (path == NULL) {
+        return JSONFailure;
+    }
+    if (type == json_value_get_type(to) && (type == JSONObject || type == JSONArray)) {
+        new_frames = (JSON_Diff_Frame*)grow_array(diff->frames, diff->depth, &diff->capacity, sizeof(JSON_Diff_Frame));
+        if (new_frames == NULL) {
+            parson_free(path);
+            return JSONFailure;
+        }
+        diff->frames = new_frames;
+        diff->frames[diff->depth].from = from;
+        diff->frames[diff->depth].to = to;
+        diff->frames[diff->depth].path = path;
+        diff->depth++;
+        return JSONSuccess;
+    }
+    if (!json_value_equals(from, to)) {
+        status = diff_emit(diff, "replace", path, NULL, to);
+    }
+    parson_free(path);
+    return status;
+}
+
+static JSON_Status diff_objects(JSON_Diff *diff, const JSON_Diff_Frame *frame) {
+    const JSON_Object *from = json_value_get_object(frame->from), *to = json_value_get_object(frame->to);
+    const JSON_Object_Item *item = NULL;
+    const JSON_Value *to_value = NULL;
+    char *path = NULL;
+    JSON_Status status = JSONSuccess;
+    size_t i = 0;
+    for (i = 0; i < from->count && status == JSONSuccess; i++) {
+        item = &from->items[i];
+        to_value = json_object_getn_value(to, item->name, item->name_len);
+        path = pointer_append(frame->path, item->name, item->name_len);
+        if (to_value == NULL) {
+            status = path != NULL ? diff_emit(diff, "remove", path, NULL, NULL) : JSONFailure;
+            parson_free(path);
+        } else {
+            status = diff_values(diff, item->value, to_value, path);
+        }
+    }
+    for (i = 0; i < to->count && status == JSONSuccess; i++) {
+        item = &to->items[i];
+        if (json_object_getn_value(from, item->name, item->name_len) == NULL) {
+            path = pointer_append(frame->path, item->name, item->name_len);
+            status = path != NULL ? diff_emit(diff, "add", path, NULL, item->value) : JSONFailure;
+            parson_free(path);
+        }
+    }
+    return status;
+}
+
+/* Key identifying an array element by its id member, NULL if it has no usable id */
+static char * diff_element_id(const JSON_Value *element, const char *id_key) {
+    const JSON_Value *id = json_object_get_value(json_value_get_object(element), id_key);
+    const char *string = NULL;
+    char *key = NULL;
+    size_t len = 0;
+    if (json_value_get_type(id) == JSONNumber) {
+        key = (char*)parson_malloc(PARSON_NUM_BUF_SIZE + 1);
+        if (key != NULL) {
+            key[0] = 'n';
+            sprintf(key + 1, "%1.17g", json_value_get_number(id));
+        }
+        return key;
+    } else if (json_value_get_type(id) == JSONString) {
+        string = json_value_get_string(id);
+        len = json_value_get_string_len(id);
+        if (memchr(string, '\0', len) != NULL) {
+            return NULL;
+        }
+        key = (char*)parson_malloc(len + 2);
+        if (key != NULL) {
+            key[0] = 's';
+            memcpy(key + 1, string, len + 1);
+        }
+        return key;
+    }
+    return NULL;
+}
+
+/* Collects the ids of all elements into ids and the set, fails if any is missing or repeated */
+static JSON_Status diff_collect_ids(const JSON_Array *array, const char *id_key, char **ids, JSON_Object *set) {
+    size_t i = 0;
+    for (i = 0; i < array->count; i++) {
+        ids[i] = diff_element_id(array->items[i], id_key);
+        if (ids[i] == NULL || json_object_get_value(set, ids[i]) != NULL
+            || json_object_set_null(set, ids[i]) != JSONSuccess) {
+            return JSONFailure;
+        }
+    }
+    return JSONSuccess;
+}
+
+/* Marks the longest run of kept elements that are already in the same relative order,
+   positions[k] is the current position of to element k or (size_t)-1 if it is new */
+static JSON_Status diff_mark_ordered(const size_t *positions, size_t count, parson_bool_t *stays) {
+    size_t *tails = (size_t*)parson_malloc((count + 1) * sizeof(size_t));
+    size_t *previous = (size_t*)parson_malloc((count + 1) * sizeof(size_t));
+    size_t k = 0, length = 0, low = 0, high = 0, middle = 0;
+    if (tails == NULL || previous == NULL) {
+        parson_free(tails);
+        parson_free(previous);
+        return JSONFailure;
+    }
+    for (k = 0; k < count; k++) {
+        stays[k] = PARSON_FALSE;
+        if (positions[k] == (size_t)-1) {
+            continue;
+        }
+        low = 0;
+        high = length;
+        while (low < high) {
+            middle = low + (high - low) / 2;
+            if (positions[tails[middle]] < positions[k]) {
+                low = middle + 1;
             } else {
-                APPEND_STRING("false");
+                high = middle;
             }
-            return written_total;
-        case JSONNumber:
-            num = json_value_get_number(value);
-            if (buf != NULL) {
-                num_buf = buf;
+        }
+        previous[k] = low > 0 ? tails[low - 1] : (size_t)-1;
+        tails[low] = k;
+        if (low == length) {
+            length++;
+        }
+    }
+    for (k = length > 0 ? tails[length - 1] : (size_t)-1; k != (size_t)-1; k = previous[k]) {
+        stays[k] = PARSON_TRUE;
+    }
+    parson_free(tails);
+    parson_free(previous);
+    return JSONSuccess;
+}
+
+/* Matches elements by id: elements missing from to are removed first (from the back,
+   so indexes stay valid), then to is built front to back by moving or adding elements.
+   Elements in the longest already ordered run stay where they are; an element that is
+   in the way of one is parked at the end until its own turn, so nothing moves more
+   than twice. Positions before the current one are final, so queued comparisons of
+   matched elements use the index they end up at. Leaves *matched unset if the arrays
+   can't be matched by id. */
+static JSON_Status diff_arrays_by_id(JSON_Diff *diff, const JSON_Diff_Frame *frame, parson_bool_t *matched) {
+    const JSON_Array *from = json_value_get_array(frame->from), *to = json_value_get_array(frame->to);
+    JSON_Value *from_set_value = json_value_init_object(), *to_set_value = json_value_init_object();
+    const JSON_Value **current = NULL, *moved = NULL;
+    char **from_ids = NULL, **to_ids = NULL, **current_ids = NULL, *moved_id = NULL;
+    char *path = NULL, *from_path = NULL;
+    size_t *positions = NULL;
+    parson_bool_t *stays = NULL;
+    size_t i = 0, j = 0, count = 0;
+    JSON_Status status = JSONFailure;
+    *matched = PARSON_FALSE;
+    from_ids = (char**)parson_malloc((from->count + 1) * sizeof(char*));
+    to_ids = (char**)parson_malloc((to->count + 1) * sizeof(char*));
+    current = (const JSON_Value**)parson_malloc((from->count + to->count + 1) * sizeof(JSON_Value*));
+    current_ids = (char**)parson_malloc((from->count + to->count + 1) * sizeof(char*));
+    positions = (size_t*)parson_malloc((to->count + 1) * sizeof(size_t));
+    stays = (parson_bool_t*)parson_malloc((to->count + 1) * sizeof(parson_bool_t));
+    if (from_set_value == NULL || to_set_value == NULL || from_ids == NULL || to_ids == NULL
+        || current == NULL || current_ids == NULL || positions == NULL || stays == NULL) {
+        goto end;
+    }
+    memset(from_ids, 0, (from->count + 1) * sizeof(char*));
+    memset(to_ids, 0, (to->count + 1) * sizeof(char*));
+    if (diff_collect_ids(from, diff->id_key, from_ids, json_value_get_object(from_set_value)) != JSONSuccess
+        || diff_collect_ids(to, diff->id_key, to_ids, json_value_get_object(to_set_value)) != JSONSuccess) {
+        status = JSONSuccess; /* not matchable, compared by index instead */
+        goto end;
+    }
+    *matched = PARSON_TRUE;
+    for (i = from->count; i > 0; i--) {
+        if (json_object_get_value(json_value_get_object(to_set_value), from_ids[i - 1]) == NULL) {
+            path = pointer_append_index(frame->path, i - 1);
+            if (path == NULL || diff_emit(diff, "remove", path, NULL, NULL) != JSONSuccess) {
+                goto end;
             }
-            if (parson_number_serialization_function) {
-                written = parson_number_serialization_function(num, num_buf);
-            } else {
-                const char *float_format = parson_float_format ? parson_float_format : PARSON_DEFAULT_FLOAT_FORMAT;
-                written = parson_sprintf(num_buf, float_format, num);
+            parson_free(path);
+            path = NULL;
+        }
+    }
+    for (i = 0; i < from->count; i++) {
+        if (json_object_get_value(json_value_get_object(to_set_value), from_ids[i]) != NULL) {
+            if (json_object_set_number(json_value_get_object(from_set_value), from_ids[i], (double)count) != JSONSuccess) {
+                goto end;
             }
-            if (written < 0) {
-                return -1;
+            current[count] = from->items[i];
+            current_ids[count] = from_ids[i];
+            count++;
+        }
+    }
+    for (i = 0; i < to->count; i++) {
+        positions[i] = json_object_get_value(json_value_get_object(from_set_value), to_ids[i]) != NULL ?
+            (size_t)json_object_get_number(json_value_get_object(from_set_value), to_ids[i]) : (size_t)-1;
+    }
+    if (diff_mark_ordered(positions, to->count, stays) != JSONSuccess) {
+        goto end;
+    }
+    for (i = 0; i < to->count; i++) {
+        for (j = i; j < count && strcmp(current_ids[j], to_ids[i]) != 0; j++);
+        while (j > i && j < count && stays[i]) { /* park the element in the way at the end */
+            moved = current[i];
+            moved_id = current_ids[i];
+            memmove(current + i, current + i + 1, (count - i - 1) * sizeof(JSON_Value*));
+            memmove(current_ids + i, current_ids + i + 1, (count - i - 1) * sizeof(char*));
+            current[count - 1] = moved;
+            current_ids[count - 1] = moved_id;
+            j--;
+            from_path = pointer_append_index(frame->path, i);
+            path = pointer_append(frame->path, "-", 1);
+            if (from_path == NULL || path == NULL || diff_emit(diff, "move", path, from_path, NULL) != JSONSuccess) {
+                goto end;
             }
-            if (buf != NULL) {
-                buf += written;
+            parson_free(from_path);
+            parson_free(path);
+            from_path = NULL;
+            path = NULL;
+        }
+        if (j == count) { /* new element */
+            memmove(current + i + 1, current + i, (count - i) * sizeof(JSON_Value*));
+            memmove(current_ids + i + 1, current_ids + i, (count - i) * sizeof(char*));
+            current[i] = to->items[i];
+            current_ids[i] = to_ids[i];
+            count++;
+            path = pointer_append_index(frame->path, i);
+            if (path == NULL || diff_emit(diff, "add", path, NULL, to->items[i]) != JSONSuccess) {
+                goto end;
             }
-            written_total += written;
-            return written_total;
-        case JSONNull:
-            APPEND_STRING("null");
-            return written_total;
-        case JSONError:
-            return -1;
-        default:
-            return -1;
+            parson_free(path);
+            path = NULL;
+            continue;
+        }
+        if (j > i) {
+            moved = current[j];
+            moved_id = current_ids[j];
+            memmove(current + i + 1, current + i, (j - i) * sizeof(JSON_Value*));
+            memmove(current_ids + i + 1, current_ids + i, (j - i) * sizeof(char*));
+            current[i] = moved;
+            current_ids[i] = moved_id;
+            from_path = pointer_append_index(frame->path, j);
+            path = pointer_append_index(frame->path, i);
+            if (from_path == NULL || path == NULL || diff_emit(diff, "move", path, from_path, NULL) != JSONSuccess) {
+                goto end;
+            }
+            parson_free(from_path);
+            parson_free(path);
+            from_path = NULL;
+            path = NULL;
+        }
+        if (diff_values(diff, current[i], to->items[i], pointer_append_index(frame->path, i)) != JSONSuccess) {
+            goto end;
+        }
     }
+    status = JSONSuccess;
+end:
+    for (i = 0; from_ids != NULL && i < from->count; i++) {
+        parson_free(from_ids[i]);
+    }
+    for (i = 0; to_ids != NULL && i < to->count; i++) {
+        parson_free(to_ids[i]);
+    }
+    parson_free(from_ids);
+    parson_free(to_ids);
+    parson_free(current);
+    parson_free(current_ids);
+    parson_free(positions);
+    parson_free(stays);
+    parson_free(path);
+    parson_free(from_path);
+    json_value_free(from_set_value);
+    json_value_free(to_set_value);
+    return status;
 }
 
-static int json_serialize_string(const char *string, size_t len, char *buf) {
+static JSON_Status diff_arrays(JSON_Diff *diff, const JSON_Diff_Frame *frame) {
+    const JSON_Array *from = json_value_get_array(frame->from), *to = json_value_get_array(frame->to);
+    parson_bool_t matched = PARSON_FALSE;
+    char *path = NULL;
     size_t i = 0;
-    char c = '\0';
-    int written = -1, written_total = 0;
-    APPEND_STRING("\"");
-    for (i = 0; i < len; i++) {
-        c = string[i];
-        switch (c) {
-            case '\"': APPEND_STRING("\\\""); break;
-            case '\\': APPEND_STRING("\\\\"); break;
-            case '\b': APPEND_STRING("\\b"); break;
-            case '\f': APPEND_STRING("\\f"); break;
-            case '\n': APPEND_STRING("\\n"); break;
-            case '\r': APPEND_STRING("\\r"); break;
-            case '\t': APPEND_STRING("\\t"); break;
-            case '\x00': APPEND_STRING("\\u0000"); break;
-            case '\x01': APPEND_STRING("\\u0001"); break;
-            case '\x02': APPEND_STRING("\\u0002"); break;
-            case '\x03': APPEND_STRING("\\u0003"); break;
-            case '\x04': APPEND_STRING("\\u0004"); break;
-            case '\x05': APPEND_STRING("\\u0005"); break;
-            case '\x06': APPEND_STRING("\\u0006"); break;
-            case '\x07': APPEND_STRING("\\u0007"); break;
-            /* '\x08' duplicate: '\b' */
-            /* '\x09' duplicate: '\t' */
-            /* '\x0a' duplicate: '\n' */
-            case '\x0b': APPEND_STRING("\\u000b"); break;
-            /* '\x0c' duplicate: '\f' */
-            /* '\x0d' duplicate: '\r' */
-            case '\x0e': APPEND_STRING("\\u000e"); break;
-            case '\x0f': APPEND_STRING("\\u000f"); break;
-            case '\x10': APPEND_STRING("\\u0010"); break;
-            case '\x11': APPEND_STRING("\\u0011"); break;
-            case '\x12': APPEND_STRING("\\u0012"); break;
-            case '\x13': APPEND_STRING("\\u0013"); break;
-            case '\x14': APPEND_STRING("\\u0014"); break;
-            case '\x15': APPEND_STRING("\\u0015"); break;
-            case '\x16': APPEND_STRING("\\u0016"); break;
-            case '\x17': APPEND_STRING("\\u0017"); break;
-            case '\x18': APPEND_STRING("\\u0018"); break;
-            case '\x19': APPEND_STRING("\\u0019"); break;
-            case '\x1a': APPEND_STRING("\\u001a"); break;
-            case '\x1b': APPEND_STRING("\\u001b"); break;
-            case '\x1c': APPEND_STRING("\\u001c"); break;
-            case '\x1d': APPEND_STRING("\\u001d"); break;
-            case '\x1e': APPEND_STRING("\\u001e"); break;
-            case '\x1f': APPEND_STRING("\\u001f"); break;
-            case '/':
-                if (parson_escape_slashes) {
-                    APPEND_STRING("\\/");  /* to make json embeddable in xml\/html */
-                } else {
-                    APPEND_STRING("/");
-                }
-                break;
-            default:
-                if (buf != NULL) {
-                    buf[0] = c;
-                    buf += 1;
-                }
-                written_total += 1;
-                break;
+    if (diff->id_key != NULL && (from->count > 0 || to->count > 0)) {
+        if (diff_arrays_by_id(diff, frame, &matched) != JSONSuccess) {
+            return JSONFailure;
+        }
+        if (matched) {
+            return JSONSuccess;
         }
     }
-    APPEND_STRING("\"");
-    return written_total;
+    for (i = from->count; i > to->count; i--) {
+        path = pointer_append_index(frame->path, i - 1);
+        if (path == NULL || diff_emit(diff, "remove", path, NULL, NULL) != JSONSuccess) {
+            parson_free(path);
+            return JSONFailure;
+        }
+        parson_free(path);
+    }
+    for (i = 0; i < to->count; i++) {
+        path = pointer_append_index(frame->path, i);
+        if (i < from->count) {
+            if (diff_values(diff, from->items[i], to->items[i], path) != JSONSuccess) {
+                return JSONFailure;
+            }
+            continue;
+        }
+        if (path == NULL || diff_emit(diff, "add", path, NULL, to->items[i]) != JSONSuccess) {
+            parson_free(path);
+            return JSONFailure;
+        }
+        parson_free(path);
+    }
+    return JSONSuccess;
 }
 
-#undef APPEND_STRING
-#undef APPEND_INDENT
-
-/* Parser API */
-JSON_Value * json_parse_file(const char *filename) {
-    char *file_contents = read_file(filename);
-    JSON_Value *output_value = NULL;
-    if (file_contents == NULL) {
+JSON_Value * json_diff(const JSON_Value *from, const JSON_Value *to, const char *id_key) {
+    JSON_Value *patch = NULL;
+    JSON_Diff diff;
+    JSON_Diff_Frame frame;
+    JSON_Status status = JSONSuccess;
+    char *root_path = NULL;
+    if (from == NULL || to == NULL || json_value_get_type(from) == JSONError || json_value_get_type(to) == JSONError) {
         return NULL;
     }
-    output_value = json_parse_string(file_contents);
-    parson_free(file_contents);
-    return output_value;
+    patch = json_value_init_array();
+    root_path = parson_strdup("");
+    memset(&diff, 0, sizeof(diff));
+    diff.patch = json_value_get_array(patch);
+    diff.id_key = id_key;
+    if (patch == NULL || diff_values(&diff, from, to, root_path) != JSONSuccess) {
+        json_value_free(patch);
+        return NULL;
+    }
+    while (diff.depth > 0 && status == JSONSuccess) {
+        frame = diff.frames[--diff.depth];
+        if (json_value_get_type(frame.from) == JSONObject) {
+            status = diff_objects(&diff, &frame);
+        } else {
+            status = diff_arrays(&diff, &frame);
+        }
+        parson_free(frame.path);
+    }
+    while (diff.depth > 0) {
+        parson_free(diff.frames[--diff.depth].path);
+    }
+    parson_free(diff.frames);
+    if (status != JSONSuccess) {
+        json_value_free(patch);
+        return NULL;
+    }
+    return patch;
 }
 
-JSON_Value * json_parse_file_with_comments(const char *filename) {
-    char *file_contents = read_file(filename);
-    JSON_Value *output_value = NULL;
-    if (file_contents == NULL) {
-        return NULL;
+/* Location of a JSON Pointer: the container holding it and its last reference token,
+   or no parent for the whole document */
+typedef struct json_pointer_target {
+    JSON_Value *parent;
+    char       *token; /* unescaped */
+    JSON_Value *value; /* NULL if nothing is there yet */
+} JSON_Pointer_Target;
+
+/* Parses an array index token, which has no sign or leading zeros */
+static parson_bool_t pointer_parse_index(const char *token, size_t *ix) {
+    size_t result = 0;
+    const char *c = token;
+    if (*c == '\0' || (*c == '0' && c[1] != '\0')) {
+        return PARSON_FALSE;
     }
-    output_value = json_parse_string_with_comments(file_contents);
-    parson_free(file_contents);
-    return output_value;
+    for (; *c != '\0'; c++) {
+        if (*c < '0' || *c > '9' || result > ((size_t)-1 - 9) / 10) {
+            return PARSON_FALSE;
+        }
+        result = result * 10 + (size_t)(*c - '0');
+    }
+    *ix = result;
+    return PARSON_TRUE;
 }
 
-JSON_Value * json_parse_string(const char *string) {
-    if (string == NULL) {
-        return NULL;
+static JSON_Value * pointer_child(const JSON_Value *container, const char *token) {
+    size_t ix = 0;
+    if (json_value_get_type(container) == JSONObject) {
+        return json_object_get_value(json_value_get_object(container), token);
     }
-    if (string[0] == '\xEF' && string[1] == '\xBB' && string[2] == '\xBF') {
-        string = string + 3; /* Support for UTF-8 BOM */
+    if (json_value_get_type(container) == JSONArray && pointer_parse_index(token, &ix)) {
+        return json_array_get_value(json_value_get_array(container), ix);
     }
-    return parse_value((const char**)&string, 0);
+    return NULL;
 }
 
-JSON_Value * json_parse_string_with_comments(const char *string) {
+static JSON_Status pointer_resolve(JSON_Value *root, const char *pointer, JSON_Pointer_Target *target) {
+    JSON_Value *current = root;
+    const char *c = pointer;
+    char *out = NULL;
+    target->parent = NULL;
+    target->token = NULL;
+    target->value = root;
+    if (pointer == NULL || (*pointer != '\0' && *pointer != '/')) {
+        return JSONFailure;
+    }
+    if (*pointer == '\0') {
+        return JSONSuccess;
+    }
+    target->token = (char*)parson_malloc(strlen(pointer) + 1);
+    if (target->token == NULL) {
+        return JSONFailure;
+    }
+    while (*c == '/') {
+        if (current == NULL) {
+            goto error; /* only the last reference token can be missing */
+        }
+        out = target->token;
+        for (c++; *c != '\0' && *c != '/'; c++) {
+            if (*c == '~') {
+                c++;
+                if (*c != '0' && *c != '1') {
+                    goto error;
+                }
+                *out++ = *c == '0' ? '~' : '/';
+            } else {
+                *out++ = *c;
+            }
+        }
+        *out = '\0';
+        if (json_value_get_type(current) != JSONObject && json_value_get_type(current) != JSONArray) {
+            goto error;
+        }
+        target->parent = current;
+        current = pointer_child(current, target->token);
+    }
+    target->value = current;
+    return JSONSuccess;
+error:
+    parson_free(target->token);
+    target->token = NULL;
+    return JSONFailure;
+}
+
+/* Adds value at target, taking ownership on success */
+static JSON_Status patch_add(JSON_Value **root, JSON_Pointer_Target *target, JSON_Value *value) {
+    JSON_Array *array = NULL;
+    size_t ix = 0;
+    if (target->parent == NULL) {
+        json_value_free(*root);
+        *root = value;
+        return JSONSuccess;
+    }
+    if (json_value_get_type(target->parent) == JSONObject) {
+        return json_object_set_value(json_value_get_object(target->parent), target->token, value);
+    }
+    array = json_value_get_array(target->parent);
+    if (strcmp(target->token, "-") == 0) {
+        return json_array_append_value(array, value);
+    }
+    if (!pointer_parse_index(target->token, &ix) || ix > array->count
+        || json_array_append_value(array, value) != JSONSuccess) {
+        return JSONFailure;
+    }
+    memmove(array->items + ix + 1, array->items + ix, (array->count - 1 - ix) * sizeof(JSON_Value*));
+    array->items[ix] = value;
+    return JSONSuccess;
+}
+
+/* Takes the value at target out of its container without freeing it */
+static JSON_Value * patch_detach(JSON_Pointer_Target *target) {
+    JSON_Value *value = target->value;
+    JSON_Array *array = NULL;
+    size_t ix = 0;
+    if (json_value_get_type(target->parent) == JSONObject) {
+        if (json_object_remove_internal(json_value_get_object(target->parent), target->token, PARSON_FALSE) != JSONSuccess) {
+            return NULL;
+        }
+    } else {
+        array = json_value_get_array(target->parent);
+        if (json_value_is_shared(target->parent) || !pointer_parse_index(target->token, &ix)) {
+            return NULL;
+        }
+        memmove(array->items + ix, array->items + ix + 1, (array->count - 1 - ix) * sizeof(JSON_Value*));
+        array->count--;
+    }
+    value->parent = NULL;
+    return value;
+}
+
+static JSON_Status patch_apply_operation(JSON_Value **root, const JSON_Object *operation) {
+    const char *op = json_object_get_string(operation, "op");
+    const char *path = json_object_get_string(operation, "path");
+    const char *from = json_object_get_string(operation, "from");
+    const JSON_Value *value = json_object_get_value(operation, "value");
+    JSON_Pointer_Target target, source;
+    JSON_Value *new_value = NULL;
+    JSON_Status status = JSONFailure;
+    size_t ix = 0, from_len = 0;
+    if (op == NULL || pointer_resolve(*root, path, &target) != JSONSuccess) {
+        return JSONFailure;
+    }
+    source.token = NULL;
+    if (strcmp(op, "add") == 0 || strcmp(op, "replace") == 0) {
+        if (value == NULL || (op[0] == 'r' && target.value == NULL)) {
+            goto end;
+        }
+        new_value = json_value_deep_copy(value);
+        if (new_value == NULL) {
+            goto end;
+        }
+        if (op[0] == 'r' && target.parent != NULL && json_value_get_type(target.parent) == JSONArray) {
+            pointer_parse_index(target.token, &ix);
+            status = json_array_replace_value(json_value_get_array(target.parent), ix, new_value);
+        } else {
+            status = patch_add(root, &target, new_value);
+        }
+    } else if (strcmp(op, "remove") == 0) {
+        if (target.value == NULL || target.parent == NULL) {
+            goto end;
+        }
+        new_value = patch_detach(&target);
+        status = new_value != NULL ? JSONSuccess : JSONFailure;
+        json_value_free(new_value);
+        new_value = NULL;
+    } else if (strcmp(op, "move") == 0 || strcmp(op, "copy") == 0) {
+        if (pointer_resolve(*root, from, &source) != JSONSuccess || source.value == NULL) {
+            goto end;
+        }
+        if (op[0] == 'c') {
+            new_value = json_value_deep_copy(source.value);
+        } else {
+            from_len = strlen(from);
+            if (strcmp(from, path) == 0) {
+                status = JSONSuccess;
+                goto end;
+            }
+            if (source.parent == NULL || (strncmp(from, path, from_len) == 0 && path[from_len] == '/')) {
+                goto end; /* can't move a value into itself */
+            }
+            new_value = patch_detach(&source);
+            /* the target's container is unaffected by the removal, but an index into the
+               same array has to be resolved again */
+            parson_free(target.token);
+            if (new_value == NULL || pointer_resolve(*root, path, &target) != JSONSuccess) {
+                target.token = NULL;
+                goto end;
+            }
+        }
+        if (new_value != NULL) {
+            status = patch_add(root, &target, new_value);
+        }
+    } else if (strcmp(op, "test") == 0) {
+        status = value != NULL && target.value != NULL && json_value_equals(target.value, value) ? JSONSuccess : JSONFailure;
+    }
+end:
+    if (status != JSONSuccess) {
+        json_value_free(new_value);
+    }
+    parson_free(target.token);
+    parson_free(source.token);
+    return status;
+}
+
+JSON_Value * json_patch_apply(const JSON_Value *value, const JSON_Value *patch) {
     JSON_Value *result = NULL;
-    char *string_mutable_copy = NULL, *string_mutable_copy_ptr = NULL;
-    string_mutable_copy = parson_strdup(string);
-    if (string_mutable_copy == NULL) {
+    const JSON_Array *operations = json_value_get_array(patch);
+    size_t i = 0;
+    if (value == NULL || operations == NULL) {
         return NULL;
     }
-    remove_comments(string_mutable_copy, "/*", "*/");
-    remove_comments(string_mutable_copy, "//", "\n");
-    string_mutable_copy_ptr = string_mutable_copy;
-    result = parse_value((const char**)&string_mutable_copy_ptr, 0);
-    parson_free(string_mutable_copy);
+    result = json_value_deep_copy(value);
+    if (result == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < json_array_get_count(operations); i++) {
+        if (patch_apply_operation(&result, json_array_get_object(operations, i)) != JSONSuccess) {
+            json_value_free(result);
+            return NULL;
+        }
+    }
     return result;
 }
 
@@ -1438,6 +4666,50 @@ int json_object_get_boolean(const JSON_Object *object, const char *name) {
     return json_value_get_boolean(json_object_get_value(object, name));
 }
 
+JSON_Key json_key_make(const char *name) {
+    JSON_Key key;
+    key.name = name;
+    key.len = name ? strlen(name) : 0;
+    key.hash = name ? hash_string(name, key.len) : 0;
+    return key;
+}
+
+JSON_Value * json_object_get_value_by_key(const JSON_Object *object, const JSON_Key *key) {
+    size_t item_ix = 0;
+    if (object == NULL || key == NULL || key->name == NULL) {
+        return NULL;
+    }
+    item_ix = json_object_find_item_with_hash(object, key->name, key->len, key->hash);
+    if (item_ix == OBJECT_INVALID_IX) {
+        return NULL;
+    }
+    return object->items[item_ix].value;
+}
+
+const char * json_object_get_string_by_key(const JSON_Object *object, const JSON_Key *key) {
+    return json_value_get_string(json_object_get_value_by_key(object, key));
+}
+
+size_t json_object_get_string_len_by_key(const JSON_Object *object, const JSON_Key *key) {
+    return json_value_get_string_len(json_object_get_value_by_key(object, key));
+}
+
+double json_object_get_number_by_key(const JSON_Object *object, const JSON_Key *key) {
+    return json_value_get_number(json_object_get_value_by_key(object, key));
+}
+
+JSON_Object * json_object_get_object_by_key(const JSON_Object *object, const JSON_Key *key) {
+    return json_value_get_object(json_object_get_value_by_key(object, key));
+}
+
+JSON_Array * json_object_get_array_by_key(const JSON_Object *object, const JSON_Key *key) {
+    return json_value_get_array(json_object_get_value_by_key(object, key));
+}
+
+int json_object_get_boolean_by_key(const JSON_Object *object, const JSON_Key *key) {
+    return json_value_get_boolean(json_object_get_value_by_key(object, key));
+}
+
 JSON_Value * json_object_dotget_value(const JSON_Object *object, const char *name) {
     const char *dot_position = strchr(name, '.');
     if (!dot_position) {
@@ -1479,14 +4751,14 @@ const char * json_object_get_name(const JSON_Object *object, size_t index) {
     if (object == NULL || index >= json_object_get_count(object)) {
         return NULL;
     }
-    return object->names[index];
+    return object->items[index].name;
 }
 
 JSON_Value * json_object_get_value_at(const JSON_Object *object, size_t index) {
     if (object == NULL || index >= json_object_get_count(object)) {
         return NULL;
     }
-    return object->values[index];
+    return object->items[index].value;
 }
 
 JSON_Value *json_object_get_wrapping_value(const JSON_Object *object) {
@@ -1596,21 +4868,102 @@ JSON_Value * json_value_get_parent (const JSON_Value *value) {
     return value ? value->parent : NULL;
 }
 
+/* Frees nested values without recursion: the last child of a container is detached
+   and descended into until a value without children is found, which is then freed.
+   Values that are still shared are only detached and dropping a shared reference
+   frees nothing. */
 void json_value_free(JSON_Value *value) {
-    switch (json_value_get_type(value)) {
-        case JSONObject:
-            json_object_free(value->value.object);
-            break;
-        case JSONString:
-            parson_free(value->value.string.chars);
-            break;
-        case JSONArray:
-            json_array_free(value->value.array);
-            break;
-        default:
-            break;
+    JSON_Value *current = value, *child = NULL, *parent = NULL;
+    JSON_Object *object = NULL;
+    JSON_Array *array = NULL;
+    if (value != NULL && value->refs > 0) {
+        value->refs--;
+        return;
+    }
+    while (current != NULL) {
+        child = NULL;
+        if (json_value_get_type(current) == JSONObject) {
+            object = current->value.object;
+            if (object->count > 0) {
+                object->count--;
+                parson_free(object->items[object->count].name);
+                child = object->items[object->count].value;
+            }
+        } else if (json_value_get_type(current) == JSONArray) {
+            array = current->value.array;
+            if (array->count > 0) {
+                array->count--;
+                child = array->items[array->count];
+            }
+        }
+        if (child != NULL && child->refs > 0) {
+            json_value_release(child);
+            continue;
+        }
+        if (child != NULL) {
+            child->parent = current;
+            current = child;
+            continue;
+        }
+        parent = current == value ? NULL : current->parent;
+        switch (json_value_get_type(current)) {
+            case JSONObject:
+                json_object_free(current->value.object);
+                break;
+            case JSONString:
+                parson_free(current->value.string.chars);
+                break;
+            case JSONArray:
+                json_array_free(current->value.array);
+                break;
+            default:
+                break;
+        }
+        parson_free(current);
+        current = parent;
+    }
+}
+
+/* Drops the reference a container holds on one of its values */
+static void json_value_release(JSON_Value *value) {
+    if (value != NULL && value->refs > 0) {
+        value->refs--;
+        value->parent = NULL; /* still referenced elsewhere */
+        return;
+    }
+    json_value_free(value);
+}
+
+JSON_Value * json_value_share(JSON_Value *value) {
+    if (value == NULL || value->refs == UINT_MAX) {
+        return NULL;
+    }
+    value->refs++;
+    return value;
+}
+
+int json_value_is_shared(const JSON_Value *value) {
+    for (; value != NULL; value = value->parent) {
+        if (value->refs > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+JSON_Value * json_value_unshare(JSON_Value *value) {
+    JSON_Value *copy = NULL;
+    if (value == NULL || !json_value_is_shared(value)) {
+        return value;
+    }
+    copy = json_value_deep_copy(value);
+    if (copy == NULL) {
+        return NULL;
+    }
+    if (value->refs > 0) {
+        value->refs--; /* caller's reference */
     }
-    parson_free(value);
+    return copy;
 }
 
 JSON_Value * json_value_init_object(void) {
@@ -1619,6 +4972,7 @@ JSON_Value * json_value_init_object(void) {
         return NULL;
     }
     new_value->parent = NULL;
+    new_value->refs = 0;
     new_value->type = JSONObject;
     new_value->value.object = json_object_make(new_value);
     if (!new_value->value.object) {
@@ -1634,6 +4988,7 @@ JSON_Value * json_value_init_array(void) {
         return NULL;
     }
     new_value->parent = NULL;
+    new_value->refs = 0;
     new_value->type = JSONArray;
     new_value->value.array = json_array_make(new_value);
     if (!new_value->value.array) {
@@ -1680,6 +5035,7 @@ JSON_Value * json_value_init_number(double number) {
         return NULL;
     }
     new_value->parent = NULL;
+    new_value->refs = 0;
     new_value->type = JSONNumber;
     new_value->value.number = number;
     return new_value;
@@ -1691,6 +5047,7 @@ JSON_Value * json_value_init_boolean(int boolean) {
         return NULL;
     }
     new_value->parent = NULL;
+    new_value->refs = 0;
     new_value->type = JSONBoolean;
     new_value->value.boolean = boolean ? 1 : 0;
     return new_value;
@@ -1702,73 +5059,56 @@ JSON_Value * json_value_init_null(void) {
         return NULL;
     }
     new_value->parent = NULL;
+    new_value->refs = 0;
     new_value->type = JSONNull;
     return new_value;
 }
 
-JSON_Value * json_value_deep_copy(const JSON_Value *value) {
-    size_t i = 0;
-    JSON_Value *return_value = NULL, *temp_value_copy = NULL, *temp_value = NULL;
+/* Containers walked side by side by json_value_deep_copy and json_value_equals */
+typedef struct json_walk_frame {
+    const JSON_Value *value;
+    const JSON_Value *other; /* the value compared with, for json_value_equals */
+    JSON_Value       *copy;  /* the copy being filled, for json_value_deep_copy */
+    size_t            index; /* next member */
+} JSON_Walk_Frame;
+
+static size_t json_value_get_member_count(const JSON_Value *value) {
+    switch (json_value_get_type(value)) {
+        case JSONObject:
+            return json_object_get_count(json_value_get_object(value));
+        case JSONArray:
+            return json_array_get_count(json_value_get_array(value));
+        default:
+            return 0;
+    }
+}
+
+static JSON_Status walk_push(JSON_Walk_Frame **frames, size_t *depth, size_t *capacity,
+                             const JSON_Value *value, const JSON_Value *other, JSON_Value *copy) {
+    JSON_Walk_Frame *new_frames = (JSON_Walk_Frame*)grow_array(*frames, *depth, capacity, sizeof(JSON_Walk_Frame));
+    if (new_frames == NULL) {
+        return JSONFailure;
+    }
+    *frames = new_frames;
+    new_frames[*depth].value = value;
+    new_frames[*depth].other = other;
+    new_frames[*depth].copy = copy;
+    new_frames[*depth].index = 0;
+    (*depth)++;
+    return JSONSuccess;
+}
+
+/* Copies a scalar, or makes an empty container of the same type */
+static JSON_Value * json_value_copy_node(const JSON_Value *value) {
     const JSON_String *temp_string = NULL;
-    const char *temp_key = NULL;
     char *temp_string_copy = NULL;
-    JSON_Array *temp_array = NULL, *temp_array_copy = NULL;
-    JSON_Object *temp_object = NULL, *temp_object_copy = NULL;
-    JSON_Status res = JSONFailure;
-    char *key_copy = NULL;
+    JSON_Value *return_value = NULL;
 
     switch (json_value_get_type(value)) {
         case JSONArray:
-            temp_array = json_value_get_array(value);
-            return_value = json_value_init_array();
-            if (return_value == NULL) {
-                return NULL;
-            }
-            temp_array_copy = json_value_get_array(return_value);
-            for (i = 0; i < json_array_get_count(temp_array); i++) {
-                temp_value = json_array_get_value(temp_array, i);
-                temp_value_copy = json_value_deep_copy(temp_value);
-                if (temp_value_copy == NULL) {
-                    json_value_free(return_value);
-                    return NULL;
-                }
-                if (json_array_add(temp_array_copy, temp_value_copy) != JSONSuccess) {
-                    json_value_free(return_value);
-                    json_value_free(temp_value_copy);
-                    return NULL;
-                }
-            }
-            return return_value;
+            return json_value_init_array();
         case JSONObject:
-            temp_object = json_value_get_object(value);
-            return_value = json_value_init_object();
-            if (!return_value) {
-                return NULL;
-            }
-            temp_object_copy = json_value_get_object(return_value);
-            for (i = 0; i < json_object_get_count(temp_object); i++) {
-                temp_key = json_object_get_name(temp_object, i);
-                temp_value = json_object_get_value(temp_object, temp_key);
-                temp_value_copy = json_value_deep_copy(temp_value);
-                if (!temp_value_copy) {
-                    json_value_free(return_value);
-                    return NULL;
-                }
-                key_copy = parson_strdup(temp_key);
-                if (!key_copy) {
-                    json_value_free(temp_value_copy);
-                    json_value_free(return_value);
-                    return NULL;
-                }
-                res = json_object_add(temp_object_copy, key_copy, temp_value_copy);
-                if (res != JSONSuccess) {
-                    parson_free(key_copy);
-                    json_value_free(temp_value_copy);
-                    json_value_free(return_value);
-                    return NULL;
-                }
-            }
-            return return_value;
+            return json_value_init_object();
         case JSONBoolean:
             return json_value_init_boolean(json_value_get_boolean(value));
         case JSONNumber:
@@ -1796,124 +5136,210 @@ JSON_Value * json_value_deep_copy(const JSON_Value *value) {
     }
 }
 
-size_t json_serialization_size(const JSON_Value *value) {
-    char num_buf[PARSON_NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, PARSON_FALSE, num_buf);
-    return res < 0 ? 0 : (size_t)(res) + 1;
-}
+/* Copies without recursion: the containers being copied are kept on an explicit
+   stack, so any tree the parser accepts can be copied. */
+JSON_Value * json_value_deep_copy(const JSON_Value *value) {
+    JSON_Walk_Frame *frames = NULL, *frame = NULL;
+    size_t depth = 0, capacity = 0;
+    JSON_Value *root = NULL, *copy = NULL;
+    const char *key = NULL;
+    char *key_copy = NULL;
 
-JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes) {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
-        return JSONFailure;
+    while (PARSON_TRUE) {
+        copy = json_value_copy_node(value);
+        if (copy == NULL) {
+            goto error;
+        }
+        if (depth == 0) {
+            root = copy;
+        } else if (json_value_get_type(frame->copy) == JSONObject) {
+            key = json_object_get_name(json_value_get_object(frame->value), frame->index - 1);
+            key_copy = parson_strdup(key);
+            if (key_copy == NULL || json_object_add(json_value_get_object(frame->copy), key_copy, copy) != JSONSuccess) {
+                parson_free(key_copy);
+                json_value_free(copy);
+                goto error;
+            }
+        } else if (json_array_add(json_value_get_array(frame->copy), copy) != JSONSuccess) {
+            json_value_free(copy);
+            goto error;
+        }
+        if (json_value_get_member_count(value) > 0
+            && walk_push(&frames, &depth, &capacity, value, NULL, copy) != JSONSuccess) {
+            goto error;
+        }
+        /* find the next value to copy, closing finished containers */
+        value = NULL;
+        while (depth > 0 && value == NULL) {
+            frame = &frames[depth - 1];
+            if (frame->index == json_value_get_member_count(frame->value)) {
+                depth--;
+            } else if (json_value_get_type(frame->value) == JSONObject) {
+                value = json_object_get_value_at(json_value_get_object(frame->value), frame->index++);
+            } else {
+                value = json_array_get_value(json_value_get_array(frame->value), frame->index++);
+            }
+        }
+        if (value == NULL) {
+            break;
+        }
     }
-    written = json_serialize_to_buffer_r(value, buf, 0, PARSON_FALSE, NULL);
-    if (written < 0) {
-        return JSONFailure;
+    parson_free(frames);
+    return root;
+error:
+    parson_free(frames);
+    json_value_free(root);
+    return NULL;
+}
+
+static JSON_Status json_serialize_to_output(const JSON_Value *value, JSON_Output *output, parson_bool_t is_pretty) {
+    char num_buf[PARSON_NUM_BUF_SIZE];
+    JSON_Serialize_Stack stack;
+    JSON_Status status = JSONFailure;
+    stack.frames = stack.local;
+    stack.depth = 0;
+    stack.capacity = SERIALIZE_STACK_SIZE;
+    status = json_serialize_value(value, output, is_pretty, num_buf, &stack);
+    if (stack.frames != stack.local) {
+        parson_free(stack.frames);
     }
-    return JSONSuccess;
+    return status;
 }
 
-JSON_Status json_serialize_to_file(const JSON_Value *value, const char *filename) {
-    JSON_Status return_code = JSONSuccess;
-    FILE *fp = NULL;
-    char *serialized_string = json_serialize_to_string(value);
-    if (serialized_string == NULL) {
-        return JSONFailure;
+static size_t json_serialization_size_internal(const JSON_Value *value, parson_bool_t is_pretty) {
+    JSON_Output output = { NULL, 0, 0, PARSON_FALSE, NULL, NULL };
+    if (json_serialize_to_output(value, &output, is_pretty) != JSONSuccess) {
+        return 0;
     }
-    fp = fopen(filename, "w");
-    if (fp == NULL) {
-        json_free_serialized_string(serialized_string);
+    return output.len + 1;
+}
+
+static JSON_Status json_serialize_to_buffer_internal(const JSON_Value *value, char *buf, size_t buf_size_in_bytes, parson_bool_t is_pretty) {
+    JSON_Output output = { NULL, 0, 0, PARSON_FALSE, NULL, NULL };
+    size_t needed_size_in_bytes = json_serialization_size_internal(value, is_pretty);
+    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
         return JSONFailure;
     }
-    if (fputs(serialized_string, fp) == EOF) {
-        return_code = JSONFailure;
-    }
-    if (fclose(fp) == EOF) {
-        return_code = JSONFailure;
-    }
-    json_free_serialized_string(serialized_string);
-    return return_code;
+    output.buf = buf;
+    output.capacity = buf_size_in_bytes;
+    return json_serialize_to_output(value, &output, is_pretty);
 }
 
-char * json_serialize_to_string(const JSON_Value *value) {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
-    }
-    buf = (char*)parson_malloc(buf_size_bytes);
-    if (buf == NULL) {
+/* Serializes in a single pass into a buffer that grows as needed */
+static char * json_serialize_to_string_internal(const JSON_Value *value, parson_bool_t is_pretty, size_t *out_len) {
+    JSON_Output output = { NULL, 0, 0, PARSON_TRUE, NULL, NULL };
+    if (json_serialize_to_output(value, &output, is_pretty) != JSONSuccess
+        || output_reserve(&output, 0) != JSONSuccess) {
+        parson_free(output.buf);
         return NULL;
     }
-    serialization_result = json_serialize_to_buffer(value, buf, buf_size_bytes);
-    if (serialization_result != JSONSuccess) {
-        json_free_serialized_string(buf);
-        return NULL;
+    output.buf[output.len] = '\0';
+    if (out_len != NULL) {
+        *out_len = output.len;
     }
-    return buf;
-}
-
-size_t json_serialization_size_pretty(const JSON_Value *value) {
-    char num_buf[PARSON_NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, PARSON_TRUE, num_buf);
-    return res < 0 ? 0 : (size_t)(res) + 1;
+    return output.buf;
 }
 
-JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf, size_t buf_size_in_bytes) {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size_pretty(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
+static JSON_Status json_serialize_to_sink_internal(const JSON_Value *value, JSON_Write_Function write, void *context, parson_bool_t is_pretty) {
+    char sink_buf[PARSON_SINK_BUF_SIZE];
+    JSON_Output output = { NULL, 0, 0, PARSON_FALSE, NULL, NULL };
+    if (write == NULL) {
         return JSONFailure;
     }
-    written = json_serialize_to_buffer_r(value, buf, 0, PARSON_TRUE, NULL);
-    if (written < 0) {
+    output.buf = sink_buf;
+    output.capacity = sizeof(sink_buf);
+    output.write = write;
+    output.write_context = context;
+    if (json_serialize_to_output(value, &output, is_pretty) != JSONSuccess) {
         return JSONFailure;
     }
-    return JSONSuccess;
+    return output_flush(&output);
 }
 
-JSON_Status json_serialize_to_file_pretty(const JSON_Value *value, const char *filename) {
+static JSON_Status file_write(void *context, const char *data, size_t len) {
+    return fwrite(data, 1, len, (FILE*)context) == len ? JSONSuccess : JSONFailure;
+}
+
+/* Writes to filename.tmp and renames it over filename once complete, so a failure
+   half way leaves the previous file untouched */
+static JSON_Status json_serialize_to_file_internal(const JSON_Value *value, const char *filename, parson_bool_t is_pretty) {
     JSON_Status return_code = JSONSuccess;
     FILE *fp = NULL;
-    char *serialized_string = json_serialize_to_string_pretty(value);
-    if (serialized_string == NULL) {
+    size_t filename_len = 0;
+    char *temp_filename = NULL;
+    if (json_value_get_type(value) == JSONError || filename == NULL) {
+        return JSONFailure;
+    }
+    filename_len = strlen(filename);
+    temp_filename = (char*)parson_malloc(filename_len + SIZEOF_TOKEN(".tmp") + 1);
+    if (temp_filename == NULL) {
         return JSONFailure;
     }
-    fp = fopen(filename, "w");
+    memcpy(temp_filename, filename, filename_len);
+    memcpy(temp_filename + filename_len, ".tmp", SIZEOF_TOKEN(".tmp") + 1);
+    fp = fopen(temp_filename, "w");
     if (fp == NULL) {
-        json_free_serialized_string(serialized_string);
+        parson_free(temp_filename);
         return JSONFailure;
     }
-    if (fputs(serialized_string, fp) == EOF) {
+    return_code = json_serialize_to_sink_internal(value, file_write, fp, is_pretty);
+    if (fclose(fp) == EOF) {
         return_code = JSONFailure;
     }
-    if (fclose(fp) == EOF) {
+    if (return_code != JSONSuccess || rename(temp_filename, filename) != 0) {
+        remove(temp_filename);
         return_code = JSONFailure;
     }
-    json_free_serialized_string(serialized_string);
+    parson_free(temp_filename);
     return return_code;
 }
 
+size_t json_serialization_size(const JSON_Value *value) {
+    return json_serialization_size_internal(value, PARSON_FALSE);
+}
+
+JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes) {
+    return json_serialize_to_buffer_internal(value, buf, buf_size_in_bytes, PARSON_FALSE);
+}
+
+JSON_Status json_serialize_to_file(const JSON_Value *value, const char *filename) {
+    return json_serialize_to_file_internal(value, filename, PARSON_FALSE);
+}
+
+char * json_serialize_to_string(const JSON_Value *value) {
+    return json_serialize_to_string_internal(value, PARSON_FALSE, NULL);
+}
+
+char * json_serialize_to_string_with_len(const JSON_Value *value, size_t *len) {
+    return json_serialize_to_string_internal(value, PARSON_FALSE, len);
+}
+
+size_t json_serialization_size_pretty(const JSON_Value *value) {
+    return json_serialization_size_internal(value, PARSON_TRUE);
+}
+
+JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf, size_t buf_size_in_bytes) {
+    return json_serialize_to_buffer_internal(value, buf, buf_size_in_bytes, PARSON_TRUE);
+}
+
+JSON_Status json_serialize_to_file_pretty(const JSON_Value *value, const char *filename) {
+    return json_serialize_to_file_internal(value, filename, PARSON_TRUE);
+}
+
 char * json_serialize_to_string_pretty(const JSON_Value *value) {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size_pretty(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
-    }
-    buf = (char*)parson_malloc(buf_size_bytes);
-    if (buf == NULL) {
-        return NULL;
-    }
-    serialization_result = json_serialize_to_buffer_pretty(value, buf, buf_size_bytes);
-    if (serialization_result != JSONSuccess) {
-        json_free_serialized_string(buf);
-        return NULL;
-    }
-    return buf;
+    return json_serialize_to_string_internal(value, PARSON_TRUE, NULL);
+}
+
+char * json_serialize_to_string_pretty_with_len(const JSON_Value *value, size_t *len) {
+    return json_serialize_to_string_internal(value, PARSON_TRUE, len);
+}
+
+JSON_Status json_serialize_to_sink(const JSON_Value *value, JSON_Write_Function write, void *context) {
+    return json_serialize_to_sink_internal(value, write, context, PARSON_FALSE);
+}
+
+JSON_Status json_serialize_to_sink_pretty(const JSON_Value *value, JSON_Write_Function write, void *context) {
+    return json_serialize_to_sink_internal(value, write, context, PARSON_TRUE);
 }
 
 void json_free_serialized_string(char *string) {
@@ -1922,10 +5348,11 @@ void json_free_serialized_string(char *string) {
 
 JSON_Status json_array_remove(JSON_Array *array, size_t ix) {
     size_t to_move_bytes = 0;
-    if (array == NULL || ix >= json_array_get_count(array)) {
+    if (array == NULL || ix >= json_array_get_count(array)
+        || json_value_is_shared(json_array_get_wrapping_value(array))) {
         return JSONFailure;
     }
-    json_value_free(json_array_get_value(array, ix));
+    json_value_release(json_array_get_value(array, ix));
     to_move_bytes = (json_array_get_count(array) - 1 - ix) * sizeof(JSON_Value*);
     memmove(array->items + ix, array->items + ix + 1, to_move_bytes);
     array->count -= 1;
@@ -1933,10 +5360,11 @@ JSON_Status json_array_remove(JSON_Array *array, size_t ix) {
 }
 
 JSON_Status json_array_replace_value(JSON_Array *array, size_t ix, JSON_Value *value) {
-    if (array == NULL || value == NULL || value->parent != NULL || ix >= json_array_get_count(array)) {
+    if (array == NULL || value == NULL || value->parent != NULL || ix >= json_array_get_count(array)
+        || json_value_is_shared(json_array_get_wrapping_value(array))) {
         return JSONFailure;
     }
-    json_value_free(json_array_get_value(array, ix));
+    json_value_release(json_array_get_value(array, ix));
     value->parent = json_array_get_wrapping_value(array);
     array->items[ix] = value;
     return JSONSuccess;
@@ -2004,18 +5432,19 @@ JSON_Status json_array_replace_null(JSON_Array *array, size_t i) {
 
 JSON_Status json_array_clear(JSON_Array *array) {
     size_t i = 0;
-    if (array == NULL) {
+    if (array == NULL || json_value_is_shared(json_array_get_wrapping_value(array))) {
         return JSONFailure;
     }
     for (i = 0; i < json_array_get_count(array); i++) {
-        json_value_free(json_array_get_value(array, i));
+        json_value_release(json_array_get_value(array, i));
     }
     array->count = 0;
     return JSONSuccess;
 }
 
 JSON_Status json_array_append_value(JSON_Array *array, JSON_Value *value) {
-    if (array == NULL || value == NULL || value->parent != NULL) {
+    if (array == NULL || value == NULL || value->parent != NULL
+        || json_value_is_shared(json_array_get_wrapping_value(array))) {
         return JSONFailure;
     }
     return json_array_add(array, value);
@@ -2082,45 +5511,30 @@ JSON_Status json_array_append_null(JSON_Array *array) {
 }
 
 JSON_Status json_object_set_value(JSON_Object *object, const char *name, JSON_Value *value) {
-    unsigned long hash = 0;
-    parson_bool_t found = PARSON_FALSE;
-    size_t cell_ix = 0;
+    size_t name_len = 0;
     size_t item_ix = 0;
-    JSON_Value *old_value = NULL;
     char *key_copy = NULL;
 
-    if (!object || !name || !value || value->parent) {
+    if (!object || !name || !value || value->parent
+        || json_value_is_shared(json_object_get_wrapping_value(object))) {
         return JSONFailure;
     }
-    hash = hash_string(name, strlen(name));
-    found = PARSON_FALSE;
-    cell_ix = json_object_get_cell_ix(object, name, strlen(name), hash, &found);
-    if (found) {
-        item_ix = object->cells[cell_ix];
-        old_value = object->values[item_ix];
-        json_value_free(old_value);
-        object->values[item_ix] = value;
+    name_len = strlen(name);
+    item_ix = json_object_find_item(object, name, name_len);
+    if (item_ix != OBJECT_INVALID_IX) {
+        json_value_release(object->items[item_ix].value);
+        object->items[item_ix].value = value;
         value->parent = json_object_get_wrapping_value(object);
         return JSONSuccess;
     }
-    if (object->count >= object->item_capacity) {
-        JSON_Status res = json_object_grow_and_rehash(object);
-        if (res != JSONSuccess) {
-            return JSONFailure;
-        }
-        cell_ix = json_object_get_cell_ix(object, name, strlen(name), hash, &found);
-    }
-    key_copy = parson_strdup(name);
+    key_copy = parson_strndup(name, name_len);
     if (!key_copy) {
         return JSONFailure;
     }
-    object->names[object->count] = key_copy;
-    object->cells[cell_ix] = object->count;
-    object->values[object->count] = value;
-    object->cell_ixs[object->count] = cell_ix;
-    object->hashes[object->count] = hash;
-    object->count++;
-    value->parent = json_object_get_wrapping_value(object);
+    if (json_object_append_item(object, key_copy, name_len, value) != JSONSuccess) {
+        parson_free(key_copy);
+        return JSONFailure;
+    }
     return JSONSuccess;
 }
 
@@ -2177,7 +5591,8 @@ JSON_Status json_object_dotset_value(JSON_Object *object, const char *name, JSON
     size_t name_len = 0;
     char *name_copy = NULL;
     
-    if (object == NULL || name == NULL || value == NULL) {
+    if (object == NULL || name == NULL || value == NULL
+        || json_value_is_shared(json_object_get_wrapping_value(object))) {
         return JSONFailure;
     }
     dot_pos = strchr(name, '.');
@@ -2290,15 +5705,15 @@ JSON_Status json_object_dotremove(JSON_Object *object, const char *name) {
 
 JSON_Status json_object_clear(JSON_Object *object) {
     size_t i = 0;
-    if (object == NULL) {
+    if (object == NULL || json_value_is_shared(json_object_get_wrapping_value(object))) {
         return JSONFailure;
     }
     for (i = 0; i < json_object_get_count(object); i++) {
-        parson_free(object->names[i]);
-        object->names[i] = NULL;
+        parson_free(object->items[i].name);
+        object->items[i].name = NULL;
         
-        json_value_free(object->values[i]);
-        object->values[i] = NULL;
+        json_value_release(object->items[i].value);
+        object->items[i].value = NULL;
     }
     object->count = 0;
     for (i = 0; i < object->cell_capacity; i++) {
@@ -2307,72 +5722,234 @@ JSON_Status json_object_clear(JSON_Object *object) {
     return JSONSuccess;
 }
 
+/* Compiled schema: the schema tree flattened in preorder, so the ops of a container's
+   members directly follow the container op and each op knows where its subtree ends */
+typedef struct json_schema_op {
+    JSON_Value_Type type;  /* JSONNull accepts any value */
+    size_t          count; /* object: members to check, array: 1 if elements are checked */
+    size_t          next;  /* op following this op's subtree */
+    JSON_Key        key;   /* member name when the parent op is an object, owned by the schema */
+} JSON_Schema_Op;
+
+struct json_schema_t {
+    JSON_Schema_Op *ops;
+    size_t          count;
+    size_t          max_depth; /* containers open at once during validation */
+};
+
+typedef struct json_schema_frame {
+    size_t            op;
+    const JSON_Value *value;     /* compiling: schema container, validating: tested container */
+    size_t            next;      /* next member op or element index */
+    size_t            remaining; /* members left to check */
+} JSON_Schema_Frame;
+
+#define SCHEMA_STACK_SIZE 32
+
+/* Appends the op checking schema_value, named name when it's an object member */
+static JSON_Status schema_emit(JSON_Schema *schema, size_t *capacity, const JSON_Value *schema_value,
+                               const char *name, size_t name_len) {
+    JSON_Schema_Op *op = NULL;
+    JSON_Schema_Op *new_ops = (JSON_Schema_Op*)grow_array(schema->ops, schema->count, capacity, sizeof(JSON_Schema_Op));
+    if (new_ops == NULL) {
+        return JSONFailure;
+    }
+    schema->ops = new_ops;
+    op = &schema->ops[schema->count];
+    op->type = json_value_get_type(schema_value);
+    op->count = 0;
+    op->next = schema->count + 1;
+    op->key.name = NULL;
+    op->key.len = 0;
+    op->key.hash = 0;
+    if (name != NULL) {
+        op->key.name = parson_strndup(name, name_len);
+        if (op->key.name == NULL) {
+            return JSONFailure;
+        }
+        op->key.len = name_len;
+        op->key.hash = hash_string(name, name_len);
+    }
+    if (op->type == JSONObject) {
+        op->count = json_object_get_count(json_value_get_object(schema_value));
+    } else if (op->type == JSONArray && json_array_get_count(json_value_get_array(schema_value)) > 0
+               && json_value_get_type(json_array_get_value(json_value_get_array(schema_value), 0)) != JSONNull) {
+        op->count = 1; /* only the first value is checked, null allows everything */
+    }
+    schema->count++;
+    return JSONSuccess;
+}
+
+/* Runs a compiled schema, which checks values without recursion */
 JSON_Status json_validate(const JSON_Value *schema, const JSON_Value *value) {
-    JSON_Value *temp_schema_value = NULL, *temp_value = NULL;
-    JSON_Array *schema_array = NULL, *value_array = NULL;
-    JSON_Object *schema_object = NULL, *value_object = NULL;
-    JSON_Value_Type schema_type = JSONError, value_type = JSONError;
-    const char *key = NULL;
-    size_t i = 0, count = 0;
+    JSON_Schema *compiled = NULL;
+    JSON_Status status = JSONFailure;
     if (schema == NULL || value == NULL) {
         return JSONFailure;
     }
-    schema_type = json_value_get_type(schema);
-    value_type = json_value_get_type(value);
-    if (schema_type != value_type && schema_type != JSONNull) { /* null represents all values */
+    compiled = json_schema_compile(schema);
+    if (compiled == NULL) {
         return JSONFailure;
     }
-    switch (schema_type) {
-        case JSONArray:
-            schema_array = json_value_get_array(schema);
-            value_array = json_value_get_array(value);
-            count = json_array_get_count(schema_array);
-            if (count == 0) {
-                return JSONSuccess; /* Empty array allows all types */
-            }
-            /* Get first value from array, rest is ignored */
-            temp_schema_value = json_array_get_value(schema_array, 0);
-            for (i = 0; i < json_array_get_count(value_array); i++) {
-                temp_value = json_array_get_value(value_array, i);
-                if (json_validate(temp_schema_value, temp_value) != JSONSuccess) {
-                    return JSONFailure;
+    status = json_schema_validate(compiled, value);
+    json_schema_free(compiled);
+    return status;
+}
+
+JSON_Schema * json_schema_compile(const JSON_Value *schema_value) {
+    JSON_Schema *schema = NULL;
+    JSON_Schema_Frame *frames = NULL, *new_frames = NULL, *frame = NULL;
+    const JSON_Object *object = NULL;
+    const JSON_Value *child = NULL;
+    size_t ops_capacity = 0, frames_capacity = 0, depth = 0, op_ix = 0;
+    if (schema_value == NULL || json_value_get_type(schema_value) == JSONError) {
+        return NULL;
+    }
+    schema = (JSON_Schema*)parson_malloc(sizeof(JSON_Schema));
+    if (schema == NULL) {
+        return NULL;
+    }
+    memset(schema, 0, sizeof(JSON_Schema));
+    child = schema_value;
+    object = NULL;
+    while (PARSON_TRUE) {
+        op_ix = schema->count;
+        if (child != NULL) {
+            if (object != NULL) {
+                if (schema_emit(schema, &ops_capacity, child, object->items[frame->next].name,
+                                object->items[frame->next].name_len) != JSONSuccess) {
+                    goto fail;
                 }
+                frame->next++;
+            } else if (schema_emit(schema, &ops_capacity, child, NULL, 0) != JSONSuccess) {
+                goto fail;
             }
-            return JSONSuccess;
-        case JSONObject:
-            schema_object = json_value_get_object(schema);
-            value_object = json_value_get_object(value);
-            count = json_object_get_count(schema_object);
-            if (count == 0) {
-                return JSONSuccess; /* Empty object allows all objects */
-            } else if (json_object_get_count(value_object) < count) {
-                return JSONFailure; /* Tested object mustn't have less name-value pairs than schema */
-            }
-            for (i = 0; i < count; i++) {
-                key = json_object_get_name(schema_object, i);
-                temp_schema_value = json_object_get_value(schema_object, key);
-                temp_value = json_object_get_value(value_object, key);
-                if (temp_value == NULL) {
-                    return JSONFailure;
-                }
-                if (json_validate(temp_schema_value, temp_value) != JSONSuccess) {
-                    return JSONFailure;
+            if (schema->ops[op_ix].count > 0) {
+                new_frames = (JSON_Schema_Frame*)grow_array(frames, depth, &frames_capacity, sizeof(JSON_Schema_Frame));
+                if (new_frames == NULL) {
+                    goto fail;
                 }
+                frames = new_frames;
+                frames[depth].op = op_ix;
+                frames[depth].value = child;
+                frames[depth].next = 0;
+                depth++;
+                schema->max_depth = MAX(schema->max_depth, depth);
             }
-            return JSONSuccess;
-        case JSONString: case JSONNumber: case JSONBoolean: case JSONNull:
-            return JSONSuccess; /* equality already tested before switch */
-        case JSONError: default:
+        }
+        if (depth == 0) {
+            break;
+        }
+        frame = &frames[depth - 1];
+        child = NULL;
+        object = NULL;
+        if (schema->ops[frame->op].type == JSONObject) {
+            if (frame->next < schema->ops[frame->op].count) {
+                object = json_value_get_object(frame->value);
+                child = object->items[frame->next].value;
+            }
+        } else if (frame->next == 0) {
+            child = json_array_get_value(json_value_get_array(frame->value), 0);
+            frame->next++;
+        }
+        if (child == NULL) {
+            schema->ops[frame->op].next = schema->count;
+            depth--;
+        }
+    }
+    parson_free(frames);
+    return schema;
+fail:
+    parson_free(frames);
+    json_schema_free(schema);
+    return NULL;
+}
+
+void json_schema_free(JSON_Schema *schema) {
+    size_t i = 0;
+    if (schema == NULL) {
+        return;
+    }
+    for (i = 0; i < schema->count; i++) {
+        parson_free((char*)schema->ops[i].key.name);
+    }
+    parson_free(schema->ops);
+    parson_free(schema);
+}
+
+/* Same rules as json_validate, in a single pass over the program */
+JSON_Status json_schema_validate(const JSON_Schema *schema, const JSON_Value *value) {
+    JSON_Schema_Frame local[SCHEMA_STACK_SIZE];
+    JSON_Schema_Frame *frames = local, *frame = NULL;
+    const JSON_Schema_Op *op = NULL;
+    JSON_Status status = JSONFailure;
+    size_t depth = 0, op_ix = 0;
+    if (schema == NULL || value == NULL) {
+        return JSONFailure;
+    }
+    if (schema->max_depth > SCHEMA_STACK_SIZE) {
+        frames = (JSON_Schema_Frame*)parson_malloc(schema->max_depth * sizeof(JSON_Schema_Frame));
+        if (frames == NULL) {
             return JSONFailure;
+        }
+    }
+    while (PARSON_TRUE) {
+        op = &schema->ops[op_ix];
+        if (op->type != JSONNull && op->type != json_value_get_type(value)) {
+            goto end;
+        }
+        if (op->count > 0 && op->type == JSONObject) {
+            if (json_object_get_count(json_value_get_object(value)) < op->count) {
+                goto end; /* tested object mustn't have less name-value pairs than schema */
+            }
+            frames[depth].op = op_ix;
+            frames[depth].value = value;
+            frames[depth].next = op_ix + 1;
+            frames[depth].remaining = op->count;
+            depth++;
+        } else if (op->count > 0 && op->type == JSONArray) {
+            frames[depth].op = op_ix;
+            frames[depth].value = value;
+            frames[depth].next = 0;
+            frames[depth].remaining = json_array_get_count(json_value_get_array(value));
+            depth++;
+        }
+        /* find the next value to check, closing finished containers */
+        value = NULL;
+        while (depth > 0 && value == NULL) {
+            frame = &frames[depth - 1];
+            if (frame->remaining == 0) {
+                depth--;
+            } else if (schema->ops[frame->op].type == JSONObject) {
+                op_ix = frame->next;
+                value = json_object_get_value_by_key(json_value_get_object(frame->value), &schema->ops[op_ix].key);
+                if (value == NULL) {
+                    goto end;
+                }
+                frame->next = schema->ops[op_ix].next;
+                frame->remaining--;
+            } else {
+                op_ix = frame->op + 1;
+                value = json_array_get_value(json_value_get_array(frame->value), frame->next);
+                frame->next++;
+                frame->remaining--;
+            }
+        }
+        if (value == NULL) {
+            status = JSONSuccess;
+            break;
+        }
+    }
+end:
+    if (frames != local) {
+        parson_free(frames);
     }
+    return status;
 }
 
-int json_value_equals(const JSON_Value *a, const JSON_Value *b) {
-    JSON_Object *a_object = NULL, *b_object = NULL;
-    JSON_Array *a_array = NULL, *b_array = NULL;
+/* Compares a scalar, or the type and member count of a container */
+static int json_value_equals_node(const JSON_Value *a, const JSON_Value *b) {
     const JSON_String *a_string = NULL, *b_string = NULL;
-    const char *key = NULL;
-    size_t a_count = 0, b_count = 0, i = 0;
     JSON_Value_Type a_type, b_type;
     a_type = json_value_get_type(a);
     b_type = json_value_get_type(b);
@@ -2381,36 +5958,8 @@ int json_value_equals(const JSON_Value *a, const JSON_Value *b) {
     }
     switch (a_type) {
         case JSONArray:
-            a_array = json_value_get_array(a);
-            b_array = json_value_get_array(b);
-            a_count = json_array_get_count(a_array);
-            b_count = json_array_get_count(b_array);
-            if (a_count != b_count) {
-                return PARSON_FALSE;
-            }
-            for (i = 0; i < a_count; i++) {
-                if (!json_value_equals(json_array_get_value(a_array, i),
-                                       json_array_get_value(b_array, i))) {
-                    return PARSON_FALSE;
-                }
-            }
-            return PARSON_TRUE;
         case JSONObject:
-            a_object = json_value_get_object(a);
-            b_object = json_value_get_object(b);
-            a_count = json_object_get_count(a_object);
-            b_count = json_object_get_count(b_object);
-            if (a_count != b_count) {
-                return PARSON_FALSE;
-            }
-            for (i = 0; i < a_count; i++) {
-                key = json_object_get_name(a_object, i);
-                if (!json_value_equals(json_object_get_value(a_object, key),
-                                       json_object_get_value(b_object, key))) {
-                    return PARSON_FALSE;
-                }
-            }
-            return PARSON_TRUE;
+            return json_value_get_member_count(a) == json_value_get_member_count(b);
         case JSONString:
             a_string = json_value_get_string_desc(a);
             b_string = json_value_get_string_desc(b);
@@ -2432,6 +5981,49 @@ int json_value_equals(const JSON_Value *a, const JSON_Value *b) {
     }
 }
 
+/* Compares without recursion, walking both trees with an explicit stack */
+int json_value_equals(const JSON_Value *a, const JSON_Value *b) {
+    JSON_Walk_Frame *frames = NULL, *frame = NULL;
+    size_t depth = 0, capacity = 0;
+    const JSON_Object *a_object = NULL;
+    int result = PARSON_TRUE;
+
+    while (PARSON_TRUE) {
+        if (!json_value_equals_node(a, b)) {
+            result = PARSON_FALSE;
+            break;
+        }
+        if (json_value_get_member_count(a) > 0
+            && walk_push(&frames, &depth, &capacity, a, b, NULL) != JSONSuccess) {
+            result = PARSON_FALSE; /* out of memory */
+            break;
+        }
+        /* find the next pair of values to compare, closing finished containers */
+        a = NULL;
+        while (depth > 0 && a == NULL) {
+            frame = &frames[depth - 1];
+            if (frame->index == json_value_get_member_count(frame->value)) {
+                depth--;
+            } else if (json_value_get_type(frame->value) == JSONObject) {
+                a_object = json_value_get_object(frame->value);
+                a = json_object_get_value_at(a_object, frame->index);
+                b = json_object_get_value(json_value_get_object(frame->other),
+                                          json_object_get_name(a_object, frame->index));
+                frame->index++;
+            } else {
+                a = json_array_get_value(json_value_get_array(frame->value), frame->index);
+                b = json_array_get_value(json_value_get_array(frame->other), frame->index);
+                frame->index++;
+            }
+        }
+        if (a == NULL) {
+            break;
+        }
+    }
+    parson_free(frames);
+    return result;
+}
+
 JSON_Value_Type json_type(const JSON_Value *value) {
     return json_value_get_type(value);
 }
@@ -2461,26 +6053,132 @@ int json_boolean(const JSON_Value *value) {
 }
 
 void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun) {
-    parson_malloc = malloc_fun;
-    parson_free = free_fun;
+    parson_default_context.malloc_fun = malloc_fun;
+    parson_default_context.free_fun = free_fun;
 }
 
 void json_set_escape_slashes(int escape_slashes) {
-    parson_escape_slashes = escape_slashes;
+    parson_default_context.escape_slashes = escape_slashes;
 }
 
-void json_set_float_serialization_format(const char *format) {
+static void context_set_float_format(JSON_Context *context, const char *format) {
+    JSON_Context *previous = json_context_use(context);
     if (parson_float_format) {
         parson_free(parson_float_format);
         parson_float_format = NULL;
     }
-    if (!format) {
-        parson_float_format = NULL;
-        return;
+    if (format) {
+        parson_float_format = parson_strdup(format);
     }
-    parson_float_format = parson_strdup(format);
+    json_context_use(previous);
+}
+
+void json_set_float_serialization_format(const char *format) {
+    context_set_float_format(&parson_default_context, format);
 }
 
 void json_set_number_serialization_function(JSON_Number_Serialization_Function func) {
-    parson_number_serialization_function = func;
+    parson_default_context.number_serialization_function = func;
+}
+
+JSON_Context * json_context_init(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun) {
+    JSON_Context *context = NULL;
+    if (malloc_fun == NULL || free_fun == NULL) {
+        malloc_fun = malloc;
+        free_fun = free;
+    }
+    context = (JSON_Context*)malloc_fun(sizeof(JSON_Context));
+    if (context == NULL) {
+        return NULL;
+    }
+    context->malloc_fun = malloc_fun;
+    context->free_fun = free_fun;
+    context->escape_slashes = 1;
+    context->float_format = NULL;
+    context->number_serialization_function = NULL;
+    return context;
+}
+
+void json_context_free(JSON_Context *context) {
+    if (context == NULL) {
+        return;
+    }
+    if (parson_current_context == context) {
+        parson_current_context = NULL;
+    }
+    if (context->float_format) {
+        context->free_fun(context->float_format);
+    }
+    context->free_fun(context);
+}
+
+void json_context_set_escape_slashes(JSON_Context *context, int escape_slashes) {
+    if (context) {
+        context->escape_slashes = escape_slashes;
+    }
+}
+
+void json_context_set_float_serialization_format(JSON_Context *context, const char *format) {
+    if (context) {
+        context_set_float_format(context, format);
+    }
+}
+
+void json_context_set_number_serialization_function(JSON_Context *context, JSON_Number_Serialization_Function func) {
+    if (context) {
+        context->number_serialization_function = func;
+    }
+}
+
+JSON_Context * json_context_use(JSON_Context *context) {
+    JSON_Context *previous = parson_current_context;
+    parson_current_context = context == &parson_default_context ? NULL : context;
+    return previous;
+}
+
+JSON_Value * json_parse_file_with_context(const char *filename, JSON_Context *context) {
+    JSON_Context *previous = json_context_use(context);
+    JSON_Value *result = json_parse_file(filename);
+    json_context_use(previous);
+    return result;
+}
+
+JSON_Value * json_parse_string_with_context(const char *string, JSON_Context *context) {
+    JSON_Context *previous = json_context_use(context);
+    JSON_Value *result = json_parse_string(string);
+    json_context_use(previous);
+    return result;
+}
+
+JSON_Value * json_parse_string_with_len_with_context(const char *string, size_t len, JSON_Context *context) {
+    JSON_Context *previous = json_context_use(context);
+    JSON_Value *result = json_parse_string_with_len(string, len);
+    json_context_use(previous);
+    return result;
+}
+
+char * json_serialize_to_string_with_context(const JSON_Value *value, JSON_Context *context) {
+    JSON_Context *previous = json_context_use(context);
+    char *result = json_serialize_to_string_internal(value, PARSON_FALSE, NULL);
+    json_context_use(previous);
+    return result;
+}
+
+char * json_serialize_to_string_pretty_with_context(const JSON_Value *value, JSON_Context *context) {
+    JSON_Context *previous = json_context_use(context);
+    char *result = json_serialize_to_string_internal(value, PARSON_TRUE, NULL);
+    json_context_use(previous);
+    return result;
+}
+
+void json_free_serialized_string_with_context(char *string, JSON_Context *context) {
+    JSON_Context *previous = json_context_use(context);
+    json_free_serialized_string(string);
+    json_context_use(previous);
+}
+
+void json_value_free_with_context(JSON_Value *value, JSON_Context *context) {
+    JSON_Context *previous = json_context_use(context);
+    json_value_free(value);
+    json_context_use(previous);
 }
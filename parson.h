@@ -78,19 +78,50 @@ typedef int (*JSON_Number_Serialization_Function)(double num, char *buf);
 void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun);
 
 /* Sets if slashes should be escaped or not when serializing JSON. By default slashes are escaped.
- This function sets a global setting and is not thread safe. */
+ This function sets a global setting and is not thread safe, use contexts (see below) instead. */
 void json_set_escape_slashes(int escape_slashes);
 
 /* Sets float format used for serialization of numbers.
    Make sure it can't serialize to a string longer than PARSON_NUM_BUF_SIZE.
-   If format is null then the default format is used. */
+   If format is null then the default serialization is used, which writes the
+   shortest representation that parses back to the same double. */
 void json_set_float_serialization_format(const char *format);
 
 /* Sets a function that will be used for serialization of numbers.
-   If function is null then the default serialization function is used. */
+   If function is null then the default serialization function is used
+   (shortest round-trip digits, with a direct path for integers). */
 void json_set_number_serialization_function(JSON_Number_Serialization_Function fun);
 
-/* Parses first JSON value in a file, returns NULL in case of error */
+/* Contexts
+   A context carries its own allocator and serialization settings, so threads can
+   parse and serialize with different arenas or settings. The functions above change
+   the default context, used by every thread that hasn't selected another one.
+   json_context_use selects a context for the calling thread (NULL selects the default
+   one) and returns the previously selected context; all parson functions then use it.
+   The *_with_context functions select context only for the duration of the call.
+   Values, and strings returned by serialization, have to be modified and freed
+   with the context they were allocated in. */
+typedef struct json_context_t JSON_Context;
+
+/* Starts with default settings, null functions mean malloc and free from stdlib */
+JSON_Context * json_context_init(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun);
+void           json_context_free(JSON_Context *context);
+void           json_context_set_escape_slashes(JSON_Context *context, int escape_slashes);
+void           json_context_set_float_serialization_format(JSON_Context *context, const char *format);
+void           json_context_set_number_serialization_function(JSON_Context *context, JSON_Number_Serialization_Function fun);
+JSON_Context * json_context_use(JSON_Context *context);
+
+JSON_Value * json_parse_file_with_context(const char *filename, JSON_Context *context);
+JSON_Value * json_parse_string_with_context(const char *string, JSON_Context *context);
+JSON_Value * json_parse_string_with_len_with_context(const char *string, size_t len, JSON_Context *context);
+char *       json_serialize_to_string_with_context(const JSON_Value *value, JSON_Context *context);
+char *       json_serialize_to_string_pretty_with_context(const JSON_Value *value, JSON_Context *context);
+void         json_free_serialized_string_with_context(char *string, JSON_Context *context);
+void         json_value_free_with_context(JSON_Value *value, JSON_Context *context);
+
+/* Parses first JSON value in a file, returns NULL in case of error.
+   On POSIX systems the file is memory mapped rather than copied to the heap
+   (define PARSON_NO_MMAP to always read it into a buffer). */
 JSON_Value * json_parse_file(const char *filename);
 
 /* Parses first JSON value in a file and ignores comments (/ * * / and //),
@@ -100,24 +131,96 @@ JSON_Value * json_parse_file_with_comments(const char *filename);
 /*  Parses first JSON value in a string, returns NULL in case of error */
 JSON_Value * json_parse_string(const char *string);
 
+/*  Parses first JSON value in the first len bytes of a string, which doesn't have to be
+    NUL terminated (e.g. a slice of a larger buffer). Returns NULL in case of error.
+    Inputs of PARSON_INDEX_MIN_LENGTH bytes or more (4096 by default) are indexed in a
+    separate pass first, which lets the parser skip whitespace and strings in bulk. */
+JSON_Value * json_parse_string_with_len(const char *string, size_t len);
+
 /*  Parses first JSON value in a string and ignores comments (/ * * / and //),
     returns NULL in case of error */
 JSON_Value * json_parse_string_with_comments(const char *string);
 
-/* Serialization */
+/* Streaming (event based) parsing
+   Input is fed in chunks of any size and every value is reported through callbacks
+   as soon as it's complete, without building JSON_Value trees. Memory use is bounded
+   by nesting depth and the longest single string or number, not by document size.
+   String and key pointers passed to callbacks are only valid during the call;
+   they are NUL terminated but may contain \0 from escapes (use len).
+   Any callback can be NULL; returning JSONFailure from a callback aborts parsing.
+   Like json_parse_string, content after the first complete value is ignored. */
+typedef struct json_stream_parser_t JSON_Stream_Parser;
+
+typedef struct json_stream_callbacks_t {
+    JSON_Status (*begin_object)(void *context);
+    JSON_Status (*end_object)  (void *context);
+    JSON_Status (*begin_array) (void *context);
+    JSON_Status (*end_array)   (void *context);
+    JSON_Status (*key)         (void *context, const char *name, size_t len);
+    JSON_Status (*string)      (void *context, const char *string, size_t len);
+    JSON_Status (*number)      (void *context, double number);
+    JSON_Status (*boolean)     (void *context, int boolean);
+    JSON_Status (*null)        (void *context);
+} JSON_Stream_Callbacks;
+
+JSON_Stream_Parser * json_stream_parser_init(const JSON_Stream_Callbacks *callbacks, void *context);
+/* Returns JSONFailure on malformed input or aborting callback, parser can't be fed afterwards */
+JSON_Status json_stream_parser_feed(JSON_Stream_Parser *parser, const char *chunk, size_t len);
+/* Signals end of input, returns JSONSuccess only if a complete value was parsed */
+JSON_Status json_stream_parser_finish(JSON_Stream_Parser *parser);
+int         json_stream_parser_is_done(const JSON_Stream_Parser *parser); /* 1 once first value is complete */
+void        json_stream_parser_free(JSON_Stream_Parser *parser);
+
+/* Incremental (push) parsing
+   Builds a JSON_Value from input fed in chunks, e.g. straight from a socket, so that
+   parsing overlaps with receiving. Feed returns JSONParseNeedMore until the first
+   value is complete. A top-level number can only be completed by
+   json_incremental_parser_finish. */
+typedef struct json_incremental_parser_t JSON_Incremental_Parser;
+
+enum json_parse_progress_t {
+    JSONParseError    = -1,
+    JSONParseNeedMore = 0,
+    JSONParseComplete = 1
+};
+typedef int JSON_Parse_Progress;
+
+JSON_Incremental_Parser * json_incremental_parser_init(void);
+JSON_Parse_Progress json_incremental_parser_feed(JSON_Incremental_Parser *parser, const char *chunk, size_t len);
+JSON_Parse_Progress json_incremental_parser_finish(JSON_Incremental_Parser *parser);
+/* Returns parsed value (to be freed with json_value_free) once complete, NULL otherwise */
+JSON_Value *        json_incremental_parser_take_value(JSON_Incremental_Parser *parser);
+void                json_incremental_parser_free(JSON_Incremental_Parser *parser);
+
+/* Serialization
+   json_serialize_to_string* write in a single pass into a growing buffer, only the
+   fixed size json_serialize_to_buffer* functions need json_serialization_size first. */
 size_t      json_serialization_size(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
 JSON_Status json_serialize_to_file(const JSON_Value *value, const char *filename);
 char *      json_serialize_to_string(const JSON_Value *value);
+char *      json_serialize_to_string_with_len(const JSON_Value *value, size_t *len); /* len doesn't account for last null character */
 
 /* Pretty serialization */
 size_t      json_serialization_size_pretty(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
 JSON_Status json_serialize_to_file_pretty(const JSON_Value *value, const char *filename);
 char *      json_serialize_to_string_pretty(const JSON_Value *value);
+char *      json_serialize_to_string_pretty_with_len(const JSON_Value *value, size_t *len); /* len doesn't account for last null character */
 
 void        json_free_serialized_string(char *string); /* frees string from json_serialize_to_string and json_serialize_to_string_pretty */
 
+/* Sink serialization
+   Output is passed to write in chunks through a small fixed buffer, so memory use
+   doesn't depend on the size of the output (json_serialize_to_file* are built on it).
+   json_serialize_to_file* write to filename.tmp and rename it over filename when done,
+   so on failure the previous contents of filename are left untouched.
+   Serialization stops with JSONFailure as soon as write doesn't return JSONSuccess. */
+typedef JSON_Status (*JSON_Write_Function)(void *context, const char *data, size_t len);
+
+JSON_Status json_serialize_to_sink(const JSON_Value *value, JSON_Write_Function write, void *context);
+JSON_Status json_serialize_to_sink_pretty(const JSON_Value *value, JSON_Write_Function write, void *context);
+
 /* Comparing */
 int  json_value_equals(const JSON_Value *a, const JSON_Value *b);
 
@@ -133,6 +236,16 @@ int  json_value_equals(const JSON_Value *a, const JSON_Value *b);
  */
 JSON_Status json_validate(const JSON_Value *schema, const JSON_Value *value);
 
+/* Compiled validation
+   Flattens a schema (same rules as json_validate) into a program that checks values in
+   a single pass, with member names hashed once at compile time. The schema value isn't
+   referenced after compilation. */
+typedef struct json_schema_t JSON_Schema;
+
+JSON_Schema * json_schema_compile (const JSON_Value *schema); /* returns NULL on fail */
+void          json_schema_free    (JSON_Schema *schema);
+JSON_Status   json_schema_validate(const JSON_Schema *schema, const JSON_Value *value);
+
 /*
  * JSON Object
  */
@@ -144,6 +257,24 @@ JSON_Array  * json_object_get_array  (const JSON_Object *object, const char *nam
 double        json_object_get_number (const JSON_Object *object, const char *name); /* returns 0 on fail */
 int           json_object_get_boolean(const JSON_Object *object, const char *name); /* returns -1 on fail */
 
+/* Key handles store a name together with its length and hash, so looking up the same
+   field in many objects doesn't recompute them. Create once (e.g. at startup) with
+   json_key_make, the name isn't copied and has to outlive the handle. */
+typedef struct json_key_t {
+    const char    *name;
+    size_t         len;
+    unsigned long  hash;
+} JSON_Key;
+
+JSON_Key      json_key_make(const char *name);
+JSON_Value  * json_object_get_value_by_key  (const JSON_Object *object, const JSON_Key *key);
+const char  * json_object_get_string_by_key (const JSON_Object *object, const JSON_Key *key);
+size_t        json_object_get_string_len_by_key(const JSON_Object *object, const JSON_Key *key); /* doesn't account for last null character */
+JSON_Object * json_object_get_object_by_key (const JSON_Object *object, const JSON_Key *key);
+JSON_Array  * json_object_get_array_by_key  (const JSON_Object *object, const JSON_Key *key);
+double        json_object_get_number_by_key (const JSON_Object *object, const JSON_Key *key); /* returns 0 on fail */
+int           json_object_get_boolean_by_key(const JSON_Object *object, const JSON_Key *key); /* returns -1 on fail */
+
 /* dotget functions enable addressing values with dot notation in nested objects,
  just like in structs or c++/java/c# objects (e.g. objectA.objectB.value).
  Because valid names in JSON can contain dots, some values may be inaccessible
@@ -156,6 +287,69 @@ JSON_Array  * json_object_dotget_array  (const JSON_Object *object, const char *
 double        json_object_dotget_number (const JSON_Object *object, const char *name); /* returns 0 on fail */
 int           json_object_dotget_boolean(const JSON_Object *object, const char *name); /* returns -1 on fail */
 
+/* Compiled paths
+   Expressions like "books[*].author" or "$[0].title" are parsed once by json_path_compile
+   and can then be evaluated many times, keys are hashed at compile time.
+   Names are separated by dots, [n] indexes arrays, [*] and * match every array element
+   or object member, ["a.b"] quotes names containing dots or brackets. Leading $ is optional.
+   The path has to outlive parsers created with json_path_stream_parser_init. */
+typedef struct json_path_t JSON_Path;
+typedef JSON_Status (*JSON_Path_Match_Function)(const JSON_Value *value, void *context);
+
+JSON_Path  * json_path_compile(const char *expression); /* returns NULL on syntax error */
+void         json_path_free(JSON_Path *path);
+/* Calls match for every matching value in document order, returning JSONFailure from match stops evaluation */
+JSON_Status  json_path_evaluate(const JSON_Path *path, const JSON_Value *value, JSON_Path_Match_Function match, void *context);
+JSON_Value * json_path_get_value(const JSON_Path *path, const JSON_Value *value); /* first match, NULL if none */
+/* Streaming parser that reports only events of matching values, each match as a
+   complete value, without building any JSON_Value. Free with json_stream_parser_free. */
+JSON_Stream_Parser * json_path_stream_parser_init(const JSON_Path *path, const JSON_Stream_Callbacks *callbacks, void *context);
+
+/* Binary encoding
+   Values are encoded as CBOR (RFC 8949): integral numbers up to 2^53 as integers, other
+   numbers as single or double precision floats, strings as text and containers with
+   definite lengths. Non-empty objects and arrays are additionally wrapped as encoded
+   data items (tag 24), a byte string prefix that lets readers jump over them.
+   Decoding accepts any CBOR with a JSON equivalent: other tags are ignored, byte strings,
+   indefinite lengths, infinities, NaN and simple values other than false, true and null
+   fail. Like json_parse_string, only the first value is decoded. */
+unsigned char * json_cbor_encode(const JSON_Value *value, size_t *len); /* free with json_cbor_free */
+JSON_Status     json_cbor_encode_to_file(const JSON_Value *value, const char *filename);
+void            json_cbor_free(unsigned char *data);
+JSON_Value *    json_cbor_decode(const unsigned char *data, size_t len);
+JSON_Value *    json_cbor_decode_file(const char *filename);
+
+/* Pull reader over encoded data, which has to outlive the reader.
+   Values are read one at a time: in objects, read_key has to come before each value,
+   enter descends into the next object or array and leave returns to its parent from any
+   member, skipping the rest. Skipping a container costs one jump when it is length
+   prefixed. Keys and strings point into the data and aren't NUL terminated.
+   After malformed input every call fails. */
+typedef struct json_cbor_reader_t JSON_CBOR_Reader;
+
+JSON_CBOR_Reader * json_cbor_reader_init(const unsigned char *data, size_t len);
+void               json_cbor_reader_free(JSON_CBOR_Reader *reader);
+JSON_Value_Type    json_cbor_reader_peek(JSON_CBOR_Reader *reader); /* JSONError at the end of a container or of the data */
+const char *       json_cbor_reader_read_key(JSON_CBOR_Reader *reader, size_t *len);
+JSON_Status        json_cbor_reader_enter(JSON_CBOR_Reader *reader, size_t *count); /* count of members, can be NULL */
+JSON_Status        json_cbor_reader_leave(JSON_CBOR_Reader *reader);
+JSON_Status        json_cbor_reader_skip(JSON_CBOR_Reader *reader);
+const char *       json_cbor_reader_read_string(JSON_CBOR_Reader *reader, size_t *len);
+JSON_Status        json_cbor_reader_read_number(JSON_CBOR_Reader *reader, double *number);
+JSON_Status        json_cbor_reader_read_boolean(JSON_CBOR_Reader *reader, int *boolean);
+JSON_Value *       json_cbor_reader_read_value(JSON_CBOR_Reader *reader); /* decodes the next value */
+
+/* JSON Patch (RFC 6902)
+   json_diff returns an array of operations turning from into to, NULL on fail.
+   If id_key isn't NULL, arrays whose elements are all objects with a unique string or
+   number member id_key are matched by that id, so inserted, removed or reordered
+   elements give add, remove and move operations instead of rewriting every index
+   after the first change; other arrays are compared index by index.
+   json_patch_apply returns a patched copy of value (free with json_value_free), or NULL
+   if any operation fails, in which case nothing is applied. */
+JSON_Value * json_diff(const JSON_Value *from, const JSON_Value *to, const char *id_key);
+JSON_Value * json_patch_apply(const JSON_Value *value, const JSON_Value *patch);
+
 /* Functions to get available names */
 size_t        json_object_get_count   (const JSON_Object *object);
 const char  * json_object_get_name    (const JSON_Object *object, size_t index);
@@ -249,6 +443,23 @@ JSON_Value * json_value_init_null   (void);
 JSON_Value * json_value_deep_copy   (const JSON_Value *value);
 void         json_value_free        (JSON_Value *value);
 
+/* Reference sharing, a cheap alternative to json_value_deep_copy for read-only use.
+ * json_value_share adds a reference to value (or to a value nested in a tree) and
+ * returns the same pointer, or NULL if the count would overflow. Every reference,
+ * including the original owner's, is dropped with json_value_free; memory is
+ * released once the last one is gone. While any reference beyond the owner's is
+ * outstanding, the value and everything nested in it is read-only: the set, append,
+ * replace, remove and clear functions return JSONFailure.
+ * json_value_unshare gives the caller a private, mutable value: it returns value
+ * itself when it isn't shared, otherwise a deep copy whose ownership passes to the
+ * caller while the caller's reference to value is dropped (NULL if the copy fails,
+ * in which case the reference is kept).
+ * Reference counts are not atomic, so shared values must not be freed from
+ * multiple threads concurrently. */
+JSON_Value * json_value_share       (JSON_Value *value);
+JSON_Value * json_value_unshare     (JSON_Value *value);
+int          json_value_is_shared   (const JSON_Value *value); /* true if value or any of its parents is shared */
+
 JSON_Value_Type json_value_get_type   (const JSON_Value *value);
 JSON_Object *   json_value_get_object (const JSON_Value *value);
 JSON_Array  *   json_value_get_array  (const JSON_Value *value);
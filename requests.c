@@ -9,7 +9,26 @@
 #include "helpers.h"
 #include "requests.h"
 
+// Adds the header "name: value" to message, unless it doesn't fit in a line
+// or in what is left of the message (the final new line included)
+static void compute_optional_header(char *message, char *line,
+                                    const char *name, const char *value) {
+  int size = snprintf(line, LINELEN, "%s: %s", name, value);
+
+  if (size < 0 || size >= LINELEN ||
+      strlen(message) + size + 2 * strlen("\r\n") >= BUFLEN) {
+    return;
+  }
+
+  compute_message(message, line);
+}
+
 char *compute_get_request(char *host, char *url, char *cookies, char *token) {
+  return compute_conditional_get_request(host, url, cookies, token, NULL, NULL);
+}
+
+char *compute_conditional_get_request(char *host, char *url, char *cookies, char *token,
+                                      const char *etag, const char *last_modified) {
   char *message = (char *)calloc(BUFLEN, sizeof(char));
   char *line = (char *)calloc(LINELEN, sizeof(char));
 
@@ -34,6 +53,16 @@ char *compute_get_request(char *host, char *url, char *cookies, char *token) {
     compute_message(message, line);
   }
 
+  // Add the validators of the cached response; they come from the server,
+  // so the ones too long to send are left out and the response is refetched
+  if (etag) {
+    compute_optional_header(message, line, "If-None-Match", etag);
+  }
+
+  if (last_modified) {
+    compute_optional_header(message, line, "If-Modified-Since", last_modified);
+  }
+
   // Add final new line
   compute_message(message, "");
   free(line);
@@ -42,8 +71,8 @@ char *compute_get_request(char *host, char *url, char *cookies, char *token) {
 }
 
 
-char *compute_post_request(char *host, char *url, char* content_type, 
-                                            char *target, char *jwt) {
+char *compute_post_request_headers(char *host, char *url, char *content_type,
+                                   size_t content_length, char *jwt) {
     char *message = calloc(BUFLEN, sizeof(char));
     char *line = calloc(LINELEN, sizeof(char));
 
@@ -66,18 +95,23 @@ char *compute_post_request(char *host, char *url, char* content_type,
     compute_message(message, line);
 
     // adds payload length
-    int length = strlen(target);
-    sprintf(line, "Content-Length: %d", length);
+    sprintf(line, "Content-Length: %zu", content_length);
     compute_message(message, line);
 
     compute_message(message, "");   
 
+    free(line);
+    return message;
+}
+
+char *compute_post_request(char *host, char *url, char* content_type, 
+                                            char *target, char *jwt) {
+    char *message = compute_post_request_headers(host, url, content_type,
+                                                 strlen(target), jwt);
+
     // adds payload
-    memset(line, 0, LINELEN);
     strcat(message, target);
 
-
-    free(line);
     return message;
 }
 
@@ -1,10 +1,23 @@
 #ifndef _REQUESTS_
 #define _REQUESTS_
 
+#include <stddef.h>
+
 // computes and returns a GET request string (query_params
 // and cookies can be set to NULL if not needed)
 char *compute_get_request(char *host, char *url, char *cookies, char *token);
 
+// computes and returns a GET request string that the server answers with
+// 304 Not Modified if the resource still matches the ETag or hasn't changed
+// since Last-Modified (etag and last_modified can be NULL if not known)
+char *compute_conditional_get_request(char *host, char *url, char *cookies, char *token,
+                                      const char *etag, const char *last_modified);
+
+// computes and returns the headers of a POST request whose payload of
+// content_length bytes is sent separately (jwt can be NULL if not needed)
+char *compute_post_request_headers(char *host, char *url, char *content_type,
+                                   size_t content_length, char *jwt);
+
 // computes and returns a POST request string (cookies can be NULL if not needed)
 char *compute_post_request(char *host, char *url, char* content_type, 
                                             char *target, char *jwt);
@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include "session.h"
+#include "helpers.h"
+#include "parson.h"
+
+/*
+ * A session file is the session as a JSON object, encrypted and
+ * authenticated with ChaCha20-Poly1305 (RFC 8439):
+ *
+ *   | magic | format | nonce (12) | ciphertext | tag (16) |
+ *
+ * The magic number and the format are authenticated as associated data.
+ * The client links no crypto library, so both primitives are implemented
+ * here, following the reference code of the RFC.
+ */
+#define SESSION_MAGIC "LBSE"
+#define SESSION_FORMAT 1
+#define HEADER_SIZE 8
+#define KEY_SIZE 32
+#define NONCE_SIZE 12
+#define TAG_SIZE 16
+#define MAX_SESSION_SIZE 65536
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d) \
+    a += b; d ^= a; d = ROTL32(d, 16); \
+    c += d; b ^= c; b = ROTL32(b, 12); \
+    a += b; d ^= a; d = ROTL32(d, 8); \
+    c += d; b ^= c; b = ROTL32(b, 7)
+
+static uint32_t load32(const unsigned char *p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void store32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/* Clears secrets in a way the compiler can't optimize out */
+static void wipe(void *data, size_t size)
+{
+    volatile unsigned char *p = data;
+
+    while (size--) {
+        *p++ = 0;
+    }
+}
+
+static void chacha20_block(const unsigned char key[KEY_SIZE], uint32_t counter,
+                           const unsigned char nonce[NONCE_SIZE], unsigned char out[64])
+{
+    uint32_t state[16], x[16];
+
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) {
+        state[4 + i] = load32(key + 4 * i);
+    }
+    state[12] = counter;
+    for (int i = 0; i < 3; i++) {
+        state[13 + i] = load32(nonce + 4 * i);
+    }
+
+    memcpy(x, state, sizeof(x));
+    for (int i = 0; i < 10; i++) {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int i = 0; i < 16; i++) {
+        store32(out + 4 * i, x[i] + state[i]);
+    }
+    wipe(x, sizeof(x));
+    wipe(state, sizeof(state));
+}
+
+/* Encrypts or decrypts data in place, starting with block counter 1 */
+static void chacha20_xor(const unsigned char key[KEY_SIZE], const unsigned char nonce[NONCE_SIZE],
+                         unsigned char *data, size_t size)
+{
+    unsigned char stream[64];
+
+    for (uint32_t counter = 1; size > 0; counter++) {
+        size_t n = size < sizeof(stream) ? size : sizeof(stream);
+
+        chacha20_block(key, counter, nonce, stream);
+        for (size_t i = 0; i < n; i++) {
+            data[i] ^= stream[i];
+        }
+        data += n;
+        size -= n;
+    }
+    wipe(stream, sizeof(stream));
+}
+
+/* Poly1305 with 26 bit limbs; the AEAD pads every part of the message to
+   16 bytes, so it is only ever fed whole blocks */
+typedef struct {
+    uint32_t r[5];
+    uint32_t h[5];
+    uint32_t pad[4];
+} poly1305;
+
+static void poly1305_init(poly1305 *st, const unsigned char key[32])
+{
+    st->r[0] = load32(key + 0) & 0x3ffffff;
+    st->r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+    st->r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+    st->r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+    st->r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+    memset(st->h, 0, sizeof(st->h));
+    for (int i = 0; i < 4; i++) {
+        st->pad[i] = load32(key + 16 + 4 * i);
+    }
+}
+
+/* Absorbs data, zero padded to a whole number of blocks */
+static void poly1305_update(poly1305 *st, const unsigned char *data, size_t size)
+{
+    const uint32_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2], r3 = st->r[3], r4 = st->r[4];
+    const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], h3 = st->h[3], h4 = st->h[4];
+    unsigned char block[16];
+
+    while (size > 0) {
+        size_t n = size < 16 ? size : 16;
+
+        memset(block, 0, sizeof(block));
+        memcpy(block, data, n);
+        data += n;
+        size -= n;
+
+        h0 += load32(block + 0) & 0x3ffffff;
+        h1 += (load32(block + 3) >> 2) & 0x3ffffff;
+        h2 += (load32(block + 6) >> 4) & 0x3ffffff;
+        h3 += (load32(block + 9) >> 6) & 0x3ffffff;
+        h4 += (load32(block + 12) >> 8) | (1 << 24);
+
+        uint64_t d0 = (uint64_t) h0 * r0 + (uint64_t) h1 * s4 + (uint64_t) h2 * s3 + (uint64_t) h3 * s2 + (uint64_t) h4 * s1;
+        uint64_t d1 = (uint64_t) h0 * r1 + (uint64_t) h1 * r0 + (uint64_t) h2 * s4 + (uint64_t) h3 * s3 + (uint64_t) h4 * s2;
+        uint64_t d2 = (uint64_t) h0 * r2 + (uint64_t) h1 * r1 + (uint64_t) h2 * r0 + (uint64_t) h3 * s4 + (uint64_t) h4 * s3;
+        uint64_t d3 = (uint64_t) h0 * r3 + (uint64_t) h1 * r2 + (uint64_t) h2 * r1 + (uint64_t) h3 * r0 + (uint64_t) h4 * s4;
+        uint64_t d4 = (uint64_t) h0 * r4 + (uint64_t) h1 * r3 + (uint64_t) h2 * r2 + (uint64_t) h3 * r1 + (uint64_t) h4 * r0;
+
+        uint32_t c = d0 >> 26; h0 = d0 & 0x3ffffff;
+        d1 += c; c = d1 >> 26; h1 = d1 & 0x3ffffff;
+        d2 += c; c = d2 >> 26; h2 = d2 & 0x3ffffff;
+        d3 += c; c = d3 >> 26; h3 = d3 & 0x3ffffff;
+        d4 += c; c = d4 >> 26; h4 = d4 & 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+    }
+
+    st->h[0] = h0;
+    st->h[1] = h1;
+    st->h[2] = h2;
+    st->h[3] = h3;
+    st->h[4] = h4;
+}
+
+static void poly1305_finish(poly1305 *st, unsigned char tag[TAG_SIZE])
+{
+    uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], h3 = st->h[3], h4 = st->h[4];
+    uint32_t c, g0, g1, g2, g3, g4, mask;
+    uint64_t f;
+
+    c = h1 >> 26; h1 &= 0x3ffffff;
+    h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+    h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+    h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    /* h - p, kept if it doesn't borrow */
+    g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+    g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+    g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+    g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+    g4 = h4 + c - (1u << 26);
+
+    mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    h0 = h0 | (h1 << 26);
+    h1 = (h1 >> 6) | (h2 << 20);
+    h2 = (h2 >> 12) | (h3 << 14);
+    h3 = (h3 >> 18) | (h4 << 8);
+
+    f = (uint64_t) h0 + st->pad[0]; store32(tag + 0, f);
+    f = (uint64_t) h1 + st->pad[1] + (f >> 32); store32(tag + 4, f);
+    f = (uint64_t) h2 + st->pad[2] + (f >> 32); store32(tag + 8, f);
+    f = (uint64_t) h3 + st->pad[3] + (f >> 32); store32(tag + 12, f);
+
+    wipe(st, sizeof(*st));
+}
+
+/* Computes the tag of the associated data and the ciphertext */
+static void aead_tag(const unsigned char key[KEY_SIZE], const unsigned char nonce[NONCE_SIZE],
+                     const unsigned char *aad, size_t aad_size,
+                     const unsigned char *ciphertext, size_t size, unsigned char tag[TAG_SIZE])
+{
+    unsigned char block[64];
+    unsigned char lengths[16];
+    poly1305 st;
+
+    chacha20_block(key, 0, nonce, block);
+    poly1305_init(&st, block);
+    wipe(block, sizeof(block));
+
+    store32(lengths, aad_size);
+    store32(lengths + 4, (uint64_t) aad_size >> 32);
+    store32(lengths + 8, size);
+    store32(lengths + 12, (uint64_t) size >> 32);
+
+    poly1305_update(&st, aad, aad_size);
+    poly1305_update(&st, ciphertext, size);
+    poly1305_update(&st, lengths, sizeof(lengths));
+    poly1305_finish(&st, tag);
+}
+
+/* Reads the key from the environment, returns -1 if it isn't set or valid */
+static int read_key(unsigned char key[KEY_SIZE])
+{
+    const char *hex = getenv(SESSION_KEY_VARIABLE);
+
+    if (hex == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < 2 * KEY_SIZE; i++) {
+        int digit;
+        char c = hex[i];
+
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            digit = -1;
+        }
+
+        if (digit < 0) {
+            fprintf(stderr, "Warning: %s must be %d hex digits, the session isn't saved.\n",
+                    SESSION_KEY_VARIABLE, 2 * KEY_SIZE);
+            wipe(key, KEY_SIZE);
+            return -1;
+        }
+        key[i / 2] = i % 2 ? key[i / 2] | digit : digit << 4;
+    }
+
+    if (hex[2 * KEY_SIZE] != '\0') {
+        fprintf(stderr, "Warning: %s must be %d hex digits, the session isn't saved.\n",
+                SESSION_KEY_VARIABLE, 2 * KEY_SIZE);
+        wipe(key, KEY_SIZE);
+        return -1;
+    }
+
+    return 0;
+}
+
+static char *copy_string(JSON_Object *object, const char *name)
+{
+    const char *string = json_object_get_string(object, name);
+
+    return string ? strdup(string) : NULL;
+}
+
+int session_load(const char *path, char **user, char **cookie, char **jwt)
+{
+    unsigned char key[KEY_SIZE];
+    unsigned char tag[TAG_SIZE];
+    unsigned char *file = NULL;
+    struct stat st;
+    int status = -1;
+
+    *user = *cookie = *jwt = NULL;
+
+    if (read_key(key) < 0) {
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0 && fstat(fd, &st) == 0
+        && st.st_size >= HEADER_SIZE + NONCE_SIZE + TAG_SIZE && st.st_size <= MAX_SESSION_SIZE
+        && (file = malloc(st.st_size + 1)) != NULL
+        && read(fd, file, st.st_size) == st.st_size
+        && memcmp(file, SESSION_MAGIC, 4) == 0 && load32(file + 4) == SESSION_FORMAT) {
+        unsigned char *nonce = file + HEADER_SIZE;
+        unsigned char *text = nonce + NONCE_SIZE;
+        size_t size = st.st_size - HEADER_SIZE - NONCE_SIZE - TAG_SIZE;
+        unsigned char diff = 0;
+
+        /* compare the whole tag, so the time taken doesn't tell how much matched */
+        aead_tag(key, nonce, file, HEADER_SIZE, text, size, tag);
+        for (int i = 0; i < TAG_SIZE; i++) {
+            diff |= tag[i] ^ text[size + i];
+        }
+
+        if (diff == 0) {
+            chacha20_xor(key, nonce, text, size);
+            text[size] = '\0';
+
+            JSON_Value *value = json_parse_string((const char *) text);
+            JSON_Object *object = json_object(value);
+            *user = copy_string(object, "user");
+            *cookie = copy_string(object, "cookie");
+            *jwt = copy_string(object, "jwt");
+            json_value_free(value);
+            wipe(text, size);
+
+            status = *user && *cookie ? 0 : -1;
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(file);
+    wipe(key, sizeof(key));
+
+    if (status < 0) {
+        free(*user);
+        free(*cookie);
+        free(*jwt);
+        *user = *cookie = *jwt = NULL;
+    }
+
+    return status;
+}
+
+int session_save(const char *path, const char *user, const char *cookie, const char *jwt)
+{
+    unsigned char key[KEY_SIZE];
+    int status = -1;
+
+    if (read_key(key) < 0) {
+        return -1;
+    }
+
+    JSON_Value *value = json_value_init_object();
+    JSON_Object *object = json_object(value);
+    json_object_set_string(object, "user", user);
+    json_object_set_string(object, "cookie", cookie);
+    if (jwt) {
+        json_object_set_string(object, "jwt", jwt);
+    }
+    char *text = json_serialize_to_string(value);
+    json_value_free(value);
+
+    size_t size = text ? strlen(text) : 0;
+    size_t file_size = HEADER_SIZE + NONCE_SIZE + size + TAG_SIZE;
+    unsigned char *file = text ? malloc(file_size) : NULL;
+
+    /* a nonce is never reused with the same key, so it is random */
+    if (file != NULL && size + TAG_SIZE <= MAX_SESSION_SIZE
+        && getrandom(file + HEADER_SIZE, NONCE_SIZE, 0) == NONCE_SIZE) {
+        unsigned char *nonce = file + HEADER_SIZE;
+        unsigned char *ciphertext = nonce + NONCE_SIZE;
+
+        memcpy(file, SESSION_MAGIC, 4);
+        store32(file + 4, SESSION_FORMAT);
+        memcpy(ciphertext, text, size);
+        chacha20_xor(key, nonce, ciphertext, size);
+        aead_tag(key, nonce, file, HEADER_SIZE, ciphertext, size, ciphertext + size);
+
+        /* a crash leaves the old session */
+        struct iovec part = { file, file_size };
+        status = replace_file(path, &part, 1);
+    }
+
+    if (text) {
+        wipe(text, size);
+    }
+    json_free_serialized_string(text);
+    free(file);
+    wipe(key, sizeof(key));
+
+    return status;
+}
+
+void session_forget(const char *path)
+{
+    unlink(path);
+}
+
+/* Decodes base64url without padding, returns the decoded size or -1 */
+static long base64url_decode(const char *in, size_t size, unsigned char *out)
+{
+    unsigned int bits = 0;
+    int count = 0;
+    long written = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        char c = in[i];
+        int digit;
+
+        if (c >= 'A' && c <= 'Z') {
+            digit = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            digit = c - 'a' + 26;
+        } else if (c >= '0' && c <= '9') {
+            digit = c - '0' + 52;
+        } else if (c == '-') {
+            digit = 62;
+        } else if (c == '_') {
+            digit = 63;
+        } else if (c == '=') {
+            break;
+        } else {
+            return -1;
+        }
+
+        bits = (bits << 6) | digit;
+        count += 6;
+        if (count >= 8) {
+            count -= 8;
+            out[written++] = (bits >> count) & 0xff;
+        }
+    }
+
+    return written;
+}
+
+time_t jwt_expiry(const char *jwt)
+{
+    /* header.payload.signature, only the payload is needed */
+    const char *payload = jwt ? strchr(jwt, '.') : NULL;
+    const char *end = payload ? strchr(payload + 1, '.') : NULL;
+    time_t expiry = 0;
+
+    if (end == NULL) {
+        return 0;
+    }
+    payload++;
+
+    size_t size = end - payload;
+    char *json = malloc(size + 1);
+    long decoded = json ? base64url_decode(payload, size, (unsigned char *) json) : -1;
+
+    if (decoded >= 0) {
+        json[decoded] = '\0';
+        JSON_Value *claims = json_parse_string(json);
+        JSON_Value *exp = json_object_get_value(json_object(claims), "exp");
+        if (json_value_get_type(exp) == JSONNumber) {
+            expiry = (time_t) json_value_get_number(exp);
+        }
+        json_value_free(claims);
+    }
+
+    free(json);
+
+    return expiry;
+}
+
+int jwt_expired(const char *jwt)
+{
+    time_t expiry = jwt_expiry(jwt);
+
+    /* without an exp claim only the server can tell */
+    return expiry != 0 && time(NULL) >= expiry - SESSION_EXPIRY_MARGIN;
+}
@@ -0,0 +1,32 @@
+#ifndef _SESSION_
+#define _SESSION_
+
+#include <time.h>
+
+// environment variable holding the key the session file is encrypted with,
+// as 64 hex digits; sessions are only saved and restored when it is set
+#define SESSION_KEY_VARIABLE "LIBRARY_SESSION_KEY"
+
+// seconds before its exp claim a token is already treated as expired,
+// to cover the time the request takes and clock skew
+#define SESSION_EXPIRY_MARGIN 30
+
+// decrypts a session file into newly allocated strings (*jwt is NULL if the
+// library wasn't entered); returns -1 if there is no key or no file, or if
+// the file was encrypted with another key or tampered with
+int session_load(const char *path, char **user, char **cookie, char **jwt);
+
+// encrypts a session (jwt can be NULL) and atomically replaces the session
+// file with it; returns -1 if there is no key or it couldn't be saved
+int session_save(const char *path, const char *user, const char *cookie, const char *jwt);
+
+// deletes a session file
+void session_forget(const char *path);
+
+// returns the exp claim of a JWT, 0 if it has none or can't be decoded
+time_t jwt_expiry(const char *jwt);
+
+// checks if a JWT is known to be expired, or about to expire
+int jwt_expired(const char *jwt);
+
+#endif
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "store.h"
+#include "helpers.h"
+
+/*
+ * A store file is a header, an array of fixed size records and the
+ * strings they point to, each stored once and null terminated:
+ *
+ *   | store_header | store_record * count | strings_size bytes |
+ *
+ * Numbers are in the byte order of the machine that wrote the file, the
+ * magic number doesn't match when it is read on another one.
+ */
+#define STORE_MAGIC 0x4c425354u   /* "LBST" */
+#define NO_STRING UINT32_MAX
+#define STRINGS_STARTING_CAPACITY 4096
+
+struct store_header {
+    uint32_t magic;
+    uint32_t format;
+    uint32_t count;
+    uint32_t strings_size;
+    uint32_t checksum;      /* of everything after the header */
+    uint32_t owner;         /* offsets into the strings */
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct store_record {
+    int64_t confirmed_at;
+    int32_t id;
+    int32_t page_count;
+    uint32_t fields;
+    uint32_t detailed;
+    uint32_t strings[4];    /* title, author, publisher, genre */
+};
+
+/* Returns the string at offset, NULL if it isn't inside the strings */
+static const char *string_at(const char *strings, uint32_t size, uint32_t offset)
+{
+    if (offset >= size) {
+        return NULL;
+    }
+
+    return memchr(strings + offset, '\0', size - offset) ? strings + offset : NULL;
+}
+
+static int load_image(const unsigned char *image, size_t size, const char *owner, catalog *catalog)
+{
+    const struct store_header *header = (const struct store_header *) image;
+
+    if (size < sizeof(*header) || header->magic != STORE_MAGIC || header->format != STORE_FORMAT) {
+        return -1;
+    }
+
+    const struct store_record *records = (const struct store_record *) (header + 1);
+
+    if (header->count > (size - sizeof(*header)) / sizeof(*records)
+        || header->strings_size != size - sizeof(*header) - header->count * sizeof(*records)
+        || header->checksum != (uint32_t) hash_bytes(HASH_SEED, header + 1, size - sizeof(*header))) {
+        return -1;
+    }
+
+    const char *strings = (const char *) (records + header->count);
+
+    const char *stored_owner = string_at(strings, header->strings_size, header->owner);
+    if (stored_owner == NULL || strcmp(stored_owner, owner) != 0) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < header->count; i++) {
+        book book = { 0 };
+
+        book.id = records[i].id;
+        book.page_count = records[i].page_count;
+        book.fields = records[i].fields & (BOOK_ID | BOOK_PAGE_COUNT);
+
+        for (size_t j = 0; j < BOOK_STRING_FIELD_COUNT; j++) {
+            if (records[i].strings[j] == NO_STRING) {
+                continue;
+            }
+            const char *string = string_at(strings, header->strings_size, records[i].strings[j]);
+            if (string == NULL) {
+                return -1;
+            }
+            BOOK_STRING(&book, book_string_fields[j].offset) = string;
+            book.fields |= book_string_fields[j].flag;
+        }
+
+        if (catalog_insert(catalog, &book, records[i].detailed != 0, (time_t) records[i].confirmed_at) < 0) {
+            return -1;
+        }
+    }
+
+    if (header->version != NO_STRING) {
+        catalog_set_version(catalog, string_at(strings, header->strings_size, header->version));
+    }
+
+    /* the books may have changed since they were saved, until the server says otherwise */
+    catalog->unrevalidated = 1;
+
+    return 0;
+}
+
+int store_load(const char *path, const char *owner, catalog *catalog)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(struct store_header)) {
+        close(fd);
+        return -1;
+    }
+
+    void *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return -1;
+    }
+
+    catalog_clear(catalog);
+    int status = load_image(image, st.st_size, owner, catalog);
+    munmap(image, st.st_size);
+
+    /* never keep half of a damaged file */
+    if (status < 0) {
+        catalog_clear(catalog);
+    }
+
+    return status;
+}
+
+/* The image of a store file while it is built */
+typedef struct {
+    struct store_record *records;
+    size_t count;
+    char *strings;
+    size_t strings_size;
+    size_t strings_capacity;
+    uint32_t *interned;     /* hash table of offsets of the strings, + 1 */
+    size_t interned_capacity;
+    int failed;
+} store_image;
+
+/* Returns the offset of string in the image, adding it the first time
+   (authors, genres and publishers repeat across books) */
+static uint32_t add_string(store_image *image, const char *string)
+{
+    size_t len = strlen(string);
+    size_t slot = hash_string(string) & (image->interned_capacity - 1);
+
+    while (image->interned[slot] != 0) {
+        uint32_t offset = image->interned[slot] - 1;
+        if (strcmp(image->strings + offset, string) == 0) {
+            return offset;
+        }
+        slot = (slot + 1) & (image->interned_capacity - 1);
+    }
+
+    if (image->strings_size + len + 1 > image->strings_capacity) {
+        size_t capacity = image->strings_capacity * 2;
+        while (capacity < image->strings_size + len + 1) {
+            capacity *= 2;
+        }
+
+        /* offsets are 32 bits */
+        char *strings = capacity < NO_STRING ? realloc(image->strings, capacity) : NULL;
+        if (strings == NULL) {
+            image->failed = 1;
+            return NO_STRING;
+        }
+        image->strings = strings;
+        image->strings_capacity = capacity;
+    }
+
+    uint32_t offset = image->strings_size;
+    memcpy(image->strings + offset, string, len + 1);
+    image->strings_size += len + 1;
+    image->interned[slot] = offset + 1;
+
+    return offset;
+}
+
+static void add_entry(const catalog_entry *entry, void *context)
+{
+    store_image *image = context;
+    struct store_record *record = &image->records[image->count++];
+
+    memset(record, 0, sizeof(*record));
+    record->confirmed_at = entry->confirmed_at;
+    record->id = entry->book.id;
+    record->page_count = entry->book.page_count;
+    record->fields = entry->book.fields;
+    record->detailed = entry->detailed;
+
+    for (size_t i = 0; i < BOOK_STRING_FIELD_COUNT; i++) {
+        record->strings[i] = entry->book.fields & book_string_fields[i].flag
+                           ? add_string(image, BOOK_STRING(&entry->book, book_string_fields[i].offset))
+                           : NO_STRING;
+    }
+}
+
+int store_save(const char *path, const char *owner, const catalog *catalog)
+{
+    struct store_header header = { 0 };
+    store_image image = { 0 };
+    int status = -1;
+
+    image.records = malloc((catalog->count ? catalog->count : 1) * sizeof(struct store_record));
+    image.strings = malloc(STRINGS_STARTING_CAPACITY);
+    image.strings_capacity = STRINGS_STARTING_CAPACITY;
+    image.interned_capacity = 64;
+    while (image.interned_capacity < (catalog->count * BOOK_STRING_FIELD_COUNT + 2) * 2) {
+        image.interned_capacity *= 2;
+    }
+    image.interned = calloc(image.interned_capacity, sizeof(uint32_t));
+
+    if (image.records != NULL && image.strings != NULL && image.interned != NULL) {
+        header.magic = STORE_MAGIC;
+        header.format = STORE_FORMAT;
+        header.owner = add_string(&image, owner);
+        header.version = catalog->version ? add_string(&image, catalog->version) : NO_STRING;
+        catalog_visit(catalog, add_entry, &image);
+    }
+
+    if (image.records != NULL && image.strings != NULL && image.interned != NULL && !image.failed) {
+        header.count = image.count;
+        header.strings_size = image.strings_size;
+
+        /* the low 32 bits of the FNV-1a hash, as the format has always stored */
+        header.checksum = (uint32_t) hash_bytes(hash_bytes(HASH_SEED, image.records,
+                                                           image.count * sizeof(struct store_record)),
+                                                image.strings, image.strings_size);
+
+        struct iovec parts[] = {
+            { &header, sizeof(header) },
+            { image.records, image.count * sizeof(struct store_record) },
+            { image.strings, image.strings_size },
+        };
+        status = replace_file(path, parts, sizeof(parts) / sizeof(parts[0]));
+    }
+
+    free(image.records);
+    free(image.strings);
+    free(image.interned);
+
+    return status;
+}
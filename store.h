@@ -0,0 +1,17 @@
+#ifndef _STORE_
+#define _STORE_
+
+#include "catalog.h"
+
+// format of the store files, bumped on every layout change
+#define STORE_FORMAT 1
+
+// maps a store file and adds its books to catalog if it was saved for
+// owner; returns -1 if it doesn't exist, is damaged or is someone else's
+int store_load(const char *path, const char *owner, catalog *catalog);
+
+// saves a catalog for owner, atomically replacing the previous file so
+// that a crash leaves either the old or the new one; returns -1 on failure
+int store_save(const char *path, const char *owner, const catalog *catalog);
+
+#endif
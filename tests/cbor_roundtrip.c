@@ -0,0 +1,234 @@
+/* Round trips JSON documents through the CBOR encoder and decoder and checks
+   that they match the text path. Run with make test. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parson.h"
+
+#define DEEP_NESTING 1000
+
+static int failures = 0;
+
+#define CHECK(condition, name) do {\
+                                   if (!(condition)) {\
+                                       printf("FAIL %s: %s (line %d)\n", (name), #condition, __LINE__);\
+                                       failures++;\
+                                   }\
+                               } while (0)
+
+static const char *fixtures[] = {
+    "null",
+    "true",
+    "false",
+    "0",
+    "-0",
+    "23",
+    "24",
+    "-25",
+    "255",
+    "65536",
+    "4294967296",
+    "9007199254740992",
+    "-9007199254740992",
+    "1.5",
+    "0.1",
+    "-2.75e-10",
+    "1e300",
+    "\"\"",
+    "\"text\"",
+    "\"caf\\u00e9 \\ud83d\\ude00 \\\"quoted\\\" \\n\"",
+    "[]",
+    "{}",
+    "[1, 2, 3]",
+    "{\"a\": 1, \"b\": [true, false, null], \"c\": {\"d\": \"e\", \"f\": {}}}",
+    "[[[]], {}, [{}], {\"empty\": []}]",
+    "{\"id\": 3, \"title\": \"Dune\", \"author\": \"Frank Herbert\", \"publisher\": \"Chilton\", "
+    "\"genre\": \"Science fiction\", \"page_count\": 412}",
+};
+
+/* Every non-empty container is wrapped as an encoded data item, tag 24 */
+static int is_tag24_wrapped(const unsigned char *data, size_t len) {
+    return len >= 3 && data[0] == 0xd8 && data[1] == 0x18 && (data[2] & 0xe0) == 0x40;
+}
+
+static void check_round_trip(const char *name, const JSON_Value *value) {
+    size_t len = 0;
+    unsigned char *data = json_cbor_encode(value, &len);
+    JSON_Value *decoded = NULL;
+    char *text = NULL, *decoded_text = NULL;
+    JSON_Value_Type type = json_value_get_type(value);
+    size_t count = 0;
+
+    CHECK(data != NULL && len > 0, name);
+    if (data == NULL) {
+        return;
+    }
+
+    if (type == JSONObject) {
+        count = json_object_get_count(json_value_get_object(value));
+    } else if (type == JSONArray) {
+        count = json_array_get_count(json_value_get_array(value));
+    }
+    if (count > 0) {
+        CHECK(is_tag24_wrapped(data, len), name);
+    }
+
+    decoded = json_cbor_decode(data, len);
+    CHECK(decoded != NULL, name);
+    CHECK(json_value_equals(value, decoded), name);
+
+    /* the text path gives the same document */
+    text = json_serialize_to_string(value);
+    decoded_text = json_serialize_to_string(decoded);
+    CHECK(text != NULL && decoded_text != NULL && strcmp(text, decoded_text) == 0, name);
+
+    /* every truncation is rejected */
+    for (size_t i = 0; i < len; i++) {
+        JSON_Value *truncated = json_cbor_decode(data, i);
+        CHECK(truncated == NULL, name);
+        json_value_free(truncated);
+    }
+
+    json_free_serialized_string(text);
+    json_free_serialized_string(decoded_text);
+    json_value_free(decoded);
+    json_cbor_free(data);
+}
+
+static void check_fixtures(void) {
+    for (size_t i = 0; i < sizeof(fixtures) / sizeof(fixtures[0]); i++) {
+        JSON_Value *value = json_parse_string(fixtures[i]);
+        CHECK(value != NULL, fixtures[i]);
+        if (value != NULL) {
+            check_round_trip(fixtures[i], value);
+        }
+        json_value_free(value);
+    }
+}
+
+static void check_deep_nesting(void) {
+    char *text = malloc(6 * DEEP_NESTING + 8);
+    size_t len = 0;
+
+    if (text == NULL) {
+        CHECK(text != NULL, "deep nesting");
+        return;
+    }
+
+    for (int i = 0; i < DEEP_NESTING; i++) {
+        text[len++] = i % 2 ? '[' : '{';
+        if (i % 2 == 0) {
+            memcpy(text + len, "\"k\":", 4);
+            len += 4;
+        }
+    }
+    text[len++] = '1';
+    for (int i = DEEP_NESTING - 1; i >= 0; i--) {
+        text[len++] = i % 2 ? ']' : '}';
+    }
+    text[len] = '\0';
+
+    JSON_Value *value = json_parse_string(text);
+    CHECK(value != NULL, "deep nesting");
+    if (value != NULL) {
+        check_round_trip("deep nesting", value);
+    }
+    json_value_free(value);
+    free(text);
+}
+
+static void check_file(void) {
+    const char *path = "tests/cbor_roundtrip.cbor";
+    JSON_Value *value = json_parse_string(fixtures[sizeof(fixtures) / sizeof(fixtures[0]) - 1]);
+    JSON_Value *decoded = NULL;
+
+    CHECK(json_cbor_encode_to_file(value, path) == JSONSuccess, "file");
+    decoded = json_cbor_decode_file(path);
+    CHECK(decoded != NULL && json_value_equals(value, decoded), "file");
+
+    remove(path);
+    json_value_free(decoded);
+    json_value_free(value);
+}
+
+/* Reads one member of an object after skipping a large subtree before it */
+static void check_skip_subtree(void) {
+    const char *name = "skip subtree";
+    JSON_Value *value = json_value_init_object();
+    JSON_Object *object = json_value_get_object(value);
+    JSON_Value *skipped = json_value_init_array();
+    JSON_Value *expected = json_parse_string("[1, \"two\", {\"three\": 3}]");
+    JSON_Value *read = NULL;
+    unsigned char *data = NULL;
+    const char *key = NULL, *string = NULL;
+    size_t len = 0, key_len = 0, string_len = 0, count = 0;
+    double number = 0;
+
+    for (int i = 0; i < 10000; i++) {
+        json_array_append_value(json_value_get_array(skipped),
+                                json_parse_string("{\"nested\": [1, 2, {\"deeper\": \"x\"}]}"));
+    }
+    json_object_set_value(object, "skipped", skipped);
+    json_object_set_value(object, "wanted", json_value_deep_copy(expected));
+    json_object_set_string(object, "after", "end");
+    json_object_set_number(object, "last", 42);
+
+    data = json_cbor_encode(value, &len);
+    CHECK(data != NULL, name);
+
+    JSON_CBOR_Reader *reader = json_cbor_reader_init(data, len);
+    CHECK(reader != NULL, name);
+    CHECK(json_cbor_reader_enter(reader, &count) == JSONSuccess && count == 4, name);
+
+    key = json_cbor_reader_read_key(reader, &key_len);
+    CHECK(key != NULL && key_len == 7 && memcmp(key, "skipped", 7) == 0, name);
+    CHECK(json_cbor_reader_peek(reader) == JSONArray, name);
+    CHECK(json_cbor_reader_skip(reader) == JSONSuccess, name);
+
+    key = json_cbor_reader_read_key(reader, &key_len);
+    CHECK(key != NULL && key_len == 6 && memcmp(key, "wanted", 6) == 0, name);
+    read = json_cbor_reader_read_value(reader);
+    CHECK(read != NULL && json_value_equals(read, expected), name);
+
+    key = json_cbor_reader_read_key(reader, &key_len);
+    CHECK(key != NULL && key_len == 5 && memcmp(key, "after", 5) == 0, name);
+    string = json_cbor_reader_read_string(reader, &string_len);
+    CHECK(string != NULL && string_len == 3 && memcmp(string, "end", 3) == 0, name);
+
+    key = json_cbor_reader_read_key(reader, &key_len);
+    CHECK(key != NULL && key_len == 4 && memcmp(key, "last", 4) == 0, name);
+    CHECK(json_cbor_reader_read_number(reader, &number) == JSONSuccess && number == 42, name);
+
+    CHECK(json_cbor_reader_peek(reader) == JSONError, name);
+    CHECK(json_cbor_reader_leave(reader) == JSONSuccess, name);
+
+    /* leave skips the rest of a container from any member */
+    json_cbor_reader_free(reader);
+    reader = json_cbor_reader_init(data, len);
+    CHECK(json_cbor_reader_enter(reader, NULL) == JSONSuccess, name);
+    key = json_cbor_reader_read_key(reader, &key_len);
+    CHECK(json_cbor_reader_enter(reader, NULL) == JSONSuccess, name);
+    CHECK(json_cbor_reader_leave(reader) == JSONSuccess, name);
+    key = json_cbor_reader_read_key(reader, &key_len);
+    CHECK(key != NULL && key_len == 6 && memcmp(key, "wanted", 6) == 0, name);
+
+    json_cbor_reader_free(reader);
+    json_value_free(read);
+    json_cbor_free(data);
+    json_value_free(expected);
+    json_value_free(value);
+}
+
+int main(void) {
+    check_fixtures();
+    check_deep_nesting();
+    check_file();
+    check_skip_subtree();
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("All CBOR round trips passed\n");
+    return EXIT_SUCCESS;
+}